@@ -0,0 +1,107 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Replaces malloc() and friends with wrappers that count the allocations
+ * of guarded threads, to check that the event path allocates nothing once
+ * the daemon is ready. Everything else goes straight to the C library's
+ * allocator, so an unguarded thread pays one thread-local test. Only with
+ * glibc, which exports its allocator under the __libc_ names. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "alloc.h"
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static __thread int alloc_guarded=0;
+static struct alloc_report_t alloc_seen;
+
+static void alloc_note(size_t size, void *caller);
+
+/* Record an allocation of a guarded thread. Must not allocate itself. */
+static void alloc_note(size_t size, void *caller)
+{
+	if (__sync_fetch_and_add(&alloc_seen.count, 1) == 0)
+	{
+		alloc_seen.size = size;
+		alloc_seen.caller = caller;
+	}
+}
+
+void *malloc(size_t size)
+{
+	if (alloc_guarded)
+		alloc_note(size, __builtin_return_address(0));
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (alloc_guarded)
+		alloc_note(nmemb * size, __builtin_return_address(0));
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (alloc_guarded)
+		alloc_note(size, __builtin_return_address(0));
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+	
+	if (alloc_guarded)
+		alloc_note(size, __builtin_return_address(0));
+	if ((ptr = __libc_memalign(alignment, size)) == NULL)
+		return ENOMEM;
+	*memptr = ptr;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	if (alloc_guarded)
+		alloc_note(size, __builtin_return_address(0));
+	return __libc_memalign(alignment, size);
+}
+
+/* Count the allocations of the calling thread from now on, or stop. Returns
+ * 0, or -1 if allocations cannot be counted with this C library. */
+int alloc_guard(int enable)
+{
+	alloc_guarded = enable;
+	return 0;
+}
+
+/* Allocations of guarded threads so far */
+void alloc_report(struct alloc_report_t *report)
+{
+	*report = alloc_seen;
+}
+
+#else
+
+int alloc_guard(int enable)
+{
+	(void) enable;
+	return -1;
+}
+
+void alloc_report(struct alloc_report_t *report)
+{
+	memset(report, 0, sizeof(*report));
+}
+
+#endif
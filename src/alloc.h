@@ -0,0 +1,21 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef ALLOC_H_
+#define ALLOC_H_
+
+#include <stddef.h>
+
+/* Allocations made by guarded threads */
+struct alloc_report_t {
+	unsigned long count;
+	size_t size;			/* Size of the first one */
+	void *caller;			/* Where the first one came from */
+};
+
+int alloc_guard(int enable);
+void alloc_report(struct alloc_report_t *report);
+
+#endif /*ALLOC_H_*/
@@ -0,0 +1,99 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ROUND(x)	(((x) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+/* A block of arena memory. Data follows the header. */
+struct arena_block_t {
+	struct arena_block_t *next;
+	size_t size;
+	size_t used;
+};
+
+struct arena_t {
+	struct arena_block_t *head;
+};
+
+/* Block header size, rounded so that the data stays aligned */
+#define ARENA_HEADER	ARENA_ROUND(sizeof(struct arena_block_t))
+
+static struct arena_block_t *arena_block_new(size_t size);
+
+static struct arena_block_t *arena_block_new(size_t size)
+{
+	struct arena_block_t *block;
+	
+	if (size < ARENA_BLOCK_SIZE)
+		size = ARENA_BLOCK_SIZE;
+	if ((block = (struct arena_block_t *) malloc(ARENA_HEADER + size)) == NULL)
+		return NULL;
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+/* Create an arena. The arena itself lives in its first block. */
+struct arena_t *arena_new(void)
+{
+	struct arena_block_t *block;
+	struct arena_t *arena;
+	
+	if ((block = arena_block_new(ARENA_BLOCK_SIZE)) == NULL)
+		return NULL;
+	arena = (struct arena_t *) ((char *) block + ARENA_HEADER);
+	block->used = ARENA_ROUND(sizeof(struct arena_t));
+	arena->head = block;
+	return arena;
+}
+
+/* Allocate zeroed memory from an arena */
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+	struct arena_block_t *block = arena->head;
+	void *ptr;
+	
+	size = ARENA_ROUND(size);
+	if (block->size - block->used < size)
+	{
+		if ((block = arena_block_new(size)) == NULL)
+			return NULL;
+		/* The first block, which holds the arena, stays last */
+		block->next = arena->head;
+		arena->head = block;
+	}
+	ptr = (char *) block + ARENA_HEADER + block->used;
+	block->used += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+char *arena_strdup(struct arena_t *arena, const char *str)
+{
+	char *copy;
+	
+	if ((copy = (char *) arena_alloc(arena, strlen(str) + 1)) != NULL)
+		strcpy(copy, str);
+	return copy;
+}
+
+/* Free an arena and everything allocated from it */
+void arena_free(struct arena_t *arena)
+{
+	struct arena_block_t *block, *next;
+	
+	if (arena == NULL)
+		return;
+	for (block = arena->head; block != NULL; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+}
@@ -0,0 +1,23 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE	4096
+#define ARENA_ALIGN			16
+
+/* A bump allocator. Everything allocated from an arena is freed at once
+ * with arena_free(). */
+struct arena_t;
+
+struct arena_t *arena_new(void);
+void *arena_alloc(struct arena_t *arena, size_t size);
+char *arena_strdup(struct arena_t *arena, const char *str);
+void arena_free(struct arena_t *arena);
+
+#endif /*ARENA_H_*/
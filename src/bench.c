@@ -0,0 +1,837 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* btnx-bench: replays synthetic traffic through the engine and reports
+ * what it costs. The configurations are generated into a temporary
+ * directory, nothing is installed or read from CONFIG_PATH, and uinput
+ * writes go to /dev/null. Run by make check with small counts; pass
+ * larger ones for numbers worth comparing.
+ * 
+ * With -l, a thread writes reports at a fixed rate into a pipe that the
+ * event loop reads like an event handler, and the system calls, CPU time
+ * and latency of the loop are reported. -r, -a and -p set up the loop like
+ * the daemon options of the same name, -L keeps that many CPU bound
+ * processes running next to it. -m scale or -m scroll holds a motion
+ * transform binding through the run, so that the motion goes through it.
+ * 
+ * The default run also scrolls a fast wheel, one notch a millisecond,
+ * with and without wheel_coalesce, and reports the uinput writes per
+ * notch. It fails if a notch is lost. Then it draws long mouse strokes
+ * at 1000 Hz and times the release that recognizes them.
+ * 
+ * With -P, config_parse() is timed over a generated configuration of that
+ * many bindings. -e copies an events file, such as data/events, in place
+ * of the generated one that only lists the codes the bench uses. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <linux/input.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "config_parser.h"
+#include "engine.h"
+#include "stats.h"
+#include "device.h"
+#include "evdev.h"
+#include "fixture.h"
+#include "realtime.h"
+#include "uinput.h"
+#include "uring.h"
+
+#define BENCH_EVENTS		2000000	/* Events replayed by default */
+#define BENCH_BINDINGS		8		/* Bindings of the generated configuration */
+#define BENCH_BATCH			4		/* Events of one handler read */
+#define BENCH_STEP_US		10000	/* Clock advance per read, past any delay */
+#define BENCH_NAME_SIZE		256
+#define BENCH_SECONDS		2		/* Length of a loop run */
+#define BENCH_PRESS_EVERY	64		/* Reports per button change of a loop run */
+#define BENCH_LOAD_MAX		16		/* Processes of the background load */
+#define BENCH_PARSE_RUNS	20		/* Parses of a -P run */
+#define BENCH_NOTCHES		1000	/* Wheel notches of a scroll run */
+#define BENCH_COALESCE		8		/* wheel_coalesce of a scroll run, in ms */
+#define BENCH_WHEEL_RAWCODE	((EV_REL << 24) | (1 << 16) | REL_WHEEL)
+#define BENCH_STROKES		100		/* Strokes of a stroke run */
+#define BENCH_STROKE_REPORTS	250	/* Motion reports per stroke direction */
+#define BENCH_MOTION_SCALE	150		/* motion_scale of -m scale */
+#define BENCH_MOTION_SCROLL	8		/* motion_scroll of -m scroll */
+
+#define BENCH_CODE(code)	{#code, code}
+
+/* Events file entries, the codes the generated bindings send */
+static const struct {
+	const char *name;
+	int value;
+} bench_codes[] = {
+	BENCH_CODE(KEY_A), BENCH_CODE(KEY_B), BENCH_CODE(KEY_C), BENCH_CODE(KEY_D),
+	BENCH_CODE(KEY_E), BENCH_CODE(KEY_F), BENCH_CODE(KEY_G), BENCH_CODE(KEY_H),
+	BENCH_CODE(KEY_PAGEUP), BENCH_CODE(KEY_PAGEDOWN), BENCH_CODE(KEY_BACK),
+	BENCH_CODE(KEY_FORWARD), BENCH_CODE(BTN_LEFT), BENCH_CODE(BTN_RIGHT),
+	BENCH_CODE(BTN_MIDDLE), BENCH_CODE(BTN_SIDE), BENCH_CODE(BTN_EXTRA),
+	BENCH_CODE(KEY_LEFTCTRL), BENCH_CODE(KEY_LEFTSHIFT), BENCH_CODE(KEY_LEFTALT)
+};
+
+#define BENCH_KEYS	((int) (sizeof(bench_codes) / sizeof(bench_codes[0])) - 3)
+
+/* Static variables */
+static struct timeval bench_now;					/* Time of the engine */
+static unsigned long bench_frames=0;
+static long bench_wheel=0;							/* REL_WHEEL sent */
+
+/* Producer of a loop run */
+struct bench_producer_t {
+	int fd;							/* Write end of the pipe */
+	int rate;						/* Reports per second */
+	int seconds;
+	long reports;					/* Reports written */
+};
+
+static void bench_clock(struct timeval *now);
+static void bench_frame(void *data, const btnx_frame *frame);
+static void bench_write(void *data, const btnx_frame *frame);
+static void bench_scroll_write(void *data, const btnx_frame *frame);
+static int bench_config(const char *name, int bindings, const char *motion);
+static int bench_rawcode(int index);
+static int bench_stream(hexdump_t **events, btnx_config *cfg);
+static double bench_cpu(void);
+static int bench_dispatch(btnx_config *cfg, long count, int write);
+static int bench_scroll(int window);
+static void bench_tick(int us);
+static int bench_stroke(void);
+static void *bench_produce(void *data);
+static long bench_syscalls(int reads);
+static int bench_compare(const void *a, const void *b);
+static int bench_loop(btnx_config *cfg, int rate, int seconds, int use_uring, int spin_us,
+                      int motion);
+static pid_t bench_load_start(void);
+static int bench_parse(int bindings);
+
+/* The bench creates no uinput devices */
+int open_handler(char *name, int flags)
+{
+	(void) name; (void) flags;
+	errno = ENODEV;
+	return -1;
+}
+
+static void bench_clock(struct timeval *now)
+{
+	*now = bench_now;
+}
+
+/* Sink of the engine-only run */
+static void bench_frame(void *data, const btnx_frame *frame)
+{
+	(void) data; (void) frame;
+	bench_frames++;
+}
+
+/* Sink of the run with the uinput writes */
+static void bench_write(void *data, const btnx_frame *frame)
+{
+	(void) data;
+	bench_frames++;
+	uinput_submit(frame);
+}
+
+/* Sink of the scroll run, which sums up the wheel steps */
+static void bench_scroll_write(void *data, const btnx_frame *frame)
+{
+	int i;
+	
+	for (i=0; i < frame->count[0] + frame->count[1]; i++)
+	{
+		if (frame->ev[i].type == EV_REL && frame->ev[i].code == REL_WHEEL)
+			bench_wheel += frame->ev[i].value;
+	}
+	bench_write(data, frame);
+}
+
+/* Generate a configuration with a mix of keys, keys with a modifier,
+ * mouse buttons and wheel steps. With motion, "scale" or "scroll", a
+ * motion transform binding follows them. */
+static int bench_config(const char *name, int bindings, const char *motion)
+{
+	char file[BENCH_NAME_SIZE];
+	FILE *fp;
+	int i;
+	
+	snprintf(file, sizeof(file), "%s_%s", CONFIG_NAME, name);
+	if ((fp = fixture_open(file)) == NULL)
+		return -1;
+	fprintf(fp, "Mouse\n\tvendor_id = 0x46d\n\tproduct_id = 0xc51a\nEndMouse\n");
+	for (i=0; i<bindings; i++)
+	{
+		fprintf(fp, "Button\n\tname = button%d\n\trawcode = 0x%08x\n", i, bench_rawcode(i));
+		if (i % 4 == 3)
+			fprintf(fp, "\tkeycode = %s\n", (i % 8 == 3) ? "REL_WHEELFORWARD" : "REL_WHEELBACK");
+		else
+			fprintf(fp, "\tkeycode = %s\n", bench_codes[i % BENCH_KEYS].name);
+		if (i % 4 == 1)
+			fprintf(fp, "\tmod1 = KEY_LEFTCTRL\n");
+		fprintf(fp, "\tdelay = 0\nEndButton\n");
+	}
+	if (motion != NULL)
+	{
+		fprintf(fp, "Button\n\tname = %s\n\trawcode = 0x%08x\n", motion,
+		        bench_rawcode(bindings));
+		if (strcmp(motion, "scroll") == 0)
+			fprintf(fp, "\tmotion_scroll = %d\n", BENCH_MOTION_SCROLL);
+		else
+			fprintf(fp, "\tmotion_scale = %d\n", BENCH_MOTION_SCALE);
+		fprintf(fp, "EndButton\n");
+	}
+	return fclose(fp);
+}
+
+/* Rawcode of a generated binding: the mouse buttons first, then codes
+ * no mouse sends, which only need to be distinct */
+static int bench_rawcode(int index)
+{
+	return (EV_KEY << 24) | ((BTN_MOUSE + index) & 0xFFFF);
+}
+
+/* Build the replayed traffic: a press and a release of every binding,
+ * each followed by some pointer motion. Returns the number of events. */
+static int bench_stream(hexdump_t **events, btnx_config *cfg)
+{
+	hexdump_t *ev;
+	int i, n=0;
+	
+	if ((ev = (hexdump_t *) calloc(cfg->count * 4, sizeof(hexdump_t))) == NULL)
+		return -1;
+	for (i=0; i<cfg->count * 2; i++)
+	{
+		ev[n].rawcode = cfg->hot[i / 2].rawcode;
+		ev[n++].pressed = !(i & 1);
+		ev[n].rawcode = (EV_REL << 24) | (((i & 1) ? 0xFE : 3) << 16) | REL_X;
+		ev[n++].pressed = (i & 1) ? -2 : 3;
+	}
+	*events = ev;
+	return n;
+}
+
+/* CPU time of the process in seconds */
+static double bench_cpu(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Replay count events in reads of BENCH_BATCH, running the timers after
+ * each read like the event loop does. With write, the frames go to
+ * /dev/null through uinput. */
+static int bench_dispatch(btnx_config *cfg, long count, int write)
+{
+	struct engine_sink_t sink = {bench_frame, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	hexdump_t *events;
+	double begin, cpu;
+	long done;
+	int n, i, j, len;
+	
+	if ((n = bench_stream(&events, cfg)) < 0)
+		return -1;
+	if (write)
+		sink.frame = bench_write;
+	engine_init(&engine, cfg, &sink, bench_clock, &btnx_stats);
+	stats_reset(&btnx_stats);
+	bench_frames = 0;
+	
+	begin = bench_cpu();
+	for (done=0, i=0; done<count; done+=len, i=(i + len) % n)
+	{
+		len = (n - i < BENCH_BATCH) ? n - i : BENCH_BATCH;
+		bench_now.tv_usec += BENCH_STEP_US;
+		if (bench_now.tv_usec >= 1000000)
+		{
+			bench_now.tv_sec++;
+			bench_now.tv_usec -= 1000000;
+		}
+		for (j=0; j<len; j++)
+			events[i + j].time = bench_now;
+		engine_feed(&engine, &events[i], len, 0);
+		engine_tick(&engine);
+	}
+	cpu = bench_cpu() - begin;
+	
+	printf("dispatch%s: %ld events, %d bindings, %.1f ns/event CPU, %lu frames, "
+	       "%lu matched\n", write ? " + write" : "", done, cfg->count, cpu * 1e9 / done,
+	       bench_frames, btnx_stats.events_matched);
+	free(events);
+	return 0;
+}
+
+/* Scroll BENCH_NOTCHES wheel notches, one per read and millisecond, with
+ * a merge window of window ms, or -1 for none. The frames go to /dev/null
+ * through uinput. Returns -1 if the steps sent do not add up to the
+ * notches. */
+static int bench_scroll(int window)
+{
+	struct engine_sink_t sink = {bench_scroll_write, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	btnx_config *cfg;
+	char name[16], file[BENCH_NAME_SIZE], option[BENCH_NAME_SIZE] = "";
+	char text[BENCH_NAME_SIZE * 2];
+	hexdump_t ev;
+	long writes;
+	int i;
+	
+	snprintf(name, sizeof(name), "scroll%d", window);
+	snprintf(file, sizeof(file), "%s_%s", CONFIG_NAME, name);
+	if (window >= 0)
+		snprintf(option, sizeof(option), "\twheel_coalesce = %d\n", window);
+	snprintf(text, sizeof(text), "Mouse\n\tvendor_id = 0x46d\n%sEndMouse\n"
+	         "Button\n\trawcode = 0x%08x\n\tkeycode = REL_WHEELFORWARD\n"
+	         "\tdelay = 0\nEndButton\n", option, BENCH_WHEEL_RAWCODE);
+	if (fixture_file(file, text) < 0 || (cfg = fixture_load(name)) == NULL)
+		return -1;
+	engine_init(&engine, cfg, &sink, bench_clock, &btnx_stats);
+	stats_reset(&btnx_stats);
+	bench_frames = 0;
+	bench_wheel = 0;
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.rawcode = BENCH_WHEEL_RAWCODE;
+	ev.pressed = 1;
+	writes = bench_syscalls(0);
+	for (i=0; i<BENCH_NOTCHES; i++)
+	{
+		bench_now.tv_usec += 1000;
+		if (bench_now.tv_usec >= 1000000)
+		{
+			bench_now.tv_sec++;
+			bench_now.tv_usec -= 1000000;
+		}
+		ev.time = bench_now;
+		engine_feed(&engine, &ev, 1, 0);
+		engine_tick(&engine);
+	}
+	bench_now.tv_sec++;
+	engine_tick(&engine);
+	writes = bench_syscalls(0) - writes;
+	
+	if (window < 0)
+		printf("scroll: ");
+	else
+		printf("scroll coalesced %d ms: ", window);
+	printf("%d notches at 1000/s, %lu frames, %ld writes, %.3f writes/notch, "
+	       "distance %ld\n", BENCH_NOTCHES, bench_frames, writes,
+	       (double) writes / BENCH_NOTCHES, bench_wheel);
+	config_free(cfg);
+	return (bench_wheel == BENCH_NOTCHES) ? 0 : -1;
+}
+
+/* Advance the time of the engine */
+static void bench_tick(int us)
+{
+	bench_now.tv_usec += us;
+	while (bench_now.tv_usec >= 1000000)
+	{
+		bench_now.tv_sec++;
+		bench_now.tv_usec -= 1000000;
+	}
+}
+
+/* Draw BENCH_STROKES strokes through all eight directions, each direction
+ * BENCH_STROKE_REPORTS reports of 1 ms, and time the release that matches
+ * them. The button has a stroke binding for each of the eight rotations
+ * of the path, and the drawn one is tried last. Returns -1 if a stroke is
+ * not matched. */
+static int bench_stroke(void)
+{
+	static const char *names[] = {"R", "DR", "D", "DL", "L", "UL", "U", "UR"};
+	static const int dx[] = {1, 1, 0, -1, -1, -1, 0, 1}, dy[] = {0, 1, 1, 1, 0, -1, -1, -1};
+	struct engine_sink_t sink = {bench_frame, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	struct timespec begin, end;
+	long ns[BENCH_STROKES];
+	btnx_config *cfg;
+	hexdump_t button, move[2];
+	FILE *fp;
+	int i, j, k;
+	
+	if ((fp = fixture_open(CONFIG_NAME "_stroke")) == NULL)
+		return -1;
+	fprintf(fp, "Mouse\n\tvendor_id = 0x46d\nEndMouse\n");
+	fprintf(fp, "Button\n\trawcode = 0x%08x\n\tkeycode = KEY_A\n\tdelay = 0\nEndButton\n",
+	        bench_rawcode(2));
+	for (i=7; i>=0; i--)
+	{
+		fprintf(fp, "Button\n\trawcode = 0x%08x\n\tkeycode = KEY_B\n\tstroke =",
+		        bench_rawcode(2));
+		for (j=0; j<8; j++)
+			fprintf(fp, " %s", names[(i + j) % 8]);
+		fprintf(fp, "\n\tdelay = 0\nEndButton\n");
+	}
+	if (fclose(fp) != 0 || (cfg = fixture_load("stroke")) == NULL)
+		return -1;
+	engine_init(&engine, cfg, &sink, bench_clock, &btnx_stats);
+	stats_reset(&btnx_stats);
+	
+	memset(&button, 0, sizeof(button));
+	memset(move, 0, sizeof(move));
+	button.rawcode = bench_rawcode(2);
+	for (i=0; i<BENCH_STROKES; i++)
+	{
+		bench_tick(BENCH_STEP_US);
+		button.pressed = 1;
+		button.time = bench_now;
+		engine_feed(&engine, &button, 1, 0);
+		for (j=0; j<8; j++)
+		{
+			move[0].rawcode = (EV_REL << 24) | ((dx[j] & 0xFF) << 16) | REL_X;
+			move[0].pressed = dx[j];
+			move[1].rawcode = (EV_REL << 24) | ((dy[j] & 0xFF) << 16) | REL_Y;
+			move[1].pressed = dy[j];
+			for (k=0; k<BENCH_STROKE_REPORTS; k++)
+			{
+				bench_tick(1000);
+				move[0].time = move[1].time = bench_now;
+				engine_feed(&engine, move, 2, 0);
+			}
+		}
+		bench_tick(1000);
+		button.pressed = 0;
+		button.time = bench_now;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		engine_feed(&engine, &button, 1, 0);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns[i] = (end.tv_sec - begin.tv_sec) * 1000000000L + (end.tv_nsec - begin.tv_nsec);
+	}
+	
+	qsort(ns, BENCH_STROKES, sizeof(long), bench_compare);
+	printf("stroke: %d strokes of 8 directions, %d reports each, release median %.2f us, "
+	       "max %.2f us, %lu matched\n", BENCH_STROKES, 8 * BENCH_STROKE_REPORTS,
+	       ns[BENCH_STROKES / 2] / 1e3, ns[BENCH_STROKES - 1] / 1e3, btnx_stats.strokes);
+	config_free(cfg);
+	return (btnx_stats.strokes == BENCH_STROKES) ? 0 : -1;
+}
+
+/* Write reports at a fixed rate: relative motion, and every
+ * BENCH_PRESS_EVERY reports a press or release of the first binding. The
+ * pipe is closed at the end, which ends the loop. */
+static void *bench_produce(void *data)
+{
+	struct bench_producer_t *p = (struct bench_producer_t *) data;
+	struct input_event ev[3];
+	struct timespec next, wall;
+	struct sched_param param;
+	long period = 1000000000L / p->rate, total = (long) p->rate * p->seconds;
+	long offset;
+	int n;
+	
+	/* The producer stands in for the device, keep the load and the
+	 * timer slack from delaying it if the priority can be raised */
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	prctl(PR_SET_TIMERSLACK, 1);
+	
+	memset(ev, 0, sizeof(ev));
+	clock_gettime(CLOCK_REALTIME, &wall);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	offset = (wall.tv_sec - next.tv_sec) * 1000000L + (wall.tv_nsec - next.tv_nsec) / 1000;
+	for (p->reports=0; p->reports<total; p->reports++)
+	{
+		next.tv_nsec += period;
+		if (next.tv_nsec >= 1000000000L)
+		{
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		
+		/* Stamped with the time the report was due, like the kernel
+		 * stamps it in the interrupt, so that a late producer counts */
+		n = 0;
+		ev[0].time.tv_sec = next.tv_sec + (next.tv_nsec / 1000 + offset) / 1000000;
+		ev[0].time.tv_usec = (next.tv_nsec / 1000 + offset) % 1000000;
+		if (p->reports % BENCH_PRESS_EVERY == 0)
+		{
+			ev[n].type = EV_KEY;
+			ev[n].code = BTN_MOUSE;
+			ev[n++].value = (p->reports / BENCH_PRESS_EVERY) % 2 == 0;
+		}
+		ev[n].time = ev[0].time;
+		ev[n].type = EV_REL;
+		ev[n].code = REL_X;
+		ev[n++].value = 1;
+		ev[n].time = ev[0].time;
+		ev[n].type = EV_SYN;
+		ev[n].code = SYN_REPORT;
+		ev[n++].value = 0;
+		if (write(p->fd, ev, n * sizeof(ev[0])) < 0)
+			break;
+	}
+	close(p->fd);
+	return NULL;
+}
+
+/* Write system calls of the calling thread so far, with reads also the
+ * read ones, or -1 if the kernel does not count them */
+static long bench_syscalls(int reads)
+{
+	char line[BENCH_NAME_SIZE];
+	long value, count=0;
+	FILE *fp;
+	
+	if ((fp = fopen("/proc/thread-self/io", "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if ((reads && sscanf(line, "syscr: %ld", &value) == 1) ||
+		    sscanf(line, "syscw: %ld", &value) == 1)
+			count += value;
+	}
+	fclose(fp);
+	return count;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+	
+	return (x > y) - (x < y);
+}
+
+/* Run the event loop of the daemon on a pipe written at rate reports per
+ * second, with select() or io_uring and a busy-poll window of spin_us.
+ * With motion, the last binding, a motion transform, is held down first.
+ * The latency is the time from writing a report to the end of its
+ * dispatch, including the uinput writes. */
+static int bench_loop(btnx_config *cfg, int rate, int seconds, int use_uring, int spin_us,
+                      int motion)
+{
+	struct engine_sink_t sink = {bench_write, NULL, NULL, NULL, NULL, NULL};
+	struct bench_producer_t producer;
+	struct device_fds_t dev_fds;
+	struct engine_t engine;
+	struct evdev_t *evdev;
+	struct timeval tv, now;
+	struct timespec begin, end, spin_start;
+	const hexdump_t *events;
+	hexdump_t hold;
+	pthread_t thread;
+	fd_set fds, wfds, spin_fds;
+	long *latency, samples=0, selects=0, sys_begin, sys_end, timeout_us, max_samples;
+	double cpu, wall;
+	int p[2], max_fd, ready, writes, count;
+	
+	max_samples = (long) rate * seconds;
+	if ((latency = (long *) malloc(max_samples * sizeof(long))) == NULL)
+		return -1;
+	if (pipe(p) < 0 || fcntl(p[0], F_SETFL, O_NONBLOCK) < 0)
+	{
+		free(latency);
+		return -1;
+	}
+	if (use_uring && uring_init() < 0)
+	{
+		printf("loop io_uring: skipped, io_uring is not available\n");
+		close(p[0]);
+		close(p[1]);
+		free(latency);
+		return 0;
+	}
+	device_fds_init(&dev_fds);
+	dev_fds.motion = 1;
+	device_fds_add_fd(&dev_fds, p[0]);
+	device_fds_set_max_fd(&dev_fds);
+	evdev = device_fds_evdev(&dev_fds, p[0]);
+	engine_init(&engine, cfg, &sink, NULL, &btnx_stats);
+	if (motion)
+	{
+		memset(&hold, 0, sizeof(hold));
+		hold.rawcode = cfg->hot[cfg->count - 1].rawcode;
+		hold.pressed = 1;
+		gettimeofday(&hold.time, NULL);
+		engine_feed(&engine, &hold, 1, 1);
+	}
+	stats_reset(&btnx_stats);
+	bench_frames = 0;
+	
+	producer.fd = p[1];
+	producer.rate = rate;
+	producer.seconds = seconds;
+	if (evdev == NULL || pthread_create(&thread, NULL, bench_produce, &producer) != 0)
+	{
+		device_fds_close(&dev_fds);
+		close(p[1]);
+		uring_close();
+		free(latency);
+		return -1;
+	}
+	sys_begin = bench_syscalls(1);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+	clock_gettime(CLOCK_MONOTONIC, &spin_start);
+	wall = spin_start.tv_sec + spin_start.tv_nsec / 1e9;
+	
+	for (;;)
+	{
+		FD_ZERO(&fds);
+		device_fds_fill_fds(&dev_fds, &fds);
+		max_fd = dev_fds.max_fd;
+		FD_ZERO(&wfds);
+		writes = uinput_fill_fds(&wfds, &max_fd);
+		timeout_us = engine_timeout(&engine);
+		
+		if (use_uring)
+			ready = uring_wait(&dev_fds, &fds, writes ? &wfds : NULL, max_fd, spin_us,
+			                   timeout_us);
+		else
+		{
+			/* Like the select() wait of the daemon */
+			ready = 0;
+			clock_gettime(CLOCK_MONOTONIC, &spin_start);
+			while (spin_us > 0 && ready == 0 && realtime_elapsed_us(&spin_start) < spin_us)
+			{
+				spin_fds = fds;
+				tv.tv_sec = tv.tv_usec = 0;
+				selects++;
+				ready = select(max_fd + 1, &spin_fds, NULL, NULL, &tv);
+			}
+			if (ready > 0)
+				fds = spin_fds;
+			else
+			{
+				tv.tv_sec = timeout_us / 1000000;
+				tv.tv_usec = timeout_us % 1000000;
+				selects++;
+				ready = select(max_fd + 1, &fds, writes ? &wfds : NULL, NULL,
+				               (timeout_us < 0) ? NULL : &tv);
+			}
+		}
+		if (ready > 0 && writes > 0)
+			ready -= uinput_flush(&wfds);
+		engine_tick(&engine);
+		if (ready <= 0 || !FD_ISSET(p[0], &fds))
+			continue;
+		
+		if ((count = evdev_read(evdev, &events)) < 0)
+			break;
+		if (count == 0)
+			continue;
+		engine_feed(&engine, events, count, 1);
+		gettimeofday(&now, NULL);
+		if (samples < max_samples)
+			latency[samples++] = (now.tv_sec - events[0].time.tv_sec) * 1000000L +
+				(now.tv_usec - events[0].time.tv_usec);
+	}
+	
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	sys_end = bench_syscalls(1);
+	clock_gettime(CLOCK_MONOTONIC, &spin_start);
+	wall = spin_start.tv_sec + spin_start.tv_nsec / 1e9 - wall;
+	cpu = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	pthread_join(thread, NULL);
+	
+	qsort(latency, samples, sizeof(long), bench_compare);
+	printf("loop %s: %ld reports at %d/s, %.0f syscalls/s (",
+	       use_uring ? "io_uring" : "select", producer.reports, rate,
+	       ((use_uring ? (double) uring_enters() : (double) selects) +
+	        (sys_end - sys_begin)) / wall);
+	if (use_uring)
+		printf("io_uring_enter %.0f/s", uring_enters() / wall);
+	else
+		printf("select %.0f/s", selects / wall);
+	printf(", read+write %.0f/s), %.1f%% CPU, %lu frames%s\n", (sys_end - sys_begin) / wall,
+	       cpu * 100 / wall, bench_frames, motion ? ", motion transform held" : "");
+	if (samples > 0)
+		printf("loop %s latency: median %ld us, p99 %ld us, p99.9 %ld us, max %ld us\n",
+		       use_uring ? "io_uring" : "select", latency[samples / 2],
+		       latency[samples * 99 / 100], latency[samples * 999 / 1000],
+		       latency[samples - 1]);
+	
+	device_fds_close(&dev_fds);
+	uring_close();
+	free(latency);
+	return 0;
+}
+
+/* Start a process that keeps a CPU busy. Returns its pid, or -1. */
+static pid_t bench_load_start(void)
+{
+	pid_t pid;
+	
+	if ((pid = fork()) == 0)
+	{
+		for (;;)
+			;
+	}
+	return pid;
+}
+
+/* Time config_parse() over a generated configuration of bindings
+ * bindings. Returns -1 if it cannot be parsed. */
+static int bench_parse(int bindings)
+{
+	long ns[BENCH_PARSE_RUNS];
+	struct timespec begin, end;
+	btnx_config *cfg;
+	char *config_name;
+	int i;
+	
+	if (bench_config("parse", bindings, NULL) < 0 || fixture_file(CONFIG_MANAGER_NAME, "parse\n") < 0)
+		return -1;
+	for (i=0; i<BENCH_PARSE_RUNS; i++)
+	{
+		if ((config_name = strdup("parse")) == NULL)
+			return -1;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		cfg = config_parse(&config_name);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		free(config_name);
+		if (cfg == NULL || cfg->count != bindings)
+			return -1;
+		config_free(cfg);
+		ns[i] = (end.tv_sec - begin.tv_sec) * 1000000000L + (end.tv_nsec - begin.tv_nsec);
+	}
+	qsort(ns, BENCH_PARSE_RUNS, sizeof(long), bench_compare);
+	printf("parse: %d bindings, %d runs, median %.2f ms, min %.2f ms\n", bindings,
+	       BENCH_PARSE_RUNS, ns[BENCH_PARSE_RUNS / 2] / 1e6, ns[0] / 1e6);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	btnx_config *cfg;
+	char events[BENCH_NAME_SIZE * 8];
+	pid_t load_pid[BENCH_LOAD_MAX];
+	long count=BENCH_EVENTS;
+	int bindings=BENCH_BINDINGS, opt, i, len=0, ret=0;
+	int rate=0, seconds=BENCH_SECONDS, use_uring=0, priority=0, cpu=REALTIME_CPU_ANY;
+	int spin_us=0, load=0, parse=0;
+	const char *events_path=NULL, *motion=NULL;
+	
+	daemon_log_ident = "btnx-bench";
+	daemon_log_use = DAEMON_LOG_STDERR;
+	while ((opt = getopt(argc, argv, "n:b:l:t:ur:a:p:L:P:e:m:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			count = strtol(optarg, NULL, 10);
+			break;
+		case 'b':
+			bindings = strtol(optarg, NULL, 10);
+			break;
+		case 'l':
+			rate = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			seconds = strtol(optarg, NULL, 10);
+			break;
+		case 'u':
+			use_uring = 1;
+			break;
+		case 'r':
+			priority = strtol(optarg, NULL, 10);
+			break;
+		case 'a':
+			cpu = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			spin_us = strtol(optarg, NULL, 10);
+			break;
+		case 'L':
+			load = strtol(optarg, NULL, 10);
+			break;
+		case 'P':
+			parse = strtol(optarg, NULL, 10);
+			break;
+		case 'e':
+			events_path = optarg;
+			break;
+		case 'm':
+			motion = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n events] [-b bindings] [-e events_file]\n"
+			        "       %s -l rate [-t seconds] [-u] [-r priority] [-a cpu] [-p usec] "
+			        "[-L load] [-m scale|scroll]\n"
+			        "       %s -P bindings [-e events_file]\n", argv[0], argv[0], argv[0]);
+			return 1;
+		}
+	}
+	if (count <= 0 || bindings <= 0 || bindings > 0xFFFF || parse < 0 || parse > 0xFFFF)
+	{
+		fprintf(stderr, "Invalid event or binding count\n");
+		return 1;
+	}
+	if (rate < 0 || rate > 1000000 || seconds <= 0 || load < 0 || load > BENCH_LOAD_MAX)
+	{
+		fprintf(stderr, "Invalid rate, length or load\n");
+		return 1;
+	}
+	if (motion != NULL && strcmp(motion, "scale") != 0 && strcmp(motion, "scroll") != 0)
+	{
+		fprintf(stderr, "Invalid motion transform, expected scale or scroll\n");
+		return 1;
+	}
+	
+	if (fixture_init("btnx-bench") < 0)
+		return 1;
+	for (i=0; i < (int) (sizeof(bench_codes) / sizeof(bench_codes[0])); i++)
+		len += snprintf(events + len, sizeof(events) - len, "%s\t%d\n",
+		                bench_codes[i].name, bench_codes[i].value);
+	if ((events_path ? fixture_copy(EVENTS_NAME, events_path) :
+	                   fixture_file(EVENTS_NAME, events)) < 0 ||
+	    bench_config("dispatch", bindings, (rate > 0) ? motion : NULL) < 0 ||
+	    (cfg = fixture_load("dispatch")) == NULL)
+	{
+		fprintf(stderr, "Could not set up the generated configuration\n");
+		fixture_cleanup();
+		return 1;
+	}
+	
+	if (parse > 0)
+	{
+		if (bench_parse(parse) < 0)
+		{
+			fprintf(stderr, "Could not parse the generated configuration\n");
+			ret = 1;
+		}
+	}
+	else if (rate > 0)
+	{
+		for (i=0; i<load; i++)
+			load_pid[i] = bench_load_start();
+		if ((priority > 0 || cpu != REALTIME_CPU_ANY) && realtime_init(priority, cpu) < 0)
+			ret = 1;
+		else if (uinput_init_file("/dev/null") < 0 ||
+		         bench_loop(cfg, rate, seconds, use_uring, spin_us, motion != NULL) < 0)
+			ret = 1;
+		for (i=0; i<load; i++)
+		{
+			if (load_pid[i] > 0)
+			{
+				kill(load_pid[i], SIGKILL);
+				waitpid(load_pid[i], NULL, 0);
+			}
+		}
+	}
+	else if (bench_dispatch(cfg, count, 0) < 0 || uinput_init_file("/dev/null") < 0 ||
+	         bench_dispatch(cfg, count, 1) < 0 || bench_scroll(-1) < 0 ||
+	         bench_scroll(BENCH_COALESCE) < 0 || bench_stroke() < 0)
+		ret = 1;
+	uinput_close();
+	config_free(cfg);
+	fixture_cleanup();
+	return ret;
+}
@@ -41,6 +41,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <ctype.h>
+#include <time.h>
 
 #include <libdaemon/dfork.h>
 #include <libdaemon/dsignal.h>
@@ -52,6 +53,15 @@
 #include "config_parser.h"
 #include "device.h"
 #include "revoco.h"
+#include "control.h"
+#include "hotplug.h"
+#include "realtime.h"
+#include "stats.h"
+#include "evdev.h"
+#include "uring.h"
+#include "engine.h"
+#include "log.h"
+#include "startup.h"
 
 #define PROGRAM_NAME			PACKAGE
 #define PROGRAM_VERSION			VERSION
@@ -67,7 +77,38 @@
 
 /* Static variables */
 static char *g_exec_path=NULL; 		/* Path of this executable */
+static int g_argc=0;				/* Command line, passed on to config switches */
+static char **g_argv=NULL;
+static char *g_config_name=NULL;	/* Name of the running configuration */
 static struct timeval exec_time; 	/* time when daemon was executed. */
+static int profile_startup=0;		/* Log the duration of each startup phase */
+static int serial_startup=0;		/* Run the startup tasks one after another */
+static struct timespec profile_begin, profile_last;
+static int rt_priority=0;			/* SCHED_FIFO priority, 0 to disable */
+static int rt_cpu=REALTIME_CPU_ANY;	/* CPU to pin the daemon to */
+static int busy_poll_us=0;			/* Busy-poll window before blocking */
+static int use_uring=0;				/* Wait and write with io_uring */
+static struct engine_t engine;		/* Runs the bindings */
+
+/* State shared by the startup tasks */
+struct startup_state_t {
+	struct device_fds_t *dev_fds;
+	struct device_handler_t handlers[NUM_EVENT_HANDLERS];
+	int num_handlers;
+	char *config_name;
+	btnx_config *cfg;
+};
+
+/* Startup tasks, each after the tasks it depends on */
+enum {
+	TASK_MODPROBE=0,
+	TASK_CONFIG,
+	TASK_HANDLERS,
+	TASK_ENGINE,
+	TASK_UINPUT,
+	TASK_REVOCO,
+	TASKS
+};
 
 /* Possible paths of event handlers */
 const char handler_locations[][15] = {
@@ -78,14 +119,65 @@ const char handler_locations[][15] = {
 
 /* Static function declarations */
 static const char *get_handler_location(int index);
-static int find_handler(struct device_fds_t *dev_fds, int flags, int vendor, int product);
-static int btnx_event_get(btnx_event **bevs, int rawcode, int pressed);
-static hexdump_t btnx_event_read(int fd, int *status);
+static void profile_phase(const char *phase);
+static int uinput_present(void);
+static int scan_handlers(struct device_handler_t *handlers, int flags);
+static char *select_config(struct device_handler_t *handlers, int count, const char *config_name);
+static int find_handler(struct device_fds_t *dev_fds, struct device_handler_t *handlers,
+                        int count, int vendor, int product);
+static void dispatch_events(struct evdev_t *evdev, const hexdump_t *events, int count);
 static void command_execute(btnx_event *bev);
-static void config_switch(btnx_event **bevs, int index);
-static void send_extra_event(btnx_event **bevs, int index);
-static int check_delay(btnx_event *bev);
+static void config_switch(btnx_event *bev);
+static void sink_frame(void *data, const btnx_frame *frame);
+static void sink_command(void *data, btnx_event *bev);
+static void sink_config_switch(void *data, btnx_event *bev);
+static void sink_wheel(void *data, int action, int mode);
+static void sink_motion(void *data, int enable);
+static void handle_hotplug(struct device_fds_t *dev_fds);
+static int wait_events(int max_fd, fd_set *fds, fd_set *wfds, long timeout_us);
 static void main_args(int argc, char *argv[], int *bg, int *kill_all, char **config_file);
+static int task_modprobe(void *arg);
+static int task_config(void *arg);
+static int task_handlers(void *arg);
+static int task_engine(void *arg);
+static int task_uinput(void *arg);
+static int task_revoco(void *arg);
+
+/* Engine output of the daemon */
+static const struct engine_sink_t daemon_sink = {
+	sink_frame, sink_command, sink_config_switch, sink_wheel, sink_motion, NULL
+};
+
+/* With --profile-startup, log the time spent since the previous phase and
+ * since the start of the process. */
+static void profile_phase(const char *phase) {
+	struct timespec now;
+	
+	if (!profile_startup)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	btnx_log(LOG_INFO, OUT_PRE "startup: %-16s %8.3f ms (total %8.3f ms)", phase,
+			(now.tv_sec - profile_last.tv_sec) * 1000.0 +
+			(now.tv_nsec - profile_last.tv_nsec) / 1000000.0,
+			(now.tv_sec - profile_begin.tv_sec) * 1000.0 +
+			(now.tv_nsec - profile_begin.tv_nsec) / 1000000.0);
+	profile_last = now;
+}
+
+/* Check whether a uinput device node already exists, so that modprobe can
+ * be skipped. */
+static int uinput_present(void) {
+	const char *loc;
+	int x=0;
+	char loc_buffer[128];
+	
+	while ((loc = get_handler_location(x++)) != NULL) {
+		sprintf(loc_buffer, "%s/%s", loc, "uinput");
+		if (access(loc_buffer, F_OK) == 0)
+			return 1;
+	}
+	return 0;
+}
 
 /* To simplify the open_handler loop. Can't think of another reason why I
  * coded this */
@@ -106,7 +198,7 @@ int open_handler(char *name, int flags) {
 	while ((loc = get_handler_location(x++)) != NULL) {
 		sprintf(loc_buffer, "%s/%s", loc, name);
 		if ((fd = open(loc_buffer, flags)) >= 0) {
-			//daemon_log(LOG_DEBUG, OUT_PRE "Opened handler: %s", loc_buffer);
+			//btnx_log(LOG_DEBUG, OUT_PRE "Opened handler: %s", loc_buffer);
 			return fd;
 		}
 	}
@@ -114,12 +206,12 @@ int open_handler(char *name, int flags) {
 	return NULL_FD;
 }
 
-/* Tries to find an input handler that has a certain vendor and product
- * ID associated with it. type determines whether it is a mouse or keyboard
- * input handler that is being searched. */
-static int find_handler(struct device_fds_t *dev_fds, int flags, int vendor, int product)
+/* Open every event handler once and record its vendor and product IDs.
+ * handlers must have room for NUM_EVENT_HANDLERS entries. Returns the
+ * number of opened handlers. */
+static int scan_handlers(struct device_handler_t *handlers, int flags)
 {
-	int i, fd;
+	int i, fd, count=0;
 	unsigned short id[6];
 	char name[16];
 	
@@ -128,53 +220,76 @@ static int find_handler(struct device_fds_t *dev_fds, int flags, int vendor, int
 		if ((fd = open_handler(name, flags)) < 0)
 			continue;
 		ioctl(fd, EVIOCGID, id); /* Extract IDs */
-		if (vendor == id[ID_VENDOR] && product == id[ID_PRODUCT]) {
-			device_fds_add_fd(dev_fds, fd);
-		}
-		else
-			close(fd);
+		handlers[count].fd = fd;
+		handlers[count].vendor = id[ID_VENDOR];
+		handlers[count].product = id[ID_PRODUCT];
+		count++;
 	}
-	device_fds_set_max_fd(dev_fds);
-	return dev_fds->count; /* No such handler found */
+	return count;
 }
 
-/* Find the btnx_event structure that is associated with a captured rawcode
- * and return its index. */
-static int btnx_event_get(btnx_event **bevs, int rawcode, int pressed)
+/* Pick the highest priority configuration whose mouse is present. Priority
+ * is the config manager file order, starting from config_name. Only the
+ * Mouse blocks of the configurations are read. Returns a newly allocated
+ * name, or NULL if no configured mouse is present. */
+static char *select_config(struct device_handler_t *handlers, int count, const char *config_name)
 {
-	int i=0;
-	
-	while (bevs[i] != 0) {
-		if (bevs[i]->rawcode == rawcode) {
-			if (bevs[i]->enabled == 0)
-				return -1; /* associated rawcode found, but event is disabled */
-			bevs[i]->pressed = pressed;
-			return i; /* rawcode found and event is enabled */
+	struct config_id_t *ids;
+	int num_ids, start=0, i, j, k;
+	char *name=NULL;
+	
+	if ((num_ids = config_index(&ids)) == 0)
+		return NULL;
+	
+	for (i=0; config_name != NULL && i<num_ids; i++) {
+		if (strcmp(ids[i].name, config_name) == 0) {
+			start = i;
+			break;
+		}
+	}
+	
+	for (i=0; i<num_ids && name == NULL; i++) {
+		k = (start + i) % num_ids;
+		for (j=0; j<count; j++) {
+			if (handlers[j].vendor == ids[k].vendor &&
+			    handlers[j].product == ids[k].product) {
+				name = (char *) malloc(CONFIG_NAME_MAX_SIZE * sizeof(char));
+				strcpy(name, ids[k].name);
+				break;
+			}
 		}
-		i++;
 	}
-	/* no such rawcode in configuration */
-	return -1; 
+	
+	free(ids);
+	return name;
 }
 
-/* Extract the rawcode(s) of an input event. */
-static hexdump_t btnx_event_read(int fd, int *status) {
-	hexdump_t hexdump = {.rawcode = 0, .pressed = 0};
-	struct input_event ev;
+/* Moves the scanned input handlers that have a certain vendor and product
+ * ID associated with them to dev_fds and closes the rest. */
+static int find_handler(struct device_fds_t *dev_fds, struct device_handler_t *handlers,
+                        int count, int vendor, int product)
+{
+	int i;
+	
+	for (i=0; i<count; i++) {
+		if (vendor == handlers[i].vendor && product == handlers[i].product)
+			device_fds_add_fd(dev_fds, handlers[i].fd);
+		else
+			close(handlers[i].fd);
+		handlers[i].fd = NULL_FD;
+	}
+	device_fds_set_max_fd(dev_fds);
+	return dev_fds->count; /* 0 if no such handler found */
+}
 
-	if ((*status = read(fd, &ev, sizeof(ev))) > 0) {
-		if (((ev.code == 0x0000 || ev.code == 0x0001) && ev.type == 0x0002) || (ev.code == 0x0000 && ev.type == 0x0000)) {
-			hexdump.rawcode = 0;
-			hexdump.pressed = 0;
-		}
-		hexdump.rawcode = ev.code & 0xFFFF;
-		if (ev.type == 0x0002)
-			hexdump.rawcode += (ev.value & 0xFF) << 16;
-		hexdump.rawcode += (ev.type & 0xFF) << 24;
-		hexdump.pressed = ev.value;
+/* Run the bindings of events decoded by a reader */
+static void dispatch_events(struct evdev_t *evdev, const hexdump_t *events, int count)
+{
+	if (profile_startup && count > 0) {
+		profile_phase("first event");
+		profile_startup = 0;
 	}
-	
-	return hexdump;
+	engine_feed(&engine, events, count, evdev_grabbed(evdev));
 }
 
 /* Execute a shell script or binary file */
@@ -188,14 +303,60 @@ static void command_execute(btnx_event *bev) {
 		execv(bev->args[0], bev->args);
 	}
 	else if (pid < 0) {
-		daemon_log(LOG_WARNING, OUT_PRE "Error: could not fork: %s", strerror(errno));
+		btnx_log(LOG_WARNING, OUT_PRE "Error: could not fork: %s", strerror(errno));
 		return;
 	}
+	btnx_stats.commands++;
 	return;
 }
 
+/* Return the name of the running configuration, NULL if the default
+ * configuration file is used. */
+const char *btnx_config_name(void) {
+	return g_config_name;
+}
+
+/* Re-execute the daemon with configuration name. If name is NULL, the
+ * default configuration is used. Other command line options are kept,
+ * except for -b. Only returns if the exec fails. */
+void btnx_config_switch(const char *name) {
+	char *args[g_argc + 3];
+	char name_buf[CONFIG_NAME_MAX_SIZE];
+	int x, i=0;
+	
+	args[i++] = g_exec_path;
+	for (x=1; x<g_argc; x++) {
+		if (!strncmp(g_argv[x], "-b", 2))
+			continue;
+		if (!strncmp(g_argv[x], "-c", 2)) {
+			x++;
+			continue;
+		}
+		args[i++] = g_argv[x];
+	}
+	if (name != NULL) {
+		snprintf(name_buf, sizeof(name_buf), "%s", name);
+		args[i++] = "-c";
+		args[i++] = name_buf;
+	}
+	args[i] = NULL;
+	
+	btnx_log(LOG_DEBUG, OUT_PRE "switching to config: %s", name ? name : CONFIG_NAME);
+	uring_close();
+	uinput_close();
+	control_close();
+	hotplug_close();
+	revoco_close();
+	daemon_signal_done();
+	daemon_pid_file_remove();
+	log_stop();
+	execv(g_exec_path, args);
+	btnx_log(LOG_ERR, OUT_PRE "Error: could not execute %s: %s", g_exec_path,
+			strerror(errno));
+}
+
 /* Perform a configuration switch */
-static void config_switch(btnx_event **bev, int index) {
+static void config_switch(btnx_event *bev) {
 	const char *name=NULL;
 	struct timeval now;
 	
@@ -209,7 +370,7 @@ static void config_switch(btnx_event **bev, int index) {
 			return;
 	/* ------------------------------------------------------------------- */
 	
-	switch (bev[index]->switch_type) {
+	switch (bev->switch_type) {
 	case CONFIG_SWITCH_NEXT:
 		name = config_get_next();
 		break;
@@ -217,70 +378,125 @@ static void config_switch(btnx_event **bev, int index) {
 		name = config_get_prev();
 		break;
 	case CONFIG_SWITCH_TO:
-		name = bev[index]->switch_name;
+		name = bev->switch_name;
 	}
 	
 	if (name == NULL) {
-		daemon_log(LOG_WARNING, OUT_PRE "Warning: config switch failed. "
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: config switch failed. "
 				"Invalid configuration name.");
 		return;
 	}
 	
-	daemon_log(LOG_DEBUG, OUT_PRE "switching to config: %s", name);
-	uinput_close();
-	daemon_signal_done();
-	daemon_pid_file_remove();
-	execl(g_exec_path, g_exec_path, "-c", name, (char *) NULL);
+	btnx_config_switch(name);
 }
 
-/* Special events, like wheel scrolls and command executions need to be
- * handled differently. They use this function. */
-static void send_extra_event(btnx_event **bevs, int index)
+static void sink_frame(void *data, const btnx_frame *frame)
 {
-	int tmp_kc = bevs[index]->keycode;
+	(void) data;
+	uinput_submit(frame);
+}
+
+static void sink_command(void *data, btnx_event *bev)
+{
+	(void) data;
+	command_execute(bev);
+}
+
+static void sink_config_switch(void *data, btnx_event *bev)
+{
+	(void) data;
+	config_switch(bev);
+}
+
+/* Wheel mode changes are handed to the revoco worker by revoco_flush() */
+static void sink_wheel(void *data, int action, int mode)
+{
+	(void) data;
+	if (action == ACTION_WHEEL_RESTORE ||
+	    (action == ACTION_WHEEL_TOGGLE && revoco_get_mode() == mode))
+		revoco_request_mode(REVOCO_DISABLED);
+	else
+		revoco_request_mode(mode);
+}
+
+/* Strokes need motion, data is the struct device_fds_t of the handlers */
+static void sink_motion(void *data, int enable)
+{
+	device_fds_motion((struct device_fds_t *) data, enable);
+}
+
+/* Picks up a configured event handler or the revoco receiver when it is
+ * plugged in again. */
+static void handle_hotplug(struct device_fds_t *dev_fds) {
+	struct hotplug_event_t event;
+	char path[128];
+	unsigned short id[6];
+	int fd;
 	
-	if (tmp_kc == COMMAND_EXECUTE) {
-		command_execute(bevs[index]);
-		return;
-	}
-	if (tmp_kc == CONFIG_SWITCH) {
-		config_switch(bevs, index);
+	if (hotplug_read(&event) <= 0 || event.action != HOTPLUG_ADD)
 		return;
-	}
 	
-	/* Perform a "button down" and "button up" event for relative events
-	 * such as wheel scrolls. */
-	bevs[index]->pressed = 1;
-	uinput_key_press(bevs[index]);
-	bevs[index]->pressed = 0;
-	/* Don't remember why the KEY_UNKNOWN is necessary. */
-	bevs[index]->keycode = KEY_UNKNOWN;
-	uinput_key_press(bevs[index]);
-	bevs[index]->keycode = tmp_kc;
+	if (!strcmp(event.subsystem, "input") && !strncmp(event.devname, "input/event", 11)) {
+		snprintf(path, sizeof(path), "/dev/%s", event.devname);
+		if ((fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+			return;
+		if (ioctl(fd, EVIOCGID, id) < 0 ||
+		    id[ID_VENDOR] != device_get_vendor_id() ||
+		    id[ID_PRODUCT] != device_get_product_id()) {
+			close(fd);
+			return;
+		}
+		btnx_log(LOG_INFO, OUT_PRE "Configured mouse handler added: %s", path);
+		device_fds_add_fd(dev_fds, fd);
+		device_fds_set_max_fd(dev_fds);
+	}
+	else if (!strcmp(event.subsystem, "usbmisc"))
+		revoco_hotplug(event.devname);
 }
 
-/* This function checks if there has been sufficient delay between two
- * occurrances of the same event. Delay is in milliseconds, defined in the
- * configuration file. 
- * Returns 0 if delay is satisfied, -1 if there has not been enough delay. */
-static int check_delay(btnx_event *bev) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
+/* Wait for any of the fds to become readable, or any of wfds writable if
+ * it is not NULL, at most timeout_us if it is not negative. With -p, the
+ * fds are polled without sleeping for a bounded window first. */
+static int wait_events(int max_fd, fd_set *fds, fd_set *wfds, long timeout_us) {
+	struct timespec spin_start;
+	struct timeval zero, timeout;
+	fd_set spin_fds, spin_wfds;
+	long spin_us = busy_poll_us;
+	int ready;
 	
-	if (bev->last.tv_sec == 0 && bev->last.tv_usec == 0)
-		return 0;
+	if (spin_us > 0) {
+		if (timeout_us >= 0 && timeout_us < spin_us)
+			spin_us = timeout_us;
+		clock_gettime(CLOCK_MONOTONIC, &spin_start);
+		do {
+			spin_fds = *fds;
+			if (wfds != NULL)
+				spin_wfds = *wfds;
+			zero.tv_sec = zero.tv_usec = 0;
+			ready = select(max_fd+1, &spin_fds, wfds ? &spin_wfds : NULL, NULL, &zero);
+		} while (ready == 0 && realtime_elapsed_us(&spin_start) < spin_us);
+		if (ready != 0) {
+			*fds = spin_fds;
+			if (wfds != NULL)
+				*wfds = spin_wfds;
+			return ready;
+		}
+		if (timeout_us >= 0)
+			timeout_us -= spin_us;
+	}
 	
-	/* Perform a millisecond conversion and compare */
-	if (((int)(((unsigned int)now.tv_sec - (unsigned int)bev->last.tv_sec) * 1000) +
-		(int)(((int)now.tv_usec - (int)bev->last.tv_usec) / 1000))
-		> (int)bev->delay)
-		return 0;
-	return -1;
+	if (timeout_us < 0)
+		return select(max_fd+1, fds, wfds, NULL, NULL);
+	timeout.tv_sec = timeout_us / 1000000;
+	timeout.tv_usec = timeout_us % 1000000;
+	return select(max_fd+1, fds, wfds, NULL, &timeout);
 }
 
 /* Parses command line arguments. */
 static void main_args(int argc, char *argv[], int *bg, int *kill_all, char **config_file) {
 	g_exec_path = argv[0];
+	g_argc = argc;
+	g_argv = argv;
 	
 	if (argc > 1) {
 		int x;
@@ -299,7 +515,7 @@ static void main_args(int argc, char *argv[], int *bg, int *kill_all, char **con
 			else if (!strncmp(argv[x], "-c", 2)) {
 				if (x < argc - 1) {
 					if (strlen(argv[x+1]) >= CONFIG_NAME_MAX_SIZE) {
-						daemon_log(LOG_ERR, OUT_PRE "Error: invalid configuration name.");
+						btnx_log(LOG_ERR, OUT_PRE "Error: invalid configuration name.");
 						goto usage;
 					}
 					*config_file = (char *) malloc((strlen(argv[x+1])+1) * sizeof(char));
@@ -307,7 +523,7 @@ static void main_args(int argc, char *argv[], int *bg, int *kill_all, char **con
 					x++;
 				}
 				else {
-					daemon_log(LOG_ERR, OUT_PRE "Error: -c argument used but no "
+					btnx_log(LOG_ERR, OUT_PRE "Error: -c argument used but no "
 							"configuration file name specified.");
 					goto usage;
 				}
@@ -317,6 +533,31 @@ static void main_args(int argc, char *argv[], int *bg, int *kill_all, char **con
 				daemon_log_use = DAEMON_LOG_SYSLOG;
 			else if (!strncmp(argv[x], "-k", 2))
 				*kill_all = 1;
+			/* Real-time priority, CPU pinning and busy-polling */
+			else if (!strncmp(argv[x], "-r", 2) || !strncmp(argv[x], "-a", 2) ||
+			         !strncmp(argv[x], "-p", 2)) {
+				if (x >= argc - 1 || !isdigit(argv[x+1][0])) {
+					btnx_log(LOG_ERR, OUT_PRE "Error: %s argument used but no "
+							"number specified.", argv[x]);
+					goto usage;
+				}
+				if (argv[x][1] == 'r')
+					rt_priority = strtol(argv[x+1], NULL, 10);
+				else if (argv[x][1] == 'a')
+					rt_cpu = strtol(argv[x+1], NULL, 10);
+				else
+					busy_poll_us = strtol(argv[x+1], NULL, 10);
+				x++;
+			}
+			/* io_uring event loop */
+			else if (!strncmp(argv[x], "-u", 2))
+				use_uring = 1;
+			/* Log startup phase durations */
+			else if (!strcmp(argv[x], "--profile-startup"))
+				profile_startup = 1;
+			/* Startup tasks one after another, e.g. to compare */
+			else if (!strcmp(argv[x], "--serial-startup"))
+				serial_startup = 1;
 			else {
 				usage:
 				daemon_log(LOG_INFO, PROGRAM_NAME " usage:\n"
@@ -326,6 +567,12 @@ static void main_args(int argc, char *argv[], int *bg, int *kill_all, char **con
 						"\t-c CONFIG\tRun with specified configuration\n"
 						"\t-k\t\tKill all btnx daemons\n"
 				        "\t-l\t\tRedirect output to syslog\n"
+						"\t-r PRIORITY\tLock memory and run with SCHED_FIFO PRIORITY\n"
+						"\t-a CPU\t\tPin the daemon to CPU\n"
+						"\t-p USEC\t\tBusy-poll the mouse for USEC microseconds before sleeping\n"
+						"\t-u\t\tRead and write the devices with io_uring\n"
+						"\t--profile-startup\tLog the duration of each startup phase\n"
+						"\t--serial-startup\tRun the startup steps one after another\n"
 						"\t-h\t\tPrint this text");
 				exit(BTNX_ERROR_FATAL);
 			}
@@ -333,21 +580,107 @@ static void main_args(int argc, char *argv[], int *bg, int *kill_all, char **con
 	}
 }
 
+/* Spawning a shell and modprobe is only needed if the uinput module is
+ * not loaded yet */
+static int task_modprobe(void *arg) {
+	(void) arg;
+	if (uinput_present())
+		btnx_log(LOG_INFO, OUT_PRE "uinput already present, modprobe skipped.");
+	else if (system("modprobe uinput") != 0)	{
+		btnx_log(LOG_WARNING, OUT_PRE "Modprobe uinput failed. Make sure the uinput "
+				"module is loaded before running btnx. If it's already running,"
+				" no problem.");
+	}
+	else
+		btnx_log(LOG_INFO, OUT_PRE "uinput modprobed successfully.");
+	return 0;
+}
+
+/* Scan the event handlers once and match them against the mouse IDs of
+ * all configurations. Only the selected configuration is parsed. */
+static int task_config(void *arg) {
+	struct startup_state_t *start = (struct startup_state_t *) arg;
+	char *selected;
+	
+	start->num_handlers = scan_handlers(start->handlers, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if ((selected = select_config(start->handlers, start->num_handlers,
+	                              start->config_name)) != NULL) {
+		free(start->config_name);
+		start->config_name = selected;
+	}
+	
+	start->cfg = config_parse(&start->config_name);
+	if (start->cfg == NULL) {
+		btnx_log(LOG_ERR, OUT_PRE "Configuration file error.");
+		return BTNX_ERROR_NO_CONFIG;
+	}
+	return 0;
+}
+
+/* Open the readers of the configured mouse handlers */
+static int task_handlers(void *arg) {
+	struct startup_state_t *start = (struct startup_state_t *) arg;
+	
+	/* Motion transforms take the pointer handler away from the system */
+	start->dev_fds->grab = start->cfg->grab;
+	if (find_handler(start->dev_fds, start->handlers, start->num_handlers,
+	                 device_get_vendor_id(), device_get_product_id()) == 0) {
+		btnx_log(LOG_ERR, OUT_PRE "No configured mouse handler detected.");
+		return BTNX_ERROR_OPEN_HANDLER;
+	}
+	return 0;
+}
+
+/* Build the output frames of the bindings */
+static int task_engine(void *arg) {
+	struct startup_state_t *start = (struct startup_state_t *) arg;
+	struct engine_sink_t sink = daemon_sink;
+	
+	sink.data = start->dev_fds;
+	engine_init(&engine, start->cfg, &sink, NULL, &btnx_stats);
+	return 0;
+}
+
+/* Create the uinput devices. The mouse device takes the codes of the
+ * grabbed handlers, so this waits for them. */
+static int task_uinput(void *arg) {
+	struct startup_state_t *start = (struct startup_state_t *) arg;
+	
+	if (uinput_init(start->cfg, start->dev_fds) < 0)
+		return BTNX_ERROR_OPEN_UINPUT;
+	return 0;
+}
+
+static int task_revoco(void *arg) {
+	(void) arg;
+	revoco_launch();
+	return 0;
+}
+
 int main(int argc, char *argv[]) {
-	int fd_daemon=0;
-	fd_set fds;
+	int fd_daemon=0, fd_hotplug;
+	fd_set fds, wfds;
 	struct device_fds_t dev_fds;
-	hexdump_t hexdump = {.rawcode=0, .pressed=0};
-	int max_fd, ready, set_fd;
-	btnx_event **bevs = NULL;
-	int bev_index;
-	int suppress_release=1;
+	struct startup_state_t start;
+	struct startup_task_t tasks[TASKS] = {
+		{"modprobe", task_modprobe, &start, 0, {0, 0}, {0, 0}},
+		{"config", task_config, &start, 0, {0, 0}, {0, 0}},
+		{"handlers", task_handlers, &start, 1U << TASK_CONFIG, {0, 0}, {0, 0}},
+		{"engine", task_engine, &start, 1U << TASK_CONFIG, {0, 0}, {0, 0}},
+		{"uinput", task_uinput, &start,
+		 (1U << TASK_CONFIG) | (1U << TASK_MODPROBE) | (1U << TASK_HANDLERS), {0, 0}, {0, 0}},
+		{"revoco", task_revoco, &start, 1U << TASK_CONFIG, {0, 0}, {0, 0}}
+	};
+	int max_fd, ready, set_fd, writes;
+	btnx_config *cfg = NULL;
 	int bg=0, ret=BTNX_EXIT_NORMAL;
 	char *config_name=NULL;
 	int kill_all=0;
 	int leave_pid_file=0;
 	pid_t pid;
 	
+	clock_gettime(CLOCK_MONOTONIC, &profile_begin);
+	profile_last = profile_begin;
 	daemon_pid_file_ident = daemon_log_ident = daemon_ident_from_argv0(argv[0]);
 	daemon_log_use = DAEMON_LOG_STDERR;
 	
@@ -355,74 +688,53 @@ int main(int argc, char *argv[]) {
 	
 	if (kill_all) {
 		if ((ret = daemon_pid_file_kill_wait(SIGINT, 5)) < 0) {
-			daemon_log(LOG_WARNING, OUT_PRE "Failed to kill previous btnx processes");
+			btnx_log(LOG_WARNING, OUT_PRE "Failed to kill previous btnx processes");
 		}
 		exit(BTNX_EXIT_NORMAL);
 	}
 	if ((pid = daemon_pid_file_is_running()) >= 0) {
-		daemon_log(LOG_WARNING, OUT_PRE "Previous daemon already running. Killing it.");
+		btnx_log(LOG_WARNING, OUT_PRE "Previous daemon already running. Killing it.");
 		if ((ret = daemon_pid_file_kill_wait(SIGINT, 5)) < 0) {
-			daemon_log(LOG_WARNING, OUT_PRE "Failed to kill previous btnx process %u", pid);
-			daemon_log(LOG_WARNING, OUT_PRE "Exit forced");
+			btnx_log(LOG_WARNING, OUT_PRE "Failed to kill previous btnx process %u", pid);
+			btnx_log(LOG_WARNING, OUT_PRE "Exit forced");
 			kill(pid, SIGKILL);
 			daemon_pid_file_remove();
 			//exit(BTNX_ERROR_FATAL);
 		}
 	}
 	
-	if (system("modprobe uinput") != 0)	{
-		daemon_log(LOG_WARNING, OUT_PRE "Modprobe uinput failed. Make sure the uinput "
-				"module is loaded before running btnx. If it's already running,"
-				" no problem.");
-	}
-	else
-		daemon_log(LOG_INFO, OUT_PRE "uinput modprobed successfully.");
+	profile_phase("previous daemon");
 	
-	/* Loop through the configurations until no more are left or a configured
-	 * mouse is detected. */
+	/* Startup steps that only depend on the configuration overlap */
+	memset(&start, 0, sizeof(start));
+	start.dev_fds = &dev_fds;
+	start.config_name = config_name;
 	device_fds_init(&dev_fds);
-	while (bevs == NULL) {
-		bevs = config_parse(&config_name);		
-		if (bevs == NULL) {
-			daemon_log(LOG_ERR, OUT_PRE "Configuration file error.");
-			exit(BTNX_ERROR_NO_CONFIG);
-		}
-		
-		if (find_handler(&dev_fds, O_RDONLY, device_get_vendor_id(), 
-		                 device_get_product_id()) == 0) {
-			daemon_log(LOG_ERR, OUT_PRE "No configured mouse handler detected: %s", 
-			           strerror(errno));
-			free(bevs);
-			bevs = NULL;
-			if (config_get_next() != NULL && config_name != NULL) {
-				free(config_name);
-				config_name = malloc(sizeof(strlen(config_get_next())) + 1);
-				strcpy(config_name, config_get_next());
-			}
-			else
-				exit(BTNX_ERROR_OPEN_HANDLER);
-		}
-	}
+	ret = startup_run(tasks, TASKS, !serial_startup);
+	g_config_name = start.config_name;
+	cfg = start.cfg;
+	profile_phase("startup tasks");
+	if (profile_startup)
+		startup_report(tasks, TASKS);
+	/* The tasks have finished, nothing else runs while exiting */
+	if (ret != 0)
+		exit(ret);
 	
-	uinput_init();
-	
-	revoco_launch();
-	
-	daemon_log(LOG_INFO, OUT_PRE "No startup errors.");
+	btnx_log(LOG_INFO, OUT_PRE "No startup errors.");
 		
 	if (bg) {
 		if ((pid = daemon_fork()) < 0) {
-			daemon_log(LOG_ERR, OUT_PRE "Daemon fork failed. Quitting.");
+			btnx_log(LOG_ERR, OUT_PRE "Daemon fork failed. Quitting.");
 			exit(BTNX_ERROR_FATAL);
 		}
 		else if (pid > 0) {
-			daemon_log(LOG_DEBUG, OUT_PRE "Parent done.");
+			btnx_log(LOG_DEBUG, OUT_PRE "Parent done.");
 			exit(BTNX_EXIT_NORMAL);
 		}
 	}
 	
 	if (daemon_pid_file_create() < 0) {
-		daemon_log(LOG_ERR, OUT_PRE "Could not create PID file: %s", strerror(errno));
+		btnx_log(LOG_ERR, OUT_PRE "Could not create PID file: %s", strerror(errno));
 		ret = BTNX_ERROR_CREATE_PID_FILE;
 		
 		/* Do not delete the pid file in finish_daemon in this case, leads to
@@ -431,45 +743,96 @@ int main(int argc, char *argv[]) {
 		goto finish_daemon;
 	}
 	if (daemon_signal_init(SIGINT, SIGTERM, SIGQUIT, 0) < 0) {
-		daemon_log(LOG_ERR, OUT_PRE "Could not register signal handlers: %s.", strerror(errno));
+		btnx_log(LOG_ERR, OUT_PRE "Could not register signal handlers: %s.", strerror(errno));
 		ret = BTNX_ERROR_INIT_SIGNALS;
 		goto finish_daemon;
 	}
 	
+	/* Before realtime_init(), the drainer keeps a normal priority */
+	log_start();
+	if (rt_priority > 0 || rt_cpu != REALTIME_CPU_ANY)
+		realtime_init(rt_priority, rt_cpu);
+	
 	fd_daemon = daemon_signal_fd();
-	if (fd_daemon > dev_fds.max_fd)
-		max_fd = fd_daemon;
-	else
-		max_fd = dev_fds.max_fd;
+	fd_hotplug = hotplug_init();
+	
+	if (use_uring && uring_init() < 0)
+		btnx_log(LOG_WARNING, OUT_PRE "Falling back to select().");
+	
+	control_init(&engine, &dev_fds);
+	profile_phase("ready");
 	
 	gettimeofday(&exec_time, NULL);
 	
 	for (;;) {
-	    int read_status;
+	    struct evdev_t *evdev;
+	    const hexdump_t *events;
+	    long timeout_us;
+	    int count;
 	    
+		/* Hand wheel mode changes to the revoco worker before sleeping,
+		 * whether events, timers, hotplug or the control socket asked */
+		revoco_flush();
+		
 		FD_ZERO(&fds);
 		device_fds_fill_fds(&dev_fds, &fds);
 		FD_SET(fd_daemon, &fds);
+		if (fd_hotplug != NULL_FD)
+			FD_SET(fd_hotplug, &fds);
+		max_fd = dev_fds.max_fd;
+		if (fd_daemon > max_fd)
+			max_fd = fd_daemon;
+		if (fd_hotplug > max_fd)
+			max_fd = fd_hotplug;
+		control_fill_fds(&fds, &max_fd);
+		/* Frames the uinput devices did not take wait for writability */
+		FD_ZERO(&wfds);
+		writes = uinput_fill_fds(&wfds, &max_fd);
 	
-		ready = select(max_fd+1, &fds, NULL, NULL, NULL);
+		timeout_us = engine_timeout(&engine);
+		if (uring_active())
+			ready = uring_wait(&dev_fds, &fds, writes ? &wfds : NULL, max_fd, busy_poll_us,
+			                   timeout_us);
+		else
+			ready = wait_events(max_fd, &fds, writes ? &wfds : NULL, timeout_us);
+		if (ready > 0 && writes > 0)
+			ready -= uinput_flush(&wfds);
+		/* Timed engine work goes out before the events that woke us */
+		engine_tick(&engine);
 		
 		if (ready == -1)
-			daemon_log(LOG_WARNING, OUT_PRE "select() error: %s", strerror(errno));
+			btnx_log(LOG_WARNING, OUT_PRE "%s error: %s",
+					uring_active() ? "io_uring_enter()" : "select()", strerror(errno));
 		else if (ready == 0)
 			continue;
 		else {
 			set_fd = device_fds_find_set_fd(&dev_fds, &fds);
 			if (set_fd != NULL_FD) {
-				hexdump = btnx_event_read(set_fd, &read_status);
-				if (read_status < 0) {
-				    daemon_log(LOG_ERR, OUT_PRE "Handler read failed.");
+				evdev = device_fds_evdev(&dev_fds, set_fd);
+				if (evdev == NULL || (count = evdev_read(evdev, &events)) < 0) {
+					/* Do not leave keys of the lost handler pressed, nor
+					 * anything btnx holds if the handler was grabbed */
+					if (evdev != NULL) {
+						dispatch_events(evdev, events, evdev_release_all(evdev, &events));
+						if (evdev_grabbed(evdev))
+							uinput_release_all();
+					}
+					if (fd_hotplug != NULL_FD) {
+						/* Unplugged or asleep. Picked up again by handle_hotplug() */
+						btnx_log(LOG_WARNING, OUT_PRE "Handler read failed. "
+								"Waiting for it to return.");
+						device_fds_remove_fd(&dev_fds, set_fd);
+						continue;
+					}
+				    btnx_log(LOG_ERR, OUT_PRE "Handler read failed.");
 				    goto finish_daemon;
 				}
+				dispatch_events(evdev, events, count);
 			}
 			else if (FD_ISSET(fd_daemon, &fds)) {
 				int sig;
 				if ((sig = daemon_signal_next()) <= 0) {
-					daemon_log(LOG_ERR, OUT_PRE "daemon_signal_next() failed.");
+					btnx_log(LOG_ERR, OUT_PRE "daemon_signal_next() failed.");
 					goto finish_daemon;
 				}
 				
@@ -477,48 +840,21 @@ int main(int argc, char *argv[]) {
 				case SIGINT:
 				case SIGQUIT:
 				case SIGTERM:
-					daemon_log(LOG_INFO, OUT_PRE "Received quit signal.");
+					btnx_log(LOG_INFO, OUT_PRE "Received quit signal.");
 					goto finish_daemon;
 				}
 			}
-			else {
-			    daemon_log(LOG_WARNING, OUT_PRE "Unexpected fd status.");
+			else if (fd_hotplug != NULL_FD && FD_ISSET(fd_hotplug, &fds)) {
+				handle_hotplug(&dev_fds);
 				continue;
 			}
-			
-			if (hexdump.rawcode == 0)
+			else if (control_is_set(&fds)) {
+				control_handle(&fds);
+				continue;
+			}
+			else {
+			    btnx_log(LOG_WARNING, OUT_PRE "Unexpected fd status.");
 				continue;
-			if ((bev_index = btnx_event_get(bevs, hexdump.rawcode, hexdump.pressed)) != -1) {
-				if (bevs[bev_index]->pressed == 1 || bevs[bev_index]->type == BUTTON_IMMEDIATE
-					|| bevs[bev_index]->type == BUTTON_RELEASE) {
-					if (check_delay(bevs[bev_index]) < 0)
-						continue;
-					gettimeofday(&(bevs[bev_index]->last), NULL);
-				}
-				/* Force release, ignore button release */
-				if (bevs[bev_index]->type == BUTTON_RELEASE &&
-					bevs[bev_index]->pressed == 0)
-					continue;
-				if ((bevs[bev_index]->type == BUTTON_IMMEDIATE ||
-					bevs[bev_index]->type == BUTTON_RELEASE) && 
-					bevs[bev_index]->keycode < BTNX_EXTRA_EVENTS) {
-					
-					bevs[bev_index]->pressed = 1;
-					uinput_key_press(bevs[bev_index]);
-					bevs[bev_index]->pressed = 0;
-					uinput_key_press(bevs[bev_index]);
-				}
-				else if (bevs[bev_index]->keycode > BTNX_EXTRA_EVENTS) {
-					if (bevs[bev_index]->type == BUTTON_NORMAL) {
-						if ((suppress_release = !suppress_release) != 1)
-							send_extra_event(bevs, bev_index);
-					}
-					else if (bevs[bev_index]->type == BUTTON_IMMEDIATE ||
-							bevs[bev_index]->type == BUTTON_RELEASE)
-						send_extra_event(bevs, bev_index);
-				}
-				else
-					uinput_key_press(bevs[bev_index]);
 			}
 		}
 		
@@ -527,12 +863,18 @@ int main(int argc, char *argv[]) {
 	}
 	
 finish_daemon:
-	daemon_log(LOG_INFO, OUT_PRE "Exiting...");
+	btnx_log(LOG_INFO, OUT_PRE "Exiting...");
+	control_close();
+	hotplug_close();
+	revoco_close();
+	uring_close();
 	uinput_close();
 	device_fds_close(&dev_fds);
+	config_free(cfg);
 	daemon_signal_done();
 	if (leave_pid_file == 0)
 	  daemon_pid_file_remove();
+	log_stop();
 	
 	return ret;
 }
@@ -8,9 +8,12 @@
 #define BTNX_H_
 
 #include <sys/time.h>
+#include <linux/input.h>
 #include "../config.h"
 
 #define MAX_MODS		3
+#define FRAME_EVENTS	(MAX_MODS + 3)
+#define STROKE_MAX		8		/* Directions of a mouse stroke */
 #define MAX_RAWCODES	10
 #define HEXDUMP_SIZE	8
 #define NULL_FD			-1
@@ -40,7 +43,11 @@ enum
 	REL_WHEELFORWARD,
 	REL_WHEELBACK,
 	COMMAND_EXECUTE,
-	CONFIG_SWITCH
+	CONFIG_SWITCH,
+	WHEEL_MODE_SWITCH,
+	LAYER_HOLD,
+	LAYER_TOGGLE,
+	MOTION_TRANSFORM
 };
 
 /* Configuration switch types */
@@ -60,31 +67,185 @@ enum
 	BUTTON_RELEASE		/* Same as immediate, but release event is ignored */
 };
 
-/* Contains all necessary information to handle a button event */
-typedef struct btnx_event
+/* Actions a binding runs on a press or a release, chosen when the
+ * configuration is loaded */
+enum
+{
+	ACTION_NONE=0,		/* Ignore the event */
+	ACTION_PRESS,		/* Send the press frame */
+	ACTION_RELEASE,		/* Send the release frame */
+	ACTION_TAP,			/* Send the press and release frames */
+	ACTION_COMMAND,		/* Execute the command */
+	ACTION_CONFIG_SWITCH,	/* Switch to another configuration */
+	ACTION_WHEEL_HOLD,	/* Switch the revoco wheel mode */
+	ACTION_WHEEL_RESTORE,	/* Return to the configured wheel mode */
+	ACTION_WHEEL_TOGGLE,	/* Switch or return, depending on the current mode */
+	ACTION_LAYER_HOLD,	/* Activate a layer */
+	ACTION_LAYER_RESTORE,	/* Return to the toggled layer */
+	ACTION_LAYER_TOGGLE,	/* Toggle a layer on or off */
+	ACTION_SCROLL,		/* Add a wheel step to the coalesced scroll */
+	ACTION_MOTION_HOLD,	/* Transform the motion of grabbed handlers */
+	ACTION_MOTION_RESTORE,	/* Pass the motion on as it is */
+	ACTION_MOTION_TOGGLE	/* Transform or restore, depending on the current transform */
+};
+
+/* When a binding runs. A button with hold or double tap bindings waits
+ * until it knows which one the user meant; its other binding runs on a
+ * tap. */
+enum
+{
+	TRIGGER_NONE=0,		/* Follow the button */
+	TRIGGER_TAP,		/* Run on a short press */
+	TRIGGER_HOLD,		/* Run when the button is held down */
+	TRIGGER_DOUBLE		/* Run on a second press that quickly follows a tap */
+};
+
+/* Directions of a mouse stroke, clockwise */
+enum
+{
+	STROKE_NONE=0,
+	STROKE_U,
+	STROKE_UR,
+	STROKE_R,
+	STROKE_DR,
+	STROKE_D,
+	STROKE_DL,
+	STROKE_L,
+	STROKE_UL
+};
+
+/* Axes a motion transform inverts */
+#define MOTION_INVERT_X		0x01
+#define MOTION_INVERT_Y		0x02
+
+/* Binding state flags */
+#define BINDING_ENABLED		0x01	/* Enabled in the configuration */
+#define BINDING_SUSPENDED	0x02	/* Disabled at runtime through the control socket */
+
+/* The fields of a binding that are matched on every input event. Kept in
+ * a contiguous array, separate from the output fields. */
+typedef struct btnx_binding
 {
 	int		rawcode;		/* 32-bit button rawcode, sniffed from event handler */
+	int		enabled;		/* Binding state flags, only send event if enabled */
 	int 	type;			/* Button type */
 	int 	delay;			/* Minimum time before event can be resent */
 	struct timeval last;	/* Last time this event occurred */
+	unsigned char action[2];	/* ACTION_* run on release [0] and press [1] */
+	unsigned char debounce[2];	/* Apply the delay on release [0] and press [1] */
+	int		gesture;		/* Gesture resolving the button, -1 to pass straight through */
+	int		stroke;			/* Strokes drawn with the button held, -1 if none */
+} btnx_binding;
+
+/* Most important data from hexdumping an event handler */
+typedef struct hexdump_s
+{
+	int rawcode;	/* 32-bit button rawcode */
+	int pressed;	/* Specifies whether button was pressed or released */
+	struct timeval time;	/* Kernel timestamp of the event */
+} hexdump_t;
+
+/* The tap, hold and double tap bindings of a button in a layer, and the
+ * state of the engine telling them apart */
+typedef struct btnx_gesture
+{
+	int		tap;			/* Binding indexes, -1 if not bound */
+	int		hold;
+	int		dbl;
+	int		hold_time;		/* Milliseconds a press lasts to become a hold */
+	int		dbl_time;		/* Milliseconds a second press may follow a tap */
+	int		state;			/* GESTURE_* state in the engine */
+	struct timeval due;		/* When the state times out, zero if it does not */
+	hexdump_t ev;			/* Event that entered the state */
+} btnx_gesture;
+
+/* The stroke bindings of a button in a layer, and the stroke being drawn
+ * while the button is held */
+typedef struct btnx_stroke
+{
+	int		tap;			/* Binding run on a click without a stroke, -1 if none */
+	int		first;			/* First stroke binding, linked through path_next */
+	int		active;			/* The button is held */
+	int		x, y;			/* Motion since the last direction */
+	int		len;			/* Directions drawn, STROKE_MAX + 1 if too many */
+	unsigned char	dir[STROKE_MAX];
+	hexdump_t ev;			/* The press */
+} btnx_stroke;
+
+/* A transform of the pointer motion of grabbed handlers, active while
+ * its binding is held or toggled on */
+typedef struct btnx_motion
+{
+	int		scale;			/* Percent of the motion passed on */
+	int		scroll;			/* Motion per wheel step, 0 to move the pointer */
+	int		invert;			/* MOTION_INVERT_* */
+} btnx_motion;
+
+/* Prebuilt uinput events for one direction of a binding. They go out in at
+ * most two writes, one per device. */
+typedef struct btnx_frame
+{
+	unsigned char	count[2];	/* Number of events in each write */
+	unsigned char	dev[2];		/* Target uinput device of each write */
+	unsigned char	pause;		/* Pause between the writes */
+	struct input_event ev[FRAME_EVENTS];
+} btnx_frame;
+
+/* Output information of a binding */
+typedef struct btnx_event
+{
 	int 	keycode;		/* Keyboard or mouse button keycode */
 	int 	mod[MAX_MODS];	/* Modifier key for the keycode */
-	int 	pressed;		/* 0: release event, 1: press event */
-	int		enabled;		/* Only send event if enabled */
+	btnx_frame	frame[2];	/* Release [0] and press [1] output */
 	char	*command;		/* The absolute path of the executable to execute */
 	char	**args;			/* Arguments for the executable */
 	int		uid;			/* UID to run the command as */
 	int		switch_type;	/* Configuration switch type */
 	char	*switch_name;	/* Name of confiugration to switch to */
+	int		wheel_mode;		/* revoco wheel mode to switch to */
+	int		layer;			/* Layer the binding belongs to */
+	int		layer_target;	/* Layer to hold or toggle */
+	int		trigger;		/* TRIGGER_* */
+	int		trigger_time;	/* Hold or double tap time in ms, 0 for the default */
+	unsigned char	path[STROKE_MAX];	/* STROKE_* directions of a stroke binding */
+	int		path_len;		/* 0 if the binding is not a stroke */
+	int		path_next;		/* Next stroke binding of the button, -1 at the end */
+	btnx_motion	motion;		/* Transform of a MOTION_TRANSFORM binding */
 } btnx_event;
 
-/* Most important data from hexdumping an event handler */
-typedef struct hexdump_s
+/* A parsed configuration. Binding i consists of hot[i] and cold[i]. All of
+ * it is allocated from one arena and freed with config_free().
+ * Each distinct rawcode has a key, found through the slots table. A layer
+ * maps keys to binding indexes, and switching layers replaces active. */
+typedef struct btnx_config
 {
-	int rawcode;	/* 32-bit button rawcode */
-	int pressed;	/* Specifies whether button was pressed or released */
-} hexdump_t;
+	int				count;	/* Number of bindings */
+	btnx_binding	*hot;	/* Matched per event */
+	btnx_event		*cold;	/* Output, strings and argv */
+	struct layer_slot_t *slots;	/* Rawcode to key table */
+	int				mask;	/* Size of the slots table - 1 */
+	int				keys;	/* Number of distinct rawcodes */
+	int				layers;	/* Number of layers */
+	int				**layer;	/* Binding index per key for each layer, -1 if unbound */
+	int				*active;	/* Dispatch table of the active layer */
+	int				active_layer;
+	int				locked;	/* Toggled layer, active when no layer is held */
+	int				*held;	/* Binding index that handled the press per key */
+	int				wheel_coalesce;	/* Wheel merge window in ms, 0 for one read, -1 off */
+	int				wheel_key_rate;	/* Key taps per second from a wheel, 0 unlimited */
+	int				gestures;	/* Number of buttons with hold or double tap bindings */
+	btnx_gesture	*gesture;
+	int				strokes;	/* Number of buttons with stroke bindings */
+	btnx_stroke		*stroke;
+	int				stroke_step;	/* Motion that makes a stroke direction */
+	int				grab;	/* Grab the motion handlers, for motion transforms */
+	int				chatter_max;	/* Longest switch bounce filtered in ms, 0 off */
+	int				chatter_unbound;	/* Filter unbound buttons of grabbed handlers */
+	struct arena_t	*arena;
+} btnx_config;
 
 int open_handler(char *name, int flags);
+const char *btnx_config_name(void);
+void btnx_config_switch(const char *name);
 
 #endif /*BTNX_H_*/
@@ -0,0 +1,247 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Filters the chatter of worn mouse switches, which bounce when pressed
+ * or released and turn one click into a double click. Each button keeps
+ * histograms of its press to release and release to press times, taken
+ * from the kernel timestamps. Bounces show up as a cluster of gaps far
+ * shorter than the gaps between real clicks. Once a button shows such a
+ * cluster, its releases are held back for the length of the cluster, and
+ * a press within that time cancels the release: the button stays down.
+ * A button that does not chatter learns no threshold and is not delayed. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "btnx.h"
+#include "chatter.h"
+
+static const char *chatter_names[8] = {
+	"left", "right", "middle", "side", "extra", "forward", "back", "task"
+};
+
+static long chatter_us(const struct timeval *from, const struct timeval *to);
+static int chatter_bucket(long us);
+static long chatter_learn(const struct chatter_button_t *b, long max_us);
+static int chatter_histogram(char *buf, int size, const char *name, const char *type,
+                             const unsigned long *hist);
+
+/* Microseconds from one kernel time to another, -1 if from is not set or
+ * the clock went back */
+static long chatter_us(const struct timeval *from, const struct timeval *to)
+{
+	long long diff;
+	
+	if (!timerisset(from))
+		return -1;
+	diff = (long long)(to->tv_sec - from->tv_sec) * 1000000 + (to->tv_usec - from->tv_usec);
+	if (diff < 0)
+		return -1;
+	return (diff > 0x7FFFFFFF) ? 0x7FFFFFFF : (long) diff;
+}
+
+static int chatter_bucket(long us)
+{
+	int bucket;
+	
+	for (bucket = 0; bucket < CHATTER_BUCKETS - 1; bucket++) {
+		if (us < (1L << bucket))
+			break;
+	}
+	return bucket;
+}
+
+/* Find the gaps of a button that are bounces. The lowest cluster of the
+ * gap histogram counts as bounces if another cluster follows it and it
+ * ends below the longest bounce allowed. The threshold is put in the
+ * middle of the empty buckets between the two. It is kept below half of
+ * the most common hold time, as nobody clicks again faster than that.
+ * Returns the threshold in microseconds, 0 if the button does not chatter. */
+static long chatter_learn(const struct chatter_button_t *b, long max_us)
+{
+	int n, low=-1, empty=-1, mode=0;
+	long threshold;
+	
+	if (b->gaps < CHATTER_SAMPLES)
+		return 0;
+	for (n=0; n<CHATTER_BUCKETS; n++)
+	{
+		if (b->gap[n] == 0)
+		{
+			if (low >= 0 && empty < 0)
+				empty = n;
+			continue;
+		}
+		if (low < 0)
+			low = n;
+		else if (empty >= 0)
+			break;
+	}
+	/* One cluster, nothing to tell the bounces from */
+	if (n == CHATTER_BUCKETS || empty < 0)
+		return 0;
+	/* Buckets start at 2^(n-1) microseconds */
+	if ((1L << (empty - 1)) > max_us)
+		return 0;
+	threshold = 1L << ((empty + n) / 2 - 1);
+	
+	for (n=1; n<CHATTER_BUCKETS; n++)
+	{
+		if (b->hold[n] > b->hold[mode])
+			mode = n;
+	}
+	if (mode >= 2 && threshold > (1L << (mode - 2)))
+		threshold = 1L << (mode - 2);
+	return (threshold > max_us) ? max_us : threshold;
+}
+
+/* Clear the statistics of all buttons of a filter and set the longest
+ * bounce that may be filtered. 0 turns the filter off. */
+void chatter_init(struct chatter_t *chatter, int max_ms)
+{
+	memset(chatter, 0, sizeof(*chatter));
+	chatter->max_us = (max_ms > 0) ? max_ms * 1000L : 0;
+}
+
+/* Pass a press or a release of a button through the filter. tag is handed
+ * back with a held release by chatter_due(). Returns CHATTER_PASS,
+ * CHATTER_HOLD, CHATTER_DROP, or CHATTER_FLUSH with the held release in
+ * release. */
+int chatter_event(struct chatter_t *chatter, const hexdump_t *ev, int tag, hexdump_t *release)
+{
+	struct chatter_button_t *b = &chatter->buttons[(ev->rawcode & 0xFFFF) - BTN_MOUSE];
+	long us, threshold = b->threshold;
+	
+	if (ev->pressed)
+	{
+		if ((us = chatter_us(&b->release, &ev->time)) >= 0)
+		{
+			b->gap[chatter_bucket(us)]++;
+			b->gaps++;
+			b->threshold = chatter_learn(b, chatter->max_us);
+		}
+		if (!b->pending)
+		{
+			b->press = ev->time;
+			return CHATTER_PASS;
+		}
+		b->pending = 0;
+		/* The button never went up, and its hold time goes on */
+		if (us >= 0 && us < threshold)
+		{
+			b->suppressed++;
+			return CHATTER_DROP;
+		}
+		b->press = ev->time;
+		*release = b->held;
+		return CHATTER_FLUSH;
+	}
+	
+	if ((us = chatter_us(&b->press, &ev->time)) >= 0)
+		b->hold[chatter_bucket(us)]++;
+	b->release = ev->time;
+	if (threshold <= 0 || chatter->max_us <= 0)
+		return CHATTER_PASS;
+	b->held = *ev;
+	b->tag = tag;
+	b->pending = 1;
+	b->due.tv_sec = ev->time.tv_sec;
+	b->due.tv_usec = ev->time.tv_usec + threshold;
+	while (b->due.tv_usec >= 1000000)
+	{
+		b->due.tv_sec++;
+		b->due.tv_usec -= 1000000;
+	}
+	return CHATTER_HOLD;
+}
+
+/* Find the time the earliest held release is due. Returns 0 if no release
+ * is held. */
+int chatter_next(const struct chatter_t *chatter, struct timeval *due)
+{
+	int i, found=0;
+	
+	for (i=0; i<CHATTER_BUTTONS; i++)
+	{
+		if (!chatter->buttons[i].pending)
+			continue;
+		if (!found || timercmp(&chatter->buttons[i].due, due, <))
+			*due = chatter->buttons[i].due;
+		found = 1;
+	}
+	return found;
+}
+
+/* Take a held release that is due at now. Returns 1 with the release and
+ * its tag, 0 if none is due. */
+int chatter_due(struct chatter_t *chatter, const struct timeval *now, hexdump_t *release,
+                int *tag)
+{
+	int i;
+	
+	for (i=0; i<CHATTER_BUTTONS; i++)
+	{
+		if (!chatter->buttons[i].pending || timercmp(now, &chatter->buttons[i].due, <))
+			continue;
+		chatter->buttons[i].pending = 0;
+		*release = chatter->buttons[i].held;
+		*tag = chatter->buttons[i].tag;
+		return 1;
+	}
+	return 0;
+}
+
+/* Write the buckets of a histogram that are not empty */
+static int chatter_histogram(char *buf, int size, const char *name, const char *type,
+                             const unsigned long *hist)
+{
+	int i, len=0;
+	
+	for (i = 0; i < CHATTER_BUCKETS && len < size; i++) {
+		if (hist[i] == 0)
+			continue;
+		if (i < CHATTER_BUCKETS - 1)
+			len += snprintf(buf + len, size - len, "chatter_%s_%s_lt_%luus %lu\n",
+					name, type, 1UL << i, hist[i]);
+		else
+			len += snprintf(buf + len, size - len, "chatter_%s_%s_ge_%luus %lu\n",
+					name, type, 1UL << (i - 1), hist[i]);
+	}
+	return len;
+}
+
+/* Write the threshold and the bounces dropped of every button that was
+ * used as "name value" lines into buf, with histograms also the times.
+ * Returns the number of characters written, not counting the terminating
+ * null. */
+int chatter_format(const struct chatter_t *chatter, char *buf, int size, int histograms)
+{
+	const struct chatter_button_t *b;
+	char name[16];
+	int i, len=0;
+	
+	if (size <= 0)
+		return 0;
+	buf[0] = '\0';
+	for (i = 0; i < CHATTER_BUTTONS && len < size; i++) {
+		b = &chatter->buttons[i];
+		if (!timerisset(&b->press))
+			continue;
+		if (i < 8)
+			snprintf(name, sizeof(name), "%s", chatter_names[i]);
+		else
+			snprintf(name, sizeof(name), "btn%d", i);
+		len += snprintf(buf + len, size - len, "chatter_%s_threshold_us %ld\n"
+				"chatter_%s_suppressed %lu\n", name, b->threshold, name, b->suppressed);
+		if (histograms && len < size)
+			len += chatter_histogram(buf + len, size - len, name, "hold", b->hold);
+		if (histograms && len < size)
+			len += chatter_histogram(buf + len, size - len, name, "gap", b->gap);
+	}
+	
+	if (len >= size)
+		len = size - 1;
+	return len;
+}
@@ -0,0 +1,66 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef CHATTER_H_
+#define CHATTER_H_
+
+#include <sys/time.h>
+#include <linux/input.h>
+
+#include "btnx.h"
+
+#define CHATTER_BUTTONS		16		/* BTN_MOUSE and the 15 codes after it */
+#define CHATTER_BUCKETS		20		/* Bucket n counts intervals below 2^n us */
+#define CHATTER_SAMPLES		32		/* Gaps seen before a threshold is learned */
+#define CHATTER_MAX			20		/* Default longest bounce in ms */
+#define CHATTER_LINE_SIZE	64		/* Longest line of chatter_format() */
+
+/* Room chatter_format() needs for every button with both histograms */
+#define CHATTER_FORMAT_SIZE	(CHATTER_BUTTONS * (2 + 2 * CHATTER_BUCKETS) * CHATTER_LINE_SIZE + 1)
+
+/* What chatter_event() made of an event */
+enum
+{
+	CHATTER_PASS=0,		/* Run it */
+	CHATTER_FLUSH,		/* Run the release returned first, then the event */
+	CHATTER_HOLD,		/* A release, held back until chatter_due() returns it */
+	CHATTER_DROP		/* A bounce, drop it. The held back release is dropped too. */
+};
+
+/* Statistics and state of a button */
+struct chatter_button_t {
+	unsigned long hold[CHATTER_BUCKETS];	/* Press to release times */
+	unsigned long gap[CHATTER_BUCKETS];		/* Release to press times */
+	unsigned long gaps;
+	unsigned long suppressed;				/* Bounces dropped */
+	long threshold;				/* Gaps shorter than this are bounces, 0 for none */
+	struct timeval press;		/* Kernel time of the last press and release */
+	struct timeval release;
+	int pending;				/* held is a release held back until due */
+	int tag;
+	hexdump_t held;
+	struct timeval due;
+};
+
+/* The filter of one engine, learned from the buttons it sees */
+struct chatter_t {
+	struct chatter_button_t buttons[CHATTER_BUTTONS];
+	long max_us;				/* Longest bounce filtered, 0 for off */
+};
+
+/* Returns 1 if the chatter filter keeps statistics for a key code */
+static inline int chatter_code(int code)
+{
+	return code >= BTN_MOUSE && code < BTN_MOUSE + CHATTER_BUTTONS;
+}
+
+void chatter_init(struct chatter_t *chatter, int max_ms);
+int chatter_event(struct chatter_t *chatter, const hexdump_t *ev, int tag, hexdump_t *release);
+int chatter_next(const struct chatter_t *chatter, struct timeval *due);
+int chatter_due(struct chatter_t *chatter, const struct timeval *now, hexdump_t *release,
+                int *tag);
+int chatter_format(const struct chatter_t *chatter, char *buf, int size, int histograms);
+
+#endif /*CHATTER_H_*/
@@ -0,0 +1,874 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* btnx-check: behaviour checks of the engine, run by make check. The
+ * configuration is written to a temporary directory and the frames the
+ * engine sends are recorded instead of written to uinput. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <linux/input.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "config_parser.h"
+#include "engine.h"
+#include "stats.h"
+#include "chatter.h"
+#include "evdev.h"
+#include "fixture.h"
+#include "uinput.h"
+#include "uring.h"
+
+#define CHECK_FRAMES		16		/* Frames recorded per step */
+#define CHECK_NAME_SIZE		256
+#define CHECK_RAWCODE		((EV_KEY << 24) | BTN_SIDE)
+#define CHECK_WHEEL_RAWCODE	((EV_REL << 24) | (1 << 16) | REL_WHEEL)
+#define CHECK_WHEEL_STEPS	25		/* Steps of the wheel burst, 1 ms apart */
+#define CHECK_STROKE_RAWCODE	((EV_KEY << 24) | BTN_MIDDLE)
+#define CHECK_GESTURE_RAWCODE	((EV_KEY << 24) | BTN_EXTRA)
+#define CHECK_LAYER_RAWCODE	((EV_KEY << 24) | BTN_FORWARD)
+#define CHECK_LAYERED_RAWCODE	((EV_KEY << 24) | BTN_BACK)
+#define CHECK_CHATTER_RAWCODE	((EV_KEY << 24) | BTN_LEFT)
+#define CHECK_CLICKS		40		/* Clicks the chatter filter learns from */
+#define CHECK_HOLD			80000	/* Press to release of a click in us */
+#define CHECK_GAP			300000	/* Release to press between clicks in us */
+#define CHECK_BOUNCE		1000	/* Length of a switch bounce in us */
+
+/* Static variables */
+static struct timeval check_now;					/* Time of the engine */
+static btnx_frame check_frame[CHECK_FRAMES];		/* Frames sent by the last step */
+static int check_frames=0;
+static int check_failed=0;
+static int check_wheel_sum=0;						/* REL_WHEEL sent */
+static int check_wheel_frames=0;
+static unsigned char check_keys[KEY_MAX / 8 + 1];	/* Key state of the pipe handler */
+
+static const char check_events[] =
+	"KEY_A\t30\n"
+	"KEY_B\t48\n"
+	"KEY_C\t46\n"
+	"KEY_LEFTCTRL\t29\n";
+
+static const char check_config[] =
+	"Mouse\n"
+	"\tvendor_id = 0x46d\n"
+	"EndMouse\n"
+	"Button\n"
+	"\trawcode = 0x01000113\n"
+	"\tkeycode = KEY_A\n"
+	"\tmod1 = KEY_LEFTCTRL\n"
+	"\tdelay = 0\n"
+	"EndButton\n";
+
+static const char check_wheel_config[] =
+	"Mouse\n"
+	"\tvendor_id = 0x46d\n"
+	"\twheel_coalesce = 8\n"
+	"EndMouse\n"
+	"Button\n"
+	"\trawcode = 0x02010008\n"
+	"\tkeycode = REL_WHEELFORWARD\n"
+	"\tdelay = 0\n"
+	"EndButton\n";
+
+static const char check_stroke_config[] =
+	"Mouse\n"
+	"\tvendor_id = 0x46d\n"
+	"EndMouse\n"
+	"Button\n"
+	"\trawcode = 0x01000112\n"
+	"\tkeycode = KEY_A\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000112\n"
+	"\tkeycode = KEY_B\n"
+	"\tstroke = R D\n"
+	"\tdelay = 0\n"
+	"EndButton\n";
+
+static const char check_gesture_config[] =
+	"Mouse\n"
+	"\tvendor_id = 0x46d\n"
+	"EndMouse\n"
+	"Button\n"
+	"\trawcode = 0x01000114\n"
+	"\tkeycode = KEY_A\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000114\n"
+	"\tkeycode = KEY_B\n"
+	"\ttrigger = hold\n"
+	"\ttrigger_time = 200\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000114\n"
+	"\tkeycode = KEY_C\n"
+	"\ttrigger = double\n"
+	"\ttrigger_time = 250\n"
+	"\tdelay = 0\n"
+	"EndButton\n";
+
+static const char check_layer_config[] =
+	"Mouse\n"
+	"\tvendor_id = 0x46d\n"
+	"EndMouse\n"
+	"Button\n"
+	"\trawcode = 0x01000115\n"
+	"\tlayer_hold = 1\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000116\n"
+	"\tkeycode = KEY_A\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000116\n"
+	"\tkeycode = KEY_C\n"
+	"\tlayer = 1\n"
+	"\tdelay = 0\n"
+	"EndButton\n";
+
+static const char check_chatter_config[] =
+	"Mouse\n"
+	"\tvendor_id = 0x46d\n"
+	"\tchatter_max = 20\n"
+	"EndMouse\n"
+	"Button\n"
+	"\trawcode = 0x01000110\n"
+	"\tkeycode = KEY_A\n"
+	"\tdelay = 0\n"
+	"EndButton\n";
+
+static void check_clock(struct timeval *now);
+static void check_sink(void *data, const btnx_frame *frame);
+static void check_wheel_sink(void *data, const btnx_frame *frame);
+static void check_advance(long us);
+static void check_after(struct engine_t *engine, int rawcode, int pressed, long us);
+static void check_step(struct engine_t *engine, int rawcode, int pressed);
+static int check_sent(int code, int value);
+static void check(int ok, const char *what);
+static void check_suspend(btnx_config *cfg);
+static void check_format(void);
+static void check_wheel(void);
+static void check_move(struct engine_t *engine, int x, int y, int count);
+static void check_stroke(void);
+static void check_gesture(void);
+static void check_layer(void);
+static void check_clicks(struct engine_t *engine, int bounces);
+static long check_threshold(const struct engine_t *engine);
+static void check_chatter(void);
+static void check_dropped(void);
+static int check_query(int fd, unsigned long request, void *bits);
+static int check_feed(int fd, int type, int code, int value);
+static void check_resync(void);
+static void check_key_frame(btnx_frame *frame, int code, int value);
+static int check_output(struct device_fds_t *dev_fds, int fd, struct input_event *ev,
+                        int count);
+static int check_key_events(const struct input_event *ev, int code, int value);
+static void check_uring(void);
+
+/* The checks create no uinput devices */
+int open_handler(char *name, int flags)
+{
+	(void) name; (void) flags;
+	errno = ENODEV;
+	return -1;
+}
+
+static void check_clock(struct timeval *now)
+{
+	*now = check_now;
+}
+
+/* Record the frames of a step */
+static void check_sink(void *data, const btnx_frame *frame)
+{
+	(void) data;
+	if (check_frames < CHECK_FRAMES)
+		check_frame[check_frames++] = *frame;
+}
+
+/* Sum up the wheel steps sent */
+static void check_wheel_sink(void *data, const btnx_frame *frame)
+{
+	int i;
+	
+	(void) data;
+	check_wheel_frames++;
+	for (i=0; i < frame->count[0] + frame->count[1]; i++)
+	{
+		if (frame->ev[i].type == EV_REL && frame->ev[i].code == REL_WHEEL)
+			check_wheel_sum += frame->ev[i].value;
+	}
+}
+
+/* Move the time of the engine on */
+static void check_advance(long us)
+{
+	check_now.tv_sec += us / 1000000;
+	check_now.tv_usec += us % 1000000;
+	if (check_now.tv_usec >= 1000000)
+	{
+		check_now.tv_sec++;
+		check_now.tv_usec -= 1000000;
+	}
+}
+
+/* Feed one event us microseconds after the previous one, after the timers
+ * that are due by then. A rawcode of 0 only runs the timers. */
+static void check_after(struct engine_t *engine, int rawcode, int pressed, long us)
+{
+	hexdump_t ev;
+	
+	check_advance(us);
+	check_frames = 0;
+	engine_tick(engine);
+	if (rawcode == 0)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.rawcode = rawcode;
+	ev.pressed = pressed;
+	ev.time = check_now;
+	engine_feed(engine, &ev, 1, 0);
+	engine_tick(engine);
+}
+
+/* Feed one event, a second after the previous one */
+static void check_step(struct engine_t *engine, int rawcode, int pressed)
+{
+	check_after(engine, rawcode, pressed, 1000000);
+}
+
+/* Returns 1 if the last step sent a key event */
+static int check_sent(int code, int value)
+{
+	const btnx_frame *frame;
+	int i, j;
+	
+	for (i=0; i<check_frames; i++)
+	{
+		frame = &check_frame[i];
+		for (j=0; j < frame->count[0] + frame->count[1]; j++)
+		{
+			if (frame->ev[j].type == EV_KEY && frame->ev[j].code == code &&
+			    frame->ev[j].value == value)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static void check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	if (!ok)
+		check_failed++;
+}
+
+/* A binding suspended through the control socket while its button is held
+ * still releases what it pressed, and takes no new presses. Suspending
+ * sets the flag like control_set_enabled() does. */
+static void check_suspend(btnx_config *cfg)
+{
+	struct engine_sink_t sink = {check_sink, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	
+	engine_init(&engine, cfg, &sink, check_clock, &btnx_stats);
+	stats_reset(&btnx_stats);
+	
+	check_step(&engine, CHECK_RAWCODE, 1);
+	check(check_sent(KEY_A, 1) && check_sent(KEY_LEFTCTRL, 1), "press sends the key");
+	cfg->hot[0].enabled |= BINDING_SUSPENDED;
+	check_step(&engine, CHECK_RAWCODE, 0);
+	check(check_sent(KEY_A, 0) && check_sent(KEY_LEFTCTRL, 0),
+	      "release after a suspend mid-hold sends the release");
+	
+	check_step(&engine, CHECK_RAWCODE, 1);
+	check(check_frames == 0 && btnx_stats.events_suspended == 1,
+	      "press of a suspended binding sends nothing");
+	check_step(&engine, CHECK_RAWCODE, 0);
+	check(check_frames == 0, "release of a press it did not take sends nothing");
+	
+	cfg->hot[0].enabled &= ~BINDING_SUSPENDED;
+	check_step(&engine, CHECK_RAWCODE, 1);
+	check(check_sent(KEY_A, 1), "press after a resume sends the key");
+	check_step(&engine, CHECK_RAWCODE, 0);
+	check(check_sent(KEY_A, 0), "release after a resume sends the release");
+}
+
+/* The statistics of every button, with the histograms full, fit the
+ * buffers the control socket formats them into */
+static void check_format(void)
+{
+	static char buf[CHATTER_FORMAT_SIZE > STATS_FORMAT_SIZE ?
+	                CHATTER_FORMAT_SIZE : STATS_FORMAT_SIZE];
+	static struct chatter_t chatter;
+	hexdump_t ev, release;
+	int i, n, len;
+	
+	chatter_init(&chatter, 0);
+	memset(&ev, 0, sizeof(ev));
+	ev.time.tv_sec = 1;
+	for (i=0; i<CHATTER_BUTTONS; i++)
+	{
+		ev.rawcode = (EV_KEY << 24) | (BTN_MOUSE + i);
+		for (n=0; n<CHATTER_BUCKETS * 2; n++)
+		{
+			ev.pressed = !(n & 1);
+			ev.time.tv_usec += 1L << (n / 2);
+			while (ev.time.tv_usec >= 1000000)
+			{
+				ev.time.tv_sec++;
+				ev.time.tv_usec -= 1000000;
+			}
+			chatter_event(&chatter, &ev, 0, &release);
+		}
+	}
+	len = chatter_format(&chatter, buf, CHATTER_FORMAT_SIZE, 1);
+	check(len > 0 && len < CHATTER_FORMAT_SIZE - 1 && buf[len - 1] == '\n',
+	      "chatter statistics of every button fit CHATTER_FORMAT_SIZE");
+	
+	memset(&btnx_stats, 0xFF, sizeof(btnx_stats));
+	len = stats_format(&btnx_stats, &chatter, buf, STATS_FORMAT_SIZE);
+	check(len > 0 && len < STATS_FORMAT_SIZE - 1 && buf[len - 1] == '\n',
+	      "statistics with the longest counters fit STATS_FORMAT_SIZE");
+	memset(&btnx_stats, 0, sizeof(btnx_stats));
+}
+
+/* A fast wheel with wheel_coalesce goes out in fewer writes, without
+ * losing a step */
+static void check_wheel(void)
+{
+	struct engine_sink_t sink = {check_wheel_sink, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	btnx_config *cfg;
+	hexdump_t ev;
+	int i;
+	
+	if (fixture_file(CONFIG_NAME "_wheel", check_wheel_config) < 0 ||
+	    (cfg = fixture_load("wheel")) == NULL)
+	{
+		check(0, "load the wheel configuration");
+		return;
+	}
+	engine_init(&engine, cfg, &sink, check_clock, &btnx_stats);
+	stats_reset(&btnx_stats);
+	check_wheel_sum = check_wheel_frames = 0;
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.rawcode = CHECK_WHEEL_RAWCODE;
+	ev.pressed = 1;
+	for (i=0; i<CHECK_WHEEL_STEPS; i++)
+	{
+		check_advance(1000);
+		ev.time = check_now;
+		engine_feed(&engine, &ev, 1, 0);
+		engine_tick(&engine);
+	}
+	check_now.tv_sec++;
+	engine_tick(&engine);
+	check(check_wheel_sum == CHECK_WHEEL_STEPS,
+	      "coalesced wheel burst sends every step in REL_WHEEL");
+	check(check_wheel_frames > 0 && check_wheel_frames <= CHECK_WHEEL_STEPS / 8 + 1 &&
+	      btnx_stats.wheel_coalesced ==
+	      (unsigned long) (CHECK_WHEEL_STEPS - check_wheel_frames),
+	      "coalesced wheel burst sends one write per merge window");
+	config_free(cfg);
+}
+
+/* Move the mouse by x and y count times, a report at a time */
+static void check_move(struct engine_t *engine, int x, int y, int count)
+{
+	hexdump_t ev[2];
+	int i;
+	
+	memset(ev, 0, sizeof(ev));
+	ev[0].rawcode = (EV_REL << 24) | ((x & 0xFF) << 16) | REL_X;
+	ev[0].pressed = x;
+	ev[1].rawcode = (EV_REL << 24) | ((y & 0xFF) << 16) | REL_Y;
+	ev[1].pressed = y;
+	for (i=0; i<count; i++)
+	{
+		check_advance(1000);
+		ev[0].time = ev[1].time = check_now;
+		engine_feed(engine, ev, 2, 0);
+	}
+}
+
+/* A stroke drawn with the button held runs its binding on the release,
+ * one that matches none runs nothing, and a click without motion runs
+ * the button's own binding */
+static void check_stroke(void)
+{
+	struct engine_sink_t sink = {check_sink, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	btnx_config *cfg;
+	
+	if (fixture_file(CONFIG_NAME "_stroke", check_stroke_config) < 0 ||
+	    (cfg = fixture_load("stroke")) == NULL)
+	{
+		check(0, "load the stroke configuration");
+		return;
+	}
+	engine_init(&engine, cfg, &sink, check_clock, &btnx_stats);
+	stats_reset(&btnx_stats);
+	
+	check_step(&engine, CHECK_STROKE_RAWCODE, 1);
+	check(check_frames == 0, "press of a stroke button sends nothing");
+	check_move(&engine, 5, 0, 40);
+	check_move(&engine, 0, 5, 40);
+	check_step(&engine, CHECK_STROKE_RAWCODE, 0);
+	check(check_sent(KEY_B, 1) && check_sent(KEY_B, 0) && btnx_stats.strokes == 1,
+	      "stroke R D runs its binding on the release");
+	
+	check_step(&engine, CHECK_STROKE_RAWCODE, 1);
+	check_move(&engine, -5, 0, 40);
+	check_step(&engine, CHECK_STROKE_RAWCODE, 0);
+	check(check_frames == 0 && btnx_stats.strokes == 1 && btnx_stats.strokes_unmatched == 1,
+	      "stroke L matches nothing and is counted");
+	
+	check_step(&engine, CHECK_STROKE_RAWCODE, 1);
+	check_step(&engine, CHECK_STROKE_RAWCODE, 0);
+	check(check_sent(KEY_A, 1) && check_sent(KEY_A, 0) && !check_sent(KEY_B, 1),
+	      "click without motion runs the button's binding");
+	config_free(cfg);
+}
+
+/* One button with a tap, a hold and a double tap binding: a short click
+ * runs the tap once the double tap time is over, holding past the hold
+ * time runs the hold while the button is down, and a second press within
+ * the double tap time runs the double tap instead of two taps */
+static void check_gesture(void)
+{
+	struct engine_sink_t sink = {check_sink, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	btnx_config *cfg;
+	
+	if (fixture_file(CONFIG_NAME "_gesture", check_gesture_config) < 0 ||
+	    (cfg = fixture_load("gesture")) == NULL)
+	{
+		check(0, "load the gesture configuration");
+		return;
+	}
+	engine_init(&engine, cfg, &sink, check_clock, &btnx_stats);
+	
+	check_step(&engine, CHECK_GESTURE_RAWCODE, 1);
+	check_after(&engine, CHECK_GESTURE_RAWCODE, 0, 50000);
+	check(check_frames == 0, "tap waits for the double tap time");
+	check_after(&engine, 0, 0, 300000);
+	check(check_sent(KEY_A, 1) && check_sent(KEY_A, 0) && !check_sent(KEY_C, 1),
+	      "tap runs its binding after the double tap time");
+	
+	check_step(&engine, CHECK_GESTURE_RAWCODE, 1);
+	check_after(&engine, 0, 0, 150000);
+	check(check_frames == 0, "press shorter than the hold time sends nothing");
+	check_after(&engine, 0, 0, 100000);
+	check(check_sent(KEY_B, 1) && !check_sent(KEY_B, 0) && !check_sent(KEY_A, 1),
+	      "hold runs its binding while the button is down");
+	check_after(&engine, CHECK_GESTURE_RAWCODE, 0, 500000);
+	check(check_sent(KEY_B, 0) && !check_sent(KEY_A, 1), "release ends the hold");
+	
+	check_step(&engine, CHECK_GESTURE_RAWCODE, 1);
+	check_after(&engine, CHECK_GESTURE_RAWCODE, 0, 50000);
+	check_after(&engine, CHECK_GESTURE_RAWCODE, 1, 100000);
+	check(check_sent(KEY_C, 1) && !check_sent(KEY_A, 1), "second press runs the double tap");
+	check_after(&engine, CHECK_GESTURE_RAWCODE, 0, 50000);
+	check(check_sent(KEY_C, 0), "second release ends the double tap");
+	check_after(&engine, 0, 0, 1000000);
+	check(check_frames == 0, "double tap runs no tap afterwards");
+	config_free(cfg);
+}
+
+/* A key pressed in a held layer is released by its layer binding after
+ * the layer is dropped, so that it does not stay down. The next press
+ * runs the base layer binding. */
+static void check_layer(void)
+{
+	struct engine_sink_t sink = {check_sink, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	btnx_config *cfg;
+	
+	if (fixture_file(CONFIG_NAME "_layer", check_layer_config) < 0 ||
+	    (cfg = fixture_load("layer")) == NULL)
+	{
+		check(0, "load the layer configuration");
+		return;
+	}
+	engine_init(&engine, cfg, &sink, check_clock, &btnx_stats);
+	
+	check_step(&engine, CHECK_LAYER_RAWCODE, 1);
+	check_step(&engine, CHECK_LAYERED_RAWCODE, 1);
+	check(check_sent(KEY_C, 1) && !check_sent(KEY_A, 1),
+	      "press in a held layer runs its binding");
+	check_step(&engine, CHECK_LAYER_RAWCODE, 0);
+	check(cfg->active_layer == 0 && !check_sent(KEY_C, 0),
+	      "release of the layer key drops the layer");
+	check_step(&engine, CHECK_LAYERED_RAWCODE, 0);
+	check(check_frames == 1 && check_sent(KEY_C, 0) && !check_sent(KEY_A, 0),
+	      "release after the layer change releases the layer binding");
+	
+	check_step(&engine, CHECK_LAYERED_RAWCODE, 1);
+	check(check_sent(KEY_A, 1) && !check_sent(KEY_C, 1), "next press runs the base layer");
+	check_step(&engine, CHECK_LAYERED_RAWCODE, 0);
+	check(check_sent(KEY_A, 0), "next release releases the base layer");
+	config_free(cfg);
+}
+
+/* Click the chatter button CHECK_CLICKS times. With bounces, every fourth
+ * release bounces once. */
+static void check_clicks(struct engine_t *engine, int bounces)
+{
+	int i;
+	
+	for (i=0; i<CHECK_CLICKS; i++)
+	{
+		check_after(engine, CHECK_CHATTER_RAWCODE, 1, CHECK_GAP);
+		check_after(engine, CHECK_CHATTER_RAWCODE, 0, CHECK_HOLD);
+		if (bounces && i % 4 == 0)
+		{
+			check_after(engine, CHECK_CHATTER_RAWCODE, 1, CHECK_BOUNCE);
+			check_after(engine, CHECK_CHATTER_RAWCODE, 0, CHECK_BOUNCE);
+		}
+	}
+	check_after(engine, 0, 0, CHECK_GAP);
+}
+
+static long check_threshold(const struct engine_t *engine)
+{
+	return engine->chatter.buttons[BTN_LEFT - BTN_MOUSE].threshold;
+}
+
+/* The chatter filter learns no threshold from clean clicks and does not
+ * delay them. Once a button bounces, a bounce after a release is dropped
+ * and the button stays down, while a real double click still goes out as
+ * two clicks. */
+static void check_chatter(void)
+{
+	struct engine_sink_t sink = {check_sink, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine, other;
+	btnx_config *cfg;
+	
+	if (fixture_file(CONFIG_NAME "_chatter", check_chatter_config) < 0 ||
+	    (cfg = fixture_load("chatter")) == NULL)
+	{
+		check(0, "load the chatter configuration");
+		return;
+	}
+	engine_init(&engine, cfg, &sink, check_clock, &btnx_stats);
+	stats_reset(&btnx_stats);
+	
+	check_clicks(&engine, 0);
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 1, CHECK_GAP);
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 0, CHECK_HOLD);
+	check(check_threshold(&engine) == 0 && check_sent(KEY_A, 0),
+	      "clean clicks learn no threshold and release at once");
+	
+	engine_init(&engine, cfg, &sink, check_clock, &btnx_stats);
+	check_clicks(&engine, 1);
+	check(check_threshold(&engine) > CHECK_BOUNCE && check_threshold(&engine) < 20000,
+	      "bouncing clicks learn a threshold");
+	engine_init(&other, cfg, &sink, check_clock, &btnx_stats);
+	check(check_threshold(&engine) > 0, "a second engine keeps its own filter");
+	
+	stats_reset(&btnx_stats);
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 1, CHECK_GAP);
+	check(check_sent(KEY_A, 1), "press of a bouncing button is sent");
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 0, CHECK_HOLD);
+	check(check_frames == 0, "release of a bouncing button is held back");
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 1, CHECK_BOUNCE);
+	check(check_frames == 0 && btnx_stats.events_chattered == 1, "bounce is dropped");
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 0, CHECK_BOUNCE);
+	check_after(&engine, 0, 0, 20000);
+	check(check_sent(KEY_A, 0) && !check_sent(KEY_A, 1),
+	      "button released once after the bounce");
+	
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 1, CHECK_GAP);
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 0, CHECK_HOLD);
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 1, 100000);
+	check(check_sent(KEY_A, 0) && check_sent(KEY_A, 1),
+	      "double click 100 ms apart sends both clicks");
+	check_after(&engine, CHECK_CHATTER_RAWCODE, 0, CHECK_HOLD);
+	check_after(&engine, 0, 0, 20000);
+	check(check_sent(KEY_A, 0) && btnx_stats.events_chattered == 1,
+	      "second click of the double click is released");
+	config_free(cfg);
+}
+
+/* A frame the device rejects does not count as written: pressing the key
+ * again is still sent, not left out as a key already held */
+static void check_dropped(void)
+{
+	btnx_frame frame;
+	
+	memset(&frame, 0, sizeof(frame));
+	frame.ev[0].type = EV_KEY;
+	frame.ev[0].code = KEY_A;
+	frame.ev[0].value = 1;
+	frame.ev[1].type = EV_SYN;
+	frame.count[0] = 2;
+	frame.dev[0] = UINPUT_DEV_KBD;
+	
+	if (uinput_init_file("/dev/full") < 0)
+	{
+		check(0, "open /dev/full");
+		return;
+	}
+	stats_reset(&btnx_stats);
+	uinput_submit(&frame);
+	uinput_submit(&frame);
+	check(btnx_stats.writes_dropped == 2 && btnx_stats.writes_suppressed == 0,
+	      "press dropped by the device is sent again by the next press");
+	uinput_close();
+	stats_reset(&btnx_stats);
+}
+
+/* The capabilities and key state of the pipe handler: it has a left Ctrl,
+ * down when set in check_keys */
+static int check_query(int fd, unsigned long request, void *bits)
+{
+	size_t len = _IOC_SIZE(request);
+	
+	(void) fd;
+	memset(bits, 0, len);
+	if (_IOC_TYPE(request) != 'E')
+	{
+		errno = ENOTTY;
+		return -1;
+	}
+	if (_IOC_NR(request) == _IOC_NR(EVIOCGBIT(EV_KEY, 0)))
+		((unsigned char *) bits)[KEY_LEFTCTRL / 8] |= 1 << (KEY_LEFTCTRL % 8);
+	else if (_IOC_NR(request) == _IOC_NR(EVIOCGKEY(0)))
+		memcpy(bits, check_keys, (len < sizeof(check_keys)) ? len : sizeof(check_keys));
+	else
+	{
+		errno = ENOTTY;
+		return -1;
+	}
+	return 0;
+}
+
+/* Queue an event on the pipe handler */
+static int check_feed(int fd, int type, int code, int value)
+{
+	struct input_event ev;
+	
+	memset(&ev, 0, sizeof(ev));
+	gettimeofday(&ev.time, NULL);
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	return (write(fd, &ev, sizeof(ev)) == sizeof(ev)) ? 0 : -1;
+}
+
+/* Ctrl is pressed, then the handler overflows and the release is lost.
+ * The resync after SYN_DROPPED finds Ctrl up and releases it, and the
+ * release still queued after the overflow is not sent again. */
+static void check_resync(void)
+{
+	struct evdev_t *evdev;
+	const hexdump_t *events;
+	int p[2], n;
+	
+	if (pipe(p) < 0 || fcntl(p[0], F_SETFL, O_NONBLOCK) < 0)
+	{
+		check(0, "create the handler pipe");
+		return;
+	}
+	evdev_set_query(check_query);
+	memset(check_keys, 0, sizeof(check_keys));
+	if ((evdev = evdev_new(p[0])) == NULL)
+	{
+		check(0, "open the pipe handler");
+		goto out;
+	}
+	stats_reset(&btnx_stats);
+	
+	check_feed(p[1], EV_KEY, KEY_LEFTCTRL, 1);
+	check_feed(p[1], EV_SYN, SYN_REPORT, 0);
+	n = evdev_read(evdev, &events);
+	check(n == 1 && events[0].rawcode == ((EV_KEY << 24) | KEY_LEFTCTRL) &&
+	      events[0].pressed == 1, "Ctrl press is read");
+	
+	check_feed(p[1], EV_REL, REL_X, 3);
+	check_feed(p[1], EV_SYN, SYN_DROPPED, 0);
+	check_feed(p[1], EV_REL, REL_X, 2);
+	check_feed(p[1], EV_SYN, SYN_REPORT, 0);
+	n = evdev_read(evdev, &events);
+	check(n == 1 && events[0].rawcode == ((EV_KEY << 24) | KEY_LEFTCTRL) &&
+	      events[0].pressed == 0 && btnx_stats.events_dropped == 1,
+	      "resync after SYN_DROPPED releases the Ctrl whose release was lost");
+	
+	check_feed(p[1], EV_KEY, KEY_LEFTCTRL, 0);
+	check_feed(p[1], EV_SYN, SYN_REPORT, 0);
+	n = evdev_read(evdev, &events);
+	check(n == 0, "release queued after the resync is not sent again");
+	
+	evdev_free(evdev);
+out:
+	evdev_set_query(NULL);
+	close(p[0]);
+	close(p[1]);
+	stats_reset(&btnx_stats);
+}
+
+/* Set up a frame of one key event on the keyboard */
+static void check_key_frame(btnx_frame *frame, int code, int value)
+{
+	memset(frame, 0, sizeof(*frame));
+	frame->ev[0].type = EV_KEY;
+	frame->ev[0].code = code;
+	frame->ev[0].value = value;
+	frame->ev[1].type = EV_SYN;
+	frame->count[0] = 2;
+	frame->dev[0] = UINPUT_DEV_KBD;
+}
+
+/* Run the output side of the event loop until count events have been
+ * read from the pipe, or for at most 100 ms. Returns the events read. */
+static int check_output(struct device_fds_t *dev_fds, int fd, struct input_event *ev,
+                        int count)
+{
+	fd_set fds, wfds;
+	ssize_t len;
+	int i, max_fd, read_count=0;
+	
+	for (i=0; i<10 && read_count < count; i++)
+	{
+		FD_ZERO(&fds);
+		FD_ZERO(&wfds);
+		max_fd = -1;
+		uinput_fill_fds(&wfds, &max_fd);
+		if (uring_wait(dev_fds, &fds, &wfds, max_fd, 0, 10000) > 0)
+			uinput_flush(&wfds);
+		if ((len = read(fd, ev + read_count, (count - read_count) * sizeof(*ev))) > 0)
+			read_count += len / sizeof(*ev);
+	}
+	return read_count;
+}
+
+/* Returns 1 if the events are the key event and report of a frame */
+static int check_key_events(const struct input_event *ev, int code, int value)
+{
+	return ev[0].type == EV_KEY && ev[0].code == code && ev[0].value == value &&
+	       ev[1].type == EV_SYN;
+}
+
+/* With io_uring, a frame the device does not take right now is not lost,
+ * and nothing overtakes it. Depending on the kernel the write waits for
+ * the device, or fails with EAGAIN and the frame waits in the queue, with
+ * the writes cancelled behind it. The device is a full pipe, opened
+ * without blocking like uinput. */
+static void check_uring(void)
+{
+	struct device_fds_t dev_fds;
+	struct input_event ev[6];
+	btnx_frame press, release, frame;
+	char path[CHECK_NAME_SIZE];
+	fd_set fds;
+	int p[2], n;
+	long filled=0;
+	
+	if (pipe(p) < 0 || fcntl(p[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(p[1], F_SETFL, O_NONBLOCK) < 0)
+	{
+		check(0, "create a pipe");
+		return;
+	}
+	memset(ev, 0, sizeof(ev));
+	while ((n = write(p[1], ev, sizeof(ev))) > 0 || (n = write(p[1], ev, 1)) > 0)
+		filled += n;
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", p[1]);
+	if (uinput_init_file(path) < 0 || uring_init() < 0)
+	{
+		printf("skip: io_uring write the device does not take\n");
+		uinput_close();
+		close(p[0]);
+		close(p[1]);
+		return;
+	}
+	device_fds_init(&dev_fds);
+	check_key_frame(&press, KEY_A, 1);
+	check_key_frame(&release, KEY_A, 0);
+	stats_reset(&btnx_stats);
+	
+	/* The release comes while the press is in flight */
+	uinput_submit(&press);
+	FD_ZERO(&fds);
+	uring_wait(&dev_fds, &fds, NULL, -1, 0, 10000);
+	uinput_submit(&release);
+	/* Both may follow as soon as there is room */
+	for (; filled > 0; filled -= n)
+	{
+		if ((n = read(p[0], ev, (filled < (long) sizeof(ev)) ? filled : (long) sizeof(ev))) <= 0)
+			break;
+	}
+	n = check_output(&dev_fds, p[0], ev, 4);
+	check(btnx_stats.writes_dropped == 0 && btnx_stats.queue_depth == 0 && n == 4 &&
+	      check_key_events(&ev[0], KEY_A, 1) && check_key_events(&ev[2], KEY_A, 0),
+	      "io_uring press and release the device does not take go out later, in order");
+	
+	/* A chain whose press fails with EAGAIN brings back its release as
+	 * cancelled, and both go out before a frame queued since */
+	uinput_write_failed(uinput_fd(UINPUT_DEV_KBD), press.ev, 2 * sizeof(press.ev[0]), 0,
+	                    EAGAIN);
+	check_key_frame(&frame, KEY_B, 1);
+	uinput_submit(&frame);
+	uinput_write_failed(uinput_fd(UINPUT_DEV_KBD), release.ev, 2 * sizeof(release.ev[0]), 0,
+	                    ECANCELED);
+	n = check_output(&dev_fds, p[0], ev, 6);
+	check(btnx_stats.writes_dropped == 0 && btnx_stats.queue_depth == 0 && n == 6 &&
+	      check_key_events(&ev[0], KEY_A, 1) && check_key_events(&ev[2], KEY_A, 0) &&
+	      check_key_events(&ev[4], KEY_B, 1),
+	      "io_uring writes of a failed chain go out again in order");
+	
+	uring_close();
+	uinput_close();
+	close(p[0]);
+	close(p[1]);
+	stats_reset(&btnx_stats);
+}
+
+int main(void)
+{
+	btnx_config *cfg;
+	
+	daemon_log_ident = "btnx-check";
+	daemon_log_use = DAEMON_LOG_STDERR;
+	if (fixture_init("btnx-check") < 0)
+		return 1;
+	if (fixture_file(EVENTS_NAME, check_events) < 0 ||
+	    fixture_file(CONFIG_NAME "_check", check_config) < 0 ||
+	    (cfg = fixture_load("check")) == NULL)
+	{
+		fprintf(stderr, "Could not set up the configuration\n");
+		fixture_cleanup();
+		return 1;
+	}
+	
+	check_suspend(cfg);
+	check_format();
+	check_wheel();
+	check_stroke();
+	check_gesture();
+	check_layer();
+	check_chatter();
+	check_dropped();
+	check_resync();
+	check_uring();
+	
+	config_free(cfg);
+	fixture_cleanup();
+	return check_failed ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* btnx-check-alloc: checks that the event path allocates nothing once the
+ * configuration is loaded. A generated configuration is loaded from a
+ * temporary directory, and synthetic traffic for every binding and some
+ * pointer motion is read from a pipe, matched, debounced and written to
+ * /dev/null, with the timers run in between. alloc.c counts the
+ * allocations of the thread while it does that. Run by make check; the
+ * daemon itself is not linked with alloc.c. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <linux/input.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "alloc.h"
+#include "config_parser.h"
+#include "engine.h"
+#include "evdev.h"
+#include "fixture.h"
+#include "log.h"
+#include "stats.h"
+#include "uinput.h"
+
+#define CHECK_ALLOC_ROUNDS		200		/* Replays of the synthetic traffic */
+#define CHECK_ALLOC_BATCH		512		/* Events written to the pipe at once */
+#define CHECK_ALLOC_PAUSE		2000	/* Microseconds between replays */
+#define CHECK_ALLOC_SKIP		77		/* Exit status of a skipped test */
+
+static const char check_alloc_events[] =
+	"KEY_A\t30\n"
+	"KEY_B\t48\n"
+	"KEY_C\t46\n"
+	"KEY_LEFTCTRL\t29\n";
+
+/* Keys with a modifier, a tap and a hold, a stroke, a layer, coalesced
+ * wheel steps and the chatter filter */
+static const char check_alloc_config[] =
+	"Mouse\n"
+	"\tvendor_id = 0x46d\n"
+	"\twheel_coalesce = 1\n"
+	"\tchatter_max = 20\n"
+	"EndMouse\n"
+	"Button\n"
+	"\trawcode = 0x01000113\n"
+	"\tkeycode = KEY_A\n"
+	"\tmod1 = KEY_LEFTCTRL\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000114\n"
+	"\tkeycode = KEY_B\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000114\n"
+	"\tkeycode = KEY_C\n"
+	"\ttrigger = hold\n"
+	"\ttrigger_time = 1\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000112\n"
+	"\tkeycode = KEY_A\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000112\n"
+	"\tkeycode = KEY_B\n"
+	"\tstroke = R\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000115\n"
+	"\tlayer_hold = 1\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x01000116\n"
+	"\tkeycode = KEY_C\n"
+	"\tlayer = 1\n"
+	"\tdelay = 0\n"
+	"EndButton\n"
+	"Button\n"
+	"\trawcode = 0x02010008\n"
+	"\tkeycode = REL_WHEELFORWARD\n"
+	"\tdelay = 0\n"
+	"EndButton\n";
+
+static void check_alloc_frame(void *data, const btnx_frame *frame);
+static int check_alloc_event(struct input_event *ev, int n, int rawcode);
+
+/* The check creates no uinput devices */
+int open_handler(char *name, int flags)
+{
+	(void) name; (void) flags;
+	errno = ENODEV;
+	return -1;
+}
+
+static void check_alloc_frame(void *data, const btnx_frame *frame)
+{
+	(void) data;
+	uinput_submit(frame);
+}
+
+/* Add the events of a binding rawcode, each in its own report, after n
+ * events. Keys get a press and a release. Returns the new number of
+ * events. */
+static int check_alloc_event(struct input_event *ev, int n, int rawcode)
+{
+	int type = (rawcode >> 24) & 0xFF, code = rawcode & 0xFFFF, values[2] = {1, 0};
+	int i;
+	
+	if (type == EV_REL)
+		values[0] = (signed char) ((rawcode >> 16) & 0xFF);
+	else if (type != EV_KEY)
+		return n;
+	for (i=0; i < (type == EV_KEY ? 2 : 1); i++)
+	{
+		gettimeofday(&ev[n].time, NULL);
+		ev[n].type = type;
+		ev[n].code = code;
+		ev[n++].value = values[i];
+		ev[n].time = ev[n-1].time;
+		ev[n].type = EV_SYN;
+		ev[n].code = SYN_REPORT;
+		ev[n++].value = 0;
+	}
+	return n;
+}
+
+int main(void)
+{
+	struct engine_sink_t sink = {check_alloc_frame, NULL, NULL, NULL, NULL, NULL};
+	struct engine_t engine;
+	struct alloc_report_t report;
+	struct input_event *ev=NULL;
+	struct evdev_t *evdev=NULL;
+	const hexdump_t *events;
+	btnx_config *cfg;
+	int fds[2], i, n=0, round, sent, len, count, ret=1;
+	
+	daemon_log_ident = "btnx-check-alloc";
+	daemon_log_use = DAEMON_LOG_STDERR;
+	if (fixture_init("btnx-check-alloc") < 0)
+		return 1;
+	if (fixture_file(EVENTS_NAME, check_alloc_events) < 0 ||
+	    fixture_file(CONFIG_NAME "_alloc", check_alloc_config) < 0 ||
+	    (cfg = fixture_load("alloc")) == NULL)
+	{
+		fprintf(stderr, "Could not set up the configuration\n");
+		fixture_cleanup();
+		return 1;
+	}
+	engine_init(&engine, cfg, &sink, NULL, &btnx_stats);
+	if ((ev = (struct input_event *) calloc(cfg->count * 4 + 4,
+	                                        sizeof(struct input_event))) == NULL ||
+	    uinput_init_file("/dev/null") < 0 || pipe(fds) < 0 ||
+	    fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    (evdev = evdev_new(fds[0])) == NULL)
+	{
+		fprintf(stderr, "Could not set up the allocation check: %s\n", strerror(errno));
+		goto finish;
+	}
+	for (i=0; i<cfg->count; i++)
+		n = check_alloc_event(ev, n, cfg->hot[i].rawcode);
+	n = check_alloc_event(ev, n, (EV_REL << 24) | (3 << 16) | REL_X);
+	n = check_alloc_event(ev, n, (EV_REL << 24) | (0xFE << 16) | REL_Y);
+	
+	log_start();
+	if (alloc_guard(1) < 0)
+	{
+		printf("skip: allocations cannot be counted with this C library\n");
+		log_stop();
+		ret = CHECK_ALLOC_SKIP;
+		goto finish;
+	}
+	for (round=0; round<CHECK_ALLOC_ROUNDS; round++)
+	{
+		/* Whole reports, the pipe does not take more than a few pages */
+		for (sent=0; sent<n; sent+=len)
+		{
+			len = (n - sent < CHECK_ALLOC_BATCH) ? n - sent : CHECK_ALLOC_BATCH;
+			if (write(fds[1], ev + sent, len * sizeof(struct input_event)) < 0)
+				break;
+			while ((count = evdev_read(evdev, &events)) > 0)
+				engine_feed(&engine, events, count, cfg->grab);
+			engine_tick(&engine);
+		}
+		/* Past the delay of the bindings, and the due timers */
+		usleep(CHECK_ALLOC_PAUSE);
+		engine_tick(&engine);
+	}
+	alloc_guard(0);
+	log_stop();
+	
+	alloc_report(&report);
+	if (report.count > 0)
+		printf("FAIL: the event path allocated %lu times, first %lu bytes from %p\n",
+		       report.count, (unsigned long) report.size, report.caller);
+	else
+		printf("ok: no allocations in %d rounds of %d events: %lu matched, "
+		       "%lu debounced, %lu sent\n", CHECK_ALLOC_ROUNDS, n,
+		       btnx_stats.events_matched, btnx_stats.events_debounced,
+		       btnx_stats.events_sent);
+	ret = (report.count > 0);
+	
+finish:
+	evdev_free(evdev);
+	uinput_close();
+	free(ev);
+	config_free(cfg);
+	fixture_cleanup();
+	return ret;
+}
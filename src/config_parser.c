@@ -4,12 +4,13 @@
   * see btnx.c for detailed license information
   */
 
-#define _GNU_SOURCE				// Needed for strcasestr()
-
 #include "btnx.h"
+#include "arena.h"
+#include "layer.h"
 #include "config_parser.h"
 #include "device.h"
 #include "revoco.h"
+#include "chatter.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -17,6 +18,9 @@
 #include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <libdaemon/dlog.h>
 
 #define CONFIG_MOUSE_BEGIN		"Mouse"
@@ -24,6 +28,11 @@
 #define CONFIG_BUTTON_BEGIN		"Button"
 #define CONFIG_BUTTON_END		"EndButton"
 #define MAX_BEVS	10
+#define KEYCODE_NAME_SIZE	24
+#define KEYCODE_TABLE_SIZE	2048	/* Power of two, over twice the events */
+#define OPTION_TABLE_SIZE	256		/* Power of two */
+#define OPTION_SEED			34		/* Collision free for the options below */
+#define NUMBER_SIZE			32
 
 /* Value used to indicate what type of block is currently being parsed */
 enum
@@ -33,26 +42,170 @@ enum
 	BLOCK_BUTTON	/* Parsing a Button block */
 };
 
+/* The binding being parsed, and the settings of the Mouse block that
+ * end up in the configuration */
+struct config_entry_t {
+	btnx_binding *hot;
+	btnx_event *cold;
+	struct arena_t *arena;
+	int wheel_coalesce;
+	int wheel_key_rate;
+	int stroke_step;
+	int chatter_max;
+	int chatter_unbound;
+	int failed;				/* Out of memory, the file is given up */
+};
+
+/* State of config_parse() */
+struct config_parse_t {
+	struct config_entry_t entry;
+	btnx_binding *hot;		/* Temporary binding arrays */
+	btnx_event *cold;
+	int count;
+	int size;
+	int block_type;
+	int block_begin;
+	int block_end;
+};
+
+/* An entry of the events file */
+struct keycode_t {
+	char name[KEYCODE_NAME_SIZE];
+	int value;
+};
+
+/* Block keywords and options */
+enum
+{
+	OPT_BUTTON_BEGIN=0,
+	OPT_BUTTON_END,
+	OPT_MOUSE_BEGIN,
+	OPT_MOUSE_END,
+	OPT_RAWCODE,
+	OPT_ENABLED,
+	OPT_TYPE,
+	OPT_DELAY,
+	OPT_KEYCODE,
+	OPT_MOD,
+	OPT_COMMAND,
+	OPT_UID,
+	OPT_SWITCH_TYPE,
+	OPT_SWITCH_NAME,
+	OPT_WHEEL_MODE,
+	OPT_LAYER,
+	OPT_LAYER_HOLD,
+	OPT_LAYER_TOGGLE,
+	OPT_FORCE_RELEASE,
+	OPT_TRIGGER,
+	OPT_TRIGGER_TIME,
+	OPT_STROKE,
+	OPT_MOTION_SCALE,
+	OPT_MOTION_SCROLL,
+	OPT_MOTION_INVERT,
+	OPT_IGNORED,
+	OPT_VENDOR_ID,
+	OPT_PRODUCT_ID,
+	OPT_REVOCO_MODE,
+	OPT_REVOCO_BTN,
+	OPT_REVOCO_UP_SCROLL,
+	OPT_REVOCO_DOWN_SCROLL,
+	OPT_WHEEL_COALESCE,
+	OPT_WHEEL_KEY_RATE,
+	OPT_STROKE_STEP,
+	OPT_CHATTER_MAX,
+	OPT_CHATTER_UNBOUND
+};
+
+/* A keyword or option name, and the block it is valid in */
+struct config_option_t {
+	const char *name;
+	int id;
+	int block;
+};
+
+static const struct config_option_t config_options[] = {
+	{CONFIG_BUTTON_BEGIN,	OPT_BUTTON_BEGIN,		BLOCK_NONE},
+	{CONFIG_BUTTON_END,		OPT_BUTTON_END,			BLOCK_NONE},
+	{CONFIG_MOUSE_BEGIN,	OPT_MOUSE_BEGIN,		BLOCK_NONE},
+	{CONFIG_MOUSE_END,		OPT_MOUSE_END,			BLOCK_NONE},
+	{"rawcode",				OPT_RAWCODE,			BLOCK_BUTTON},
+	{"enabled",				OPT_ENABLED,			BLOCK_BUTTON},
+	{"type",				OPT_TYPE,				BLOCK_BUTTON},
+	{"delay",				OPT_DELAY,				BLOCK_BUTTON},
+	{"keycode",				OPT_KEYCODE,			BLOCK_BUTTON},
+	{"mod1",				OPT_MOD,				BLOCK_BUTTON},
+	{"mod2",				OPT_MOD,				BLOCK_BUTTON},
+	{"mod3",				OPT_MOD,				BLOCK_BUTTON},
+	{"command",				OPT_COMMAND,			BLOCK_BUTTON},
+	{"uid",					OPT_UID,				BLOCK_BUTTON},
+	{"switch_type",			OPT_SWITCH_TYPE,		BLOCK_BUTTON},
+	{"switch_name",			OPT_SWITCH_NAME,		BLOCK_BUTTON},
+	{"wheel_mode",			OPT_WHEEL_MODE,			BLOCK_BUTTON},
+	{"layer",				OPT_LAYER,				BLOCK_BUTTON},
+	{"layer_hold",			OPT_LAYER_HOLD,			BLOCK_BUTTON},
+	{"layer_toggle",		OPT_LAYER_TOGGLE,		BLOCK_BUTTON},
+	{"force_release",		OPT_FORCE_RELEASE,		BLOCK_BUTTON},
+	{"trigger",				OPT_TRIGGER,			BLOCK_BUTTON},
+	{"trigger_time",		OPT_TRIGGER_TIME,		BLOCK_BUTTON},
+	{"stroke",				OPT_STROKE,				BLOCK_BUTTON},
+	{"motion_scale",		OPT_MOTION_SCALE,		BLOCK_BUTTON},
+	{"motion_scroll",		OPT_MOTION_SCROLL,		BLOCK_BUTTON},
+	{"motion_invert",		OPT_MOTION_INVERT,		BLOCK_BUTTON},
+	{"name",				OPT_IGNORED,			BLOCK_BUTTON},
+	{"vendor_name",			OPT_IGNORED,			BLOCK_MOUSE},
+	{"product_name",		OPT_IGNORED,			BLOCK_MOUSE},
+	{"vendor_id",			OPT_VENDOR_ID,			BLOCK_MOUSE},
+	{"product_id",			OPT_PRODUCT_ID,			BLOCK_MOUSE},
+	{"revoco_mode",			OPT_REVOCO_MODE,		BLOCK_MOUSE},
+	{"revoco_btn",			OPT_REVOCO_BTN,			BLOCK_MOUSE},
+	{"revoco_up_scroll",	OPT_REVOCO_UP_SCROLL,	BLOCK_MOUSE},
+	{"revoco_down_scroll",	OPT_REVOCO_DOWN_SCROLL,	BLOCK_MOUSE},
+	{"wheel_coalesce",		OPT_WHEEL_COALESCE,		BLOCK_MOUSE},
+	{"wheel_key_rate",		OPT_WHEEL_KEY_RATE,		BLOCK_MOUSE},
+	{"stroke_step",			OPT_STROKE_STEP,		BLOCK_MOUSE},
+	{"chatter_max",			OPT_CHATTER_MAX,		BLOCK_MOUSE},
+	{"chatter_unbound",		OPT_CHATTER_UNBOUND,	BLOCK_MOUSE}
+};
+
+#define NUM_OPTIONS	((int) (sizeof(config_options) / sizeof(config_options[0])))
+
 /* Static variables */
 static char next_config[CONFIG_NAME_MAX_SIZE];	/* Name of next config */
 static char prev_config[CONFIG_NAME_MAX_SIZE];	/* Name of previous config */
-static char first_config[CONFIG_NAME_MAX_SIZE] = ""; /* Name of current config */
 static int have_next_config=0;					/* Is next config defined? */
 static int have_prev_config=0;					/* Is previous config defined? */
+static struct keycode_t *keycodes=NULL;			/* Contents of the events file */
+static int num_keycodes=0;
+static short *keycode_table=NULL;				/* Hashed indexes into keycodes */
+static signed char option_table[OPTION_TABLE_SIZE];	/* Perfect hash of config_options */
+static unsigned int option_seed=0;
+static const char *config_path=CONFIG_PATH;		/* Directory of the configuration files */
 
 /* Static function declarations */
 static inline void strip_newline(char *str, int size);
 static char *config_get_names(char *config_name);
-static const char *config_add_value(btnx_event *e, 
-									int type, 
-									const char *option, 
-									char *value);
+static int config_read_ids(struct config_id_t *id);
+static inline unsigned int config_hash(const char *str, int len, unsigned int seed);
+static int config_init_options(void);
+static const struct config_option_t *config_find_option(const char *name, int len);
+static int config_add_value(struct config_entry_t *e, 
+							int type, 
+							const struct config_option_t *option, 
+							const char *value, int len);
 static void config_add_mod(btnx_event *e, int mod);
-static int config_get_keycode(const char *value);
-static char **config_split_command(char *cmd);
-static char *config_set_command(btnx_event *e, char *value);
-static void config_set_switch_type(btnx_event *e, char *value);
-static void config_set_switch_name(btnx_event *e, char *value);
+static int config_load_keycodes(void);
+static int config_get_keycode(const char *value, int len);
+static int config_number(const char *value, int len, int base);
+static char **config_split_command(struct arena_t *arena, char *cmd);
+static char *config_set_command(struct config_entry_t *e, const char *value, int len);
+static int config_layer_number(const char *value, int len);
+static int config_trigger(const char *value, int len);
+static void config_set_stroke(btnx_event *e, const char *value, int len);
+static btnx_motion *config_motion(btnx_event *e);
+static int config_invert(const char *value, int len);
+static void config_compile_action(btnx_binding *b, const btnx_event *e, int coalesce);
+static void config_new_binding(struct config_parse_t *p);
+static void config_parse_line(struct config_parse_t *p, const char *beg, const char *end);
 
 /* Strip newlines from a string. Used for config name parsing. */
 static inline void strip_newline(char *str, int size)
@@ -63,6 +216,13 @@ static inline void strip_newline(char *str, int size)
 		if (str[x] == '\n') str[x] = '\0';
 }
 
+/* Read the configuration files from another directory than CONFIG_PATH,
+ * e.g. for the benchmarks. path must stay valid. */
+void config_set_path(const char *path)
+{
+	config_path = path;
+}
+
 /* Return the name of the next configuration */
 const char *config_get_next(void)
 {
@@ -94,7 +254,8 @@ static char *config_get_names(char *config_name)
 	name_prev[0] = '\0';
 	name_first[0] = '\0';
 	
-	if (!(fp = fopen(CONFIG_MANAGER_FILE,"r")))
+	sprintf(buffer, "%s/%s", config_path, CONFIG_MANAGER_NAME);
+	if (!(fp = fopen(buffer,"r")))
 	{
 		perror(OUT_PRE "Could not read the config manager file");
 		if (config_name != NULL) free(config_name);
@@ -186,16 +347,216 @@ static char *config_get_names(char *config_name)
 	return config_name;
 }
 
-/* Converts the string representation of a keycode to its integer value */
-static int config_get_keycode(const char *value)
+/* Read only the vendor and product IDs from the Mouse block of a
+ * configuration file. Stops at the first Button block. */
+static int config_read_ids(struct config_id_t *id)
+{
+	FILE *fp;
+	char buffer[CONFIG_PARSE_BUFFER_SIZE];
+	char *loc_beg, *loc_eq;
+	int found=0;
+	
+	sprintf(buffer, "%s/%s_%s", config_path, CONFIG_NAME, id->name);
+	if (!(fp = fopen(buffer, "r")))
+		return -1;
+	
+	id->vendor = id->product = 0;
+	while (found < 2 && fgets(buffer, CONFIG_PARSE_BUFFER_SIZE-1, fp) != NULL)
+	{
+		loc_beg = buffer;
+		while (isspace(*loc_beg)) loc_beg++;
+		if (*loc_beg == '#' || *loc_beg == '\0')
+			continue;
+		if (strncasecmp(loc_beg, CONFIG_BUTTON_BEGIN, strlen(CONFIG_BUTTON_BEGIN)) == 0 &&
+			(isspace(loc_beg[strlen(CONFIG_BUTTON_BEGIN)]) ||
+			 loc_beg[strlen(CONFIG_BUTTON_BEGIN)] == '\0'))
+			break;
+		if ((loc_eq = strchr(loc_beg, '=')) == NULL)
+			continue;
+		if (strncasecmp(loc_beg, "vendor_id", 9) == 0)
+		{
+			id->vendor = strtol(loc_eq + 1, NULL, 16);
+			found++;
+		}
+		else if (strncasecmp(loc_beg, "product_id", 10) == 0)
+		{
+			id->product = strtol(loc_eq + 1, NULL, 16);
+			found++;
+		}
+	}
+	
+	fclose(fp);
+	return 0;
+}
+
+/* Build an index of the mouse IDs of every configuration listed in the
+ * config manager file, in priority order. Returns the number of entries.
+ * The caller frees *ids. */
+int config_index(struct config_id_t **ids)
+{
+	FILE *fp;
+	char buffer[CONFIG_PARSE_BUFFER_SIZE];
+	int count=0, size=MAX_BEVS;
+	
+	*ids = NULL;
+	sprintf(buffer, "%s/%s", config_path, CONFIG_MANAGER_NAME);
+	if (!(fp = fopen(buffer,"r")))
+		return 0;
+	
+	*ids = (struct config_id_t *) malloc(size * sizeof(struct config_id_t));
+	while (*ids != NULL && fgets(buffer, CONFIG_PARSE_BUFFER_SIZE-1, fp) != NULL)
+	{
+		strip_newline(buffer, CONFIG_PARSE_BUFFER_SIZE);
+		if (buffer[0] == '\0' || strlen(buffer) >= CONFIG_NAME_MAX_SIZE)
+			continue;
+		if (count >= size)
+		{
+			size *= 2;
+			*ids = (struct config_id_t *) realloc(*ids, size * sizeof(struct config_id_t));
+			if (*ids == NULL)
+				break;
+		}
+		strcpy((*ids)[count].name, buffer);
+		if (config_read_ids(&(*ids)[count]) < 0)
+		{
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: could not read configuration %s",
+					buffer);
+			continue;
+		}
+		count++;
+	}
+	
+	fclose(fp);
+	if (*ids == NULL)
+		return 0;
+	return count;
+}
+
+/* Hash a string case-insensitively (FNV-1a) */
+static inline unsigned int config_hash(const char *str, int len, unsigned int seed)
+{
+	unsigned int h = 2166136261u ^ seed;
+	
+	while (len-- > 0)
+	{
+		h ^= (unsigned char) tolower((unsigned char) *str++);
+		h *= 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+/* Build the option lookup table. Every option gets its own slot, so a
+ * lookup is one hash and one compare. If an added option collides with
+ * OPTION_SEED, the next collision free seed is searched. */
+static int config_init_options(void)
+{
+	int i, slot;
+	unsigned int seed;
+	
+	if (option_seed != 0)
+		return 0;
+	for (seed = OPTION_SEED; seed < OPTION_SEED + 100000; seed++)
+	{
+		memset(option_table, -1, sizeof(option_table));
+		for (i=0; i<NUM_OPTIONS; i++)
+		{
+			slot = config_hash(config_options[i].name, strlen(config_options[i].name), seed)
+			       & (OPTION_TABLE_SIZE - 1);
+			if (option_table[slot] >= 0)
+				break;
+			option_table[slot] = i;
+		}
+		if (i == NUM_OPTIONS)
+		{
+			option_seed = seed;
+			return 0;
+		}
+	}
+	daemon_log(LOG_ERR, OUT_PRE "Error: no perfect hash for the configuration options");
+	return -1;
+}
+
+/* Find a keyword or option by name */
+static const struct config_option_t *config_find_option(const char *name, int len)
+{
+	int i;
+	
+	i = option_table[config_hash(name, len, option_seed) & (OPTION_TABLE_SIZE - 1)];
+	if (i < 0 || strncasecmp(config_options[i].name, name, len) != 0 ||
+		config_options[i].name[len] != '\0')
+		return NULL;
+	return &config_options[i];
+}
+
+/* Read the events file into memory once, so that keycode lookups do not
+ * need to spawn processes or reread the file. The names are hashed for
+ * lookups. */
+static int config_load_keycodes(void)
 {
 	FILE *fp;
 	char buffer[128];
-	char *loc_beg;
-	unsigned int len;
+	char name[KEYCODE_NAME_SIZE];
+	char value[KEYCODE_NAME_SIZE];
+	int size=512;
+	unsigned int h;
+	
+	if (keycodes != NULL)
+		return num_keycodes;
+	
+	sprintf(buffer, "%s/%s", config_path, EVENTS_NAME);
+	if (!(fp = fopen(buffer, "r")))
+	{
+		daemon_log(LOG_WARNING, OUT_PRE "Could not read the events file: %s", strerror(errno));
+		return 0;
+	}
+	
+	keycodes = (struct keycode_t *) malloc(size * sizeof(struct keycode_t));
+	keycode_table = (short *) malloc(KEYCODE_TABLE_SIZE * sizeof(short));
+	if (keycode_table != NULL)
+		memset(keycode_table, -1, KEYCODE_TABLE_SIZE * sizeof(short));
+	while (keycodes != NULL && keycode_table != NULL && fgets(buffer, 127, fp) != NULL)
+	{
+		if (sscanf(buffer, "%23s %23s", name, value) != 2)
+			continue;
+		if (num_keycodes >= KEYCODE_TABLE_SIZE / 2)
+			break;
+		if (num_keycodes >= size)
+		{
+			size *= 2;
+			keycodes = (struct keycode_t *) realloc(keycodes, size * sizeof(struct keycode_t));
+			if (keycodes == NULL)
+				break;
+		}
+		strcpy(keycodes[num_keycodes].name, name);
+		keycodes[num_keycodes].value = strtol(value, NULL, 0);
+		/* The first entry of a name wins */
+		for (h = config_hash(name, strlen(name), 0);; h++)
+		{
+			if (keycode_table[h & (KEYCODE_TABLE_SIZE - 1)] < 0)
+			{
+				keycode_table[h & (KEYCODE_TABLE_SIZE - 1)] = num_keycodes;
+				break;
+			}
+			if (!strcasecmp(keycodes[keycode_table[h & (KEYCODE_TABLE_SIZE - 1)]].name, name))
+				break;
+		}
+		num_keycodes++;
+	}
+	fclose(fp);
+	
+	if (keycodes == NULL || keycode_table == NULL)
+		num_keycodes = 0;
+	return num_keycodes;
+}
+
+/* Converts the string representation of a keycode to its integer value */
+static int config_get_keycode(const char *value, int len)
+{
+	int i;
+	unsigned int h;
 	
 	/* Length is longer than any defined event */
-	if (strlen(value) > 20)
+	if (len > 20)
 	{
 		daemon_log(LOG_WARNING, OUT_PRE "Warning: possibly malformed keycode or "
 				"modifier value. Ignoring.");
@@ -203,34 +564,37 @@ static int config_get_keycode(const char *value)
 	}
 	
 	/* Explicitly no defined keycode */
-	if (!strcasecmp(value, "none"))
+	if (len == 4 && !strncasecmp(value, "none", 4))
 		return 0;
 	
 	/* btnx's own defined events */
-	if (!strcasecmp(value, "REL_WHEELFORWARD"))
+	if (len == 16 && !strncasecmp(value, "REL_WHEELFORWARD", 16))
 		return REL_WHEELFORWARD;
-	else if (!strcasecmp(value, "REL_WHEELBACK"))
+	else if (len == 13 && !strncasecmp(value, "REL_WHEELBACK", 13))
 		return REL_WHEELBACK;
 	
-	/* use cat and grep to our advantage here to find the keycode in the
-	 * events file */
-	sprintf(buffer, "cat %s/%s | /bin/grep %s", CONFIG_PATH, EVENTS_NAME, value);
-	fp = popen(buffer, "r");
-	while (fgets(buffer, 127, fp) != NULL)
+	/* find the keycode in the events file */
+	if (config_load_keycodes() == 0)
+		return 0;
+	for (h = config_hash(value, len, 0);; h++)
 	{
-		len = strlen(buffer);
-		if (len > 0 && len > strlen(value))
-		{
-			loc_beg = strcasestr(buffer, value) + strlen(value);
-			if (!isspace(*loc_beg))
-				continue;
-			pclose(fp);
-			return strtol(loc_beg, NULL, 0);
-		}
+		if ((i = keycode_table[h & (KEYCODE_TABLE_SIZE - 1)]) < 0)
+			return 0;
+		if (!strncasecmp(keycodes[i].name, value, len) && keycodes[i].name[len] == '\0')
+			return keycodes[i].value;
 	}
-	pclose(fp);
+}
+
+/* Convert a numeric value. Values are not terminated in the mapped file. */
+static int config_number(const char *value, int len, int base)
+{
+	char buf[NUMBER_SIZE];
 	
-	return 0;
+	if (len >= NUMBER_SIZE)
+		len = NUMBER_SIZE - 1;
+	memcpy(buf, value, len);
+	buf[len] = '\0';
+	return strtol(buf, NULL, base);
 }
 
 /* Adds a modifier key value to an event structure */
@@ -253,7 +617,7 @@ static void config_add_mod(btnx_event *e, int mod)
 
 /* Split an execute command string into a string vector of its executable path
  * and its arguments for execv() */
-static char **config_split_command(char *cmd)
+static char **config_split_command(struct arena_t *arena, char *cmd)
 {
 	char *beg, *end, closing='\0';
 	int stop=0, i=0, enclosed=0;
@@ -261,7 +625,8 @@ static char **config_split_command(char *cmd)
 	
 	if (cmd == NULL)
 		return NULL;
-	args = (char **) malloc(sizeof(char*));
+	/* Every argument but the last takes at least two characters */
+	args = (char **) arena_alloc(arena, (strlen(cmd) / 2 + 2) * sizeof(char*));
 	if (args == NULL)
 		return NULL;
 	args[0] = NULL;
@@ -294,7 +659,6 @@ static char **config_split_command(char *cmd)
 		*end = '\0';
 		
 		i++;
-		args = (char **) realloc(args, (i+1) * sizeof(char*));
 		args[i-1] = beg; args[i] = NULL;
 		
 		if (stop)
@@ -316,312 +680,570 @@ static char **config_split_command(char *cmd)
 }
 
 /* Set event type, the command and its arguments for a command execution event */
-static char *config_set_command(btnx_event *e, char *value)
+static char *config_set_command(struct config_entry_t *e, const char *value, int len)
 {
-	e->command = (char *) malloc((strlen(value) + 1)*sizeof(char));
+	e->cold->command = (char *) arena_alloc(e->arena, len + 1);
 	
-	if (e->command == NULL)
+	if (e->cold->command == NULL)
 	{
 		daemon_log(LOG_WARNING, OUT_PRE "Error: could not allocate command: %s", strerror(errno));
+		e->failed = 1;
 		return NULL;
 	}
-	e->keycode = COMMAND_EXECUTE;
-	strcpy(e->command, value);
+	memcpy(e->cold->command, value, len);
+	e->cold->keycode = COMMAND_EXECUTE;
 	
-	e->args = config_split_command(e->command);
-	if (e->args == NULL)
+	e->cold->args = config_split_command(e->arena, e->cold->command);
+	if (e->cold->args == NULL)
 	{
-		daemon_log(LOG_WARNING, OUT_PRE "Fatal error in config_split_command. Exiting...");
-		exit(BTNX_ERROR_BAD_CONFIG);
+		daemon_log(LOG_WARNING, OUT_PRE "Fatal error in config_split_command.");
+		e->failed = 1;
+		return NULL;
 	}
 	
-	return e->command;
+	return e->cold->command;
 	
 }
 
-/* Set the configuration switch type for an event. */
-static void config_set_switch_type(btnx_event *e, char *value)
+/* Parse a layer number, 0 for invalid values */
+static int config_layer_number(const char *value, int len)
 {
-	int num;
+	int layer = config_number(value, len, 10);
 	
-	e->keycode = CONFIG_SWITCH;
-	num = strtol(value, NULL, 10);
-	e->switch_type = num;
+	if (layer < 0 || layer >= MAX_LAYERS)
+	{
+		daemon_log(LOG_WARNING, OUT_PRE "Warning: invalid layer %.*s, using the base layer",
+				len, value);
+		return 0;
+	}
+	return layer;
 }
 
-/* Set the configuration switch name for an event. */
-static void config_set_switch_name(btnx_event *e, char *value)
+/* Parse a trigger name, TRIGGER_NONE for invalid values */
+static int config_trigger(const char *value, int len)
 {
-	if (e->switch_name != NULL)
-		free(e->switch_name);
-	e->switch_name = (char *) malloc((strlen(value)+1) * sizeof(char));
-	strcpy(e->switch_name, value);
+	if (len == 3 && !strncasecmp(value, "tap", 3))
+		return TRIGGER_TAP;
+	if (len == 4 && !strncasecmp(value, "hold", 4))
+		return TRIGGER_HOLD;
+	if (len == 6 && !strncasecmp(value, "double", 6))
+		return TRIGGER_DOUBLE;
+	daemon_log(LOG_WARNING, OUT_PRE "Warning: invalid trigger %.*s, "
+			"expected tap, hold or double", len, value);
+	return TRIGGER_NONE;
 }
 
-/* Compares the parsed option name to defined option names. If a match is found,
- * set the value to the correct variable in the event structure. */
-static const char *config_add_value(btnx_event *e, 
-									int type, 
-									const char *option, 
-									char *value)
+/* Parse the directions of a stroke, e.g. "L R UL". A stroke that is not
+ * valid leaves the binding a normal one. */
+static void config_set_stroke(btnx_event *e, const char *value, int len)
 {
-	/* Button values */
-	if (type == BLOCK_BUTTON)
+	static const char *names[] = {"", "U", "UR", "R", "DR", "D", "DL", "L", "UL"};
+	const char *end = value + len, *tok;
+	int dir;
+	
+	e->path_len = 0;
+	while (value < end)
 	{
-		if (!strcasecmp(option, "rawcode"))
-		{
-			e->rawcode = strtol(value, NULL, 16);
-			return option;
-		}
-		if (!strcasecmp(option, "enabled"))
-		{
-			e->enabled = strtol(value, NULL, 10);
-			return option;
-		}
-		if (!strcasecmp(option, "type"))
-		{
-			e->type = strtol(value, NULL, 10);
-			return option;
-		}
-		if (!strcasecmp(option, "delay"))
-		{
-			e->delay = strtol(value, NULL, 10);
-			return option;
-		}
-		if (!strcasecmp(option, "keycode"))
-		{
-			e->keycode = config_get_keycode(value);
-			return option;
-		}
-		if (!strcasecmp(option, "mod1"))
+		if (isspace(*value) || *value == ',' || *value == '-')
 		{
-			config_add_mod(e, config_get_keycode(value));
-			return option;
+			value++;
+			continue;
 		}
-		if (!strcasecmp(option, "mod2"))
+		for (tok = value; value < end && isalpha(*value); value++);
+		for (dir = STROKE_U; dir <= STROKE_UL; dir++)
 		{
-			config_add_mod(e, config_get_keycode(value));
-			return option;
+			if ((int) strlen(names[dir]) == value - tok &&
+			    !strncasecmp(names[dir], tok, value - tok))
+				break;
 		}
-		if (!strcasecmp(option, "mod3"))
+		if (dir > STROKE_UL || value == tok || e->path_len == STROKE_MAX)
 		{
-			config_add_mod(e, config_get_keycode(value));
-			return option;
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: invalid stroke %.*s, expected up to "
+					"%d of U, UR, R, DR, D, DL, L and UL", len, end - len, STROKE_MAX);
+			e->path_len = 0;
+			return;
 		}
-		if (!strcasecmp(option, "command"))
+		e->path[e->path_len++] = dir;
+	}
+}
+
+/* Make a binding a motion transform and return the transform. Options
+ * that are not given keep the motion as it is: full scale, no scrolling
+ * and no inverted axes. */
+static btnx_motion *config_motion(btnx_event *e)
+{
+	if (e->keycode != MOTION_TRANSFORM)
+	{
+		e->keycode = MOTION_TRANSFORM;
+		e->motion.scale = 100;
+		e->motion.scroll = 0;
+		e->motion.invert = 0;
+	}
+	return &e->motion;
+}
+
+/* Parse the axes to invert, e.g. "xy" */
+static int config_invert(const char *value, int len)
+{
+	int i, invert=0;
+	
+	for (i=0; i<len; i++)
+	{
+		if (value[i] == 'x' || value[i] == 'X')
+			invert |= MOTION_INVERT_X;
+		else if (value[i] == 'y' || value[i] == 'Y')
+			invert |= MOTION_INVERT_Y;
+		else
 		{
-			config_set_command(e, value);
-			return option;
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: invalid motion_invert %.*s, "
+					"expected x, y or xy", len, value);
+			return 0;
 		}
-		if (!strcasecmp(option, "uid"))
+	}
+	return invert;
+}
+
+/* Decide once what a binding does on a press and on a release, so that
+ * the event loop does not look at button types and keycodes again. Normal
+ * buttons follow the physical button. Immediate buttons send a full click
+ * on both the press and the release, release-only buttons on the press
+ * only. Wheel scrolls, commands and switches have no release part. A
+ * layer hold or a motion transform lasts until the button is released, a
+ * toggle acts on the press. With coalesce, wheel scrolls without modifiers are merged into
+ * one write by the engine. */
+static void config_compile_action(btnx_binding *b, const btnx_event *e, int coalesce)
+{
+	int extra = ACTION_NONE;
+	
+	/* Press and release events of non-normal buttons are both debounced */
+	b->debounce[1] = 1;
+	b->debounce[0] = (b->type != BUTTON_NORMAL);
+	
+	switch (e->keycode)
+	{
+	case WHEEL_MODE_SWITCH:
+		if (b->type == BUTTON_NORMAL)
 		{
-			e->uid = strtol(value, NULL, 10);
-			return option;
+			b->action[1] = ACTION_WHEEL_HOLD;
+			b->action[0] = ACTION_WHEEL_RESTORE;
 		}
-		if (!strcasecmp(option, "switch_type"))
+		else
 		{
-			config_set_switch_type(e, value);
-			return option;
+			b->action[1] = ACTION_WHEEL_TOGGLE;
+			b->action[0] = (b->type == BUTTON_IMMEDIATE) ? ACTION_WHEEL_TOGGLE : ACTION_NONE;
 		}
-		if (!strcasecmp(option, "switch_name"))
+		return;
+	case MOTION_TRANSFORM:
+		if (b->type == BUTTON_NORMAL)
 		{
-			config_set_switch_name(e, value);
-			return option;
+			b->action[1] = ACTION_MOTION_HOLD;
+			b->action[0] = ACTION_MOTION_RESTORE;
 		}
-		if (!strcasecmp(option, "force_release"))
+		else
 		{
-			if (strtol(value, NULL, 10) == 1)
-				e->type = BUTTON_RELEASE;
-			return option;
+			b->action[1] = ACTION_MOTION_TOGGLE;
+			b->action[0] = (b->type == BUTTON_IMMEDIATE) ? ACTION_MOTION_TOGGLE : ACTION_NONE;
 		}
-		if (!strcasecmp(option, "name"))
-			return option;
+		return;
+	case LAYER_HOLD:
+		b->action[1] = ACTION_LAYER_HOLD;
+		b->action[0] = ACTION_LAYER_RESTORE;
+		return;
+	case LAYER_TOGGLE:
+		b->action[1] = ACTION_LAYER_TOGGLE;
+		b->action[0] = ACTION_NONE;
+		return;
+	case COMMAND_EXECUTE:
+		extra = ACTION_COMMAND;
+		break;
+	case CONFIG_SWITCH:
+		extra = ACTION_CONFIG_SWITCH;
+		break;
+	case REL_WHEELFORWARD:
+	case REL_WHEELBACK:
+		extra = (coalesce && e->mod[0] == 0) ? ACTION_SCROLL : ACTION_TAP;
+		/* Without a delay, steps of a fast wheel within the same
+		 * millisecond all count */
+		if (b->delay == 0)
+			b->debounce[1] = b->debounce[0] = 0;
+		break;
+	}
+	
+	if (extra != ACTION_NONE)
+	{
+		b->action[1] = extra;
+		b->action[0] = (b->type == BUTTON_IMMEDIATE) ? extra : ACTION_NONE;
+	}
+	else if (b->type == BUTTON_NORMAL)
+	{
+		b->action[1] = ACTION_PRESS;
+		b->action[0] = ACTION_RELEASE;
 	}
+	else
+	{
+		b->action[1] = ACTION_TAP;
+		b->action[0] = (b->type == BUTTON_IMMEDIATE) ? ACTION_TAP : ACTION_NONE;
+	}
+}
+
+/* Set the value of a parsed option in the event structure or the mouse
+ * settings. Returns -1 if the option is not valid in the block. */
+static int config_add_value(struct config_entry_t *e, 
+							int type, 
+							const struct config_option_t *option, 
+							const char *value, int len)
+{
+	if (option->block != type)
+		return -1;
+	
+	switch (option->id)
+	{
+	/* Button values */
+	case OPT_RAWCODE:
+		e->hot->rawcode = config_number(value, len, 16);
+		break;
+	case OPT_ENABLED:
+		e->hot->enabled = config_number(value, len, 10) ? BINDING_ENABLED : 0;
+		break;
+	case OPT_TYPE:
+		e->hot->type = config_number(value, len, 10);
+		break;
+	case OPT_DELAY:
+		e->hot->delay = config_number(value, len, 10);
+		break;
+	case OPT_KEYCODE:
+		e->cold->keycode = config_get_keycode(value, len);
+		break;
+	case OPT_MOD:
+		config_add_mod(e->cold, config_get_keycode(value, len));
+		break;
+	case OPT_COMMAND:
+		config_set_command(e, value, len);
+		break;
+	case OPT_UID:
+		e->cold->uid = config_number(value, len, 10);
+		break;
+	case OPT_SWITCH_TYPE:
+		e->cold->keycode = CONFIG_SWITCH;
+		e->cold->switch_type = config_number(value, len, 10);
+		break;
+	case OPT_SWITCH_NAME:
+		if ((e->cold->switch_name = (char *) arena_alloc(e->arena, len + 1)) != NULL)
+			memcpy(e->cold->switch_name, value, len);
+		break;
+	case OPT_WHEEL_MODE:
+		/* Set the revoco wheel mode a button switches to at runtime. */
+		e->cold->keycode = WHEEL_MODE_SWITCH;
+		e->cold->wheel_mode = config_number(value, len, 10);
+		break;
+	case OPT_LAYER:
+		e->cold->layer = config_layer_number(value, len);
+		break;
+	case OPT_LAYER_HOLD:
+		e->cold->keycode = LAYER_HOLD;
+		e->cold->layer_target = config_layer_number(value, len);
+		break;
+	case OPT_LAYER_TOGGLE:
+		e->cold->keycode = LAYER_TOGGLE;
+		e->cold->layer_target = config_layer_number(value, len);
+		break;
+	case OPT_FORCE_RELEASE:
+		if (config_number(value, len, 10) == 1)
+			e->hot->type = BUTTON_RELEASE;
+		break;
+	case OPT_TRIGGER:
+		e->cold->trigger = config_trigger(value, len);
+		break;
+	case OPT_TRIGGER_TIME:
+		e->cold->trigger_time = config_number(value, len, 10);
+		break;
+	case OPT_STROKE:
+		config_set_stroke(e->cold, value, len);
+		break;
+	case OPT_MOTION_SCALE:
+		config_motion(e->cold)->scale = config_number(value, len, 10);
+		break;
+	case OPT_MOTION_SCROLL:
+		config_motion(e->cold)->scroll = config_number(value, len, 10);
+		break;
+	case OPT_MOTION_INVERT:
+		config_motion(e->cold)->invert = config_invert(value, len);
+		break;
 	/* Mouse values */
-	else if (type == BLOCK_MOUSE)
+	case OPT_VENDOR_ID:
+		device_set_vendor_id(config_number(value, len, 16));
+		break;
+	case OPT_PRODUCT_ID:
+		device_set_product_id(config_number(value, len, 16));
+		break;
+	case OPT_REVOCO_MODE:
+		revoco_set_mode(config_number(value, len, 10));
+		break;
+	case OPT_REVOCO_BTN:
+		revoco_set_btn(config_number(value, len, 10));
+		break;
+	case OPT_REVOCO_UP_SCROLL:
+		revoco_set_up_scroll(config_number(value, len, 10));
+		break;
+	case OPT_REVOCO_DOWN_SCROLL:
+		revoco_set_down_scroll(config_number(value, len, 10));
+		break;
+	case OPT_WHEEL_COALESCE:
+		e->wheel_coalesce = config_number(value, len, 10);
+		break;
+	case OPT_WHEEL_KEY_RATE:
+		e->wheel_key_rate = config_number(value, len, 10);
+		break;
+	case OPT_STROKE_STEP:
+		e->stroke_step = config_number(value, len, 10);
+		break;
+	case OPT_CHATTER_MAX:
+		e->chatter_max = config_number(value, len, 10);
+		break;
+	case OPT_CHATTER_UNBOUND:
+		e->chatter_unbound = config_number(value, len, 10);
+		break;
+	case OPT_IGNORED:
+		break;
+	default:
+		return -1;
+	}
+	
+	return 0;
+}
+
+
+/* Start a new binding, growing the temporary arrays geometrically. If
+ * they cannot grow, the parse is marked failed and the binding goes to
+ * the last slot, which the failed parse throws away. */
+static void config_new_binding(struct config_parse_t *p)
+{
+	btnx_binding *hot;
+	btnx_event *cold;
+	
+	if (p->count == p->size && !p->entry.failed)
 	{
-		if (!strcasecmp(option, "vendor_name"))
-			return option;
-		if (!strcasecmp(option, "product_name"))
-			return option;
-		if (!strcasecmp(option, "vendor_id"))
-		{
-			device_set_vendor_id(strtol(value, NULL, 16));
-			return option;
-		}
-		if (!strcasecmp(option, "product_id"))
-		{
-			device_set_product_id(strtol(value, NULL, 16));
-			return option;
-		}
-		if (!strcasecmp(option, "revoco_mode"))
+		if ((hot = (btnx_binding *) realloc(p->hot, 2 * p->size * sizeof(btnx_binding))) != NULL)
+			p->hot = hot;
+		if ((cold = (btnx_event *) realloc(p->cold, 2 * p->size * sizeof(btnx_event))) != NULL)
+			p->cold = cold;
+		if (hot == NULL || cold == NULL)
 		{
-			revoco_set_mode(strtol(value, NULL, 10));
-			return option;
+			daemon_log(LOG_WARNING, OUT_PRE "Error: could not allocate bindings: %s", strerror(errno));
+			p->entry.failed = 1;
 		}
-		if (!strcasecmp(option, "revoco_btn"))
+		else
+			p->size *= 2;
+	}
+	if (p->count < p->size)
+		p->count++;
+	memset(&p->hot[p->count-1], 0, sizeof(btnx_binding));
+	memset(&p->cold[p->count-1], 0, sizeof(btnx_event));
+	p->hot[p->count-1].enabled = BINDING_ENABLED;
+	p->cold[p->count-1].switch_type = CONFIG_SWITCH_NONE;
+	p->entry.hot = &p->hot[p->count-1];
+	p->entry.cold = &p->cold[p->count-1];
+}
+
+/* Parse one line of a configuration file. The line is not terminated and
+ * is not modified. */
+static void config_parse_line(struct config_parse_t *p, const char *beg, const char *end)
+{
+	const char *eq, *com, *val;
+	const struct config_option_t *option;
+	
+	while (beg < end && isspace(*beg)) beg++;
+	if (beg == end || *beg == '#')
+		return;
+	eq = memchr(beg, '=', end - beg);
+	com = memchr(beg, '#', end - beg);
+	
+	if (eq != NULL && (com == NULL || com > eq) && p->block_type != BLOCK_NONE)
+	{
+		/* A comment can follow the value, unless it starts the value */
+		if (com != NULL && com != eq + 1)
+			end = com;
+		val = eq + 1;
+		while (eq > beg && isspace(*(eq-1))) eq--;
+		while (val < end && isspace(*val)) val++;
+		while (end > val && isspace(*(end-1))) end--;
+		
+		option = config_find_option(beg, eq - beg);
+		if (option == NULL ||
+			config_add_value(&p->entry, p->block_type, option, val, end - val) < 0)
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: parse error: %.*s = %.*s",
+					(int) (eq - beg), beg, (int) (end - val), val);
+		return;
+	}
+	
+	/* Block keyword */
+	for (val = beg; val < end && !isspace(*val) && *val != '#'; val++);
+	if ((option = config_find_option(beg, val - beg)) == NULL)
+		return;
+	switch (option->id)
+	{
+	case OPT_BUTTON_BEGIN:
+	case OPT_MOUSE_BEGIN:
+		if (p->block_end == 0)
 		{
-			revoco_set_btn(strtol(value, NULL, 10));
-			return option;
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: config file parse error");
+			return;
 		}
-		if (!strcasecmp(option, "revoco_up_scroll"))
+		p->block_begin = 1;
+		if (option->id == OPT_BUTTON_BEGIN)
 		{
-			revoco_set_up_scroll(strtol(value, NULL, 10));
-			return option;
+			config_new_binding(p);
+			p->block_type = BLOCK_BUTTON;
 		}
-		if (!strcasecmp(option, "revoco_down_scroll"))
+		else
+			p->block_type = BLOCK_MOUSE;
+		break;
+	case OPT_BUTTON_END:
+	case OPT_MOUSE_END:
+		if (p->block_begin == 0)
 		{
-			revoco_set_down_scroll(strtol(value, NULL, 10));
-			return option;
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: config file parse error");
+			return;
 		}
+		p->block_end = 1;
+		p->block_type = BLOCK_NONE;
+		break;
 	}
-	
-	return NULL;
 }
 
-
-/* Parse a configuration file and return the btnx_event structures */
-btnx_event **config_parse(char **config_name)
+/* Parse a configuration file and return its bindings. The result lives in a
+ * single arena and is released with config_free(). The file is mapped and
+ * parsed in one pass without copying lines. */
+btnx_config *config_parse(char **config_name)
 {
-	FILE *fp;
 	char buffer[CONFIG_PARSE_BUFFER_SIZE];
-	char option[CONFIG_PARSE_OPTION_SIZE];
-	char value[CONFIG_PARSE_VALUE_SIZE];
-	char *loc_eq, *loc_com, *loc_beg, *loc_end;
-	int block_begin = 0, block_end = 1;
-	btnx_event **bevs;
-	int i=-1, block_type=BLOCK_NONE;
+	char *data;
+	const char *line, *eol, *end;
+	struct stat st;
+	struct config_parse_t p;
+	btnx_config *cfg;
+	int fd, i;
 	
 	if ((*config_name = config_get_names(*config_name)) == NULL)
-		sprintf(buffer,"%s/%s", CONFIG_PATH, CONFIG_NAME);
+		sprintf(buffer,"%s/%s", config_path, CONFIG_NAME);
 	else
-		sprintf(buffer,"%s/%s_%s", CONFIG_PATH, CONFIG_NAME, *config_name);
-	
-	/* When looping through configurations, stop when reaching the original
-	 * configuration. */
-	if (first_config[0] == '\0')
-		strcpy(first_config, *config_name);
-	else if (strcmp(first_config, *config_name) == 0) {
-		daemon_log(LOG_WARNING, OUT_PRE "Looped through all configurations. Stopping.");
-		return NULL;
-	}
+		sprintf(buffer,"%s/%s_%s", config_path, CONFIG_NAME, *config_name);
 	
 	daemon_log(LOG_WARNING, OUT_PRE "Opening config file: %s", buffer);
 	
-	if (!(fp = fopen(buffer,"r")))
+	if ((fd = open(buffer, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0)
 	{
 		daemon_log(LOG_WARNING, OUT_PRE "Could not read the config file: %s", strerror(errno));
+		if (fd >= 0)
+			close(fd);
 		return NULL;
 	}
-	
-	bevs = (btnx_event **) calloc(MAX_BEVS+1, sizeof(btnx_event*));
-	
-	while (fgets(buffer, CONFIG_PARSE_BUFFER_SIZE-1, fp) != NULL)
+	data = NULL;
+	if (st.st_size > 0)
 	{
-		if (buffer[0] != '#')
+		data = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
 		{
-			loc_eq = strchr(buffer, '=');
-			loc_com = strchr(buffer,'#');
-			loc_beg = buffer;
-			while (isspace(*loc_beg)) loc_beg++;
-			
-			if (loc_eq && (loc_com == NULL || loc_com > loc_eq) && block_type != BLOCK_NONE)
-			{
-				if (loc_com != NULL && loc_com != loc_eq + 1)
-					*loc_com = '\0';
-				
-				loc_beg = buffer;
-				while (isspace(*loc_beg)) loc_beg++;
-				loc_end = loc_eq;
-				while (isspace(*(loc_end-1))) loc_end--;
-				*loc_end = '\0';
-				strcpy(option, loc_beg);
-				
-				loc_beg = loc_eq;
-				while (isspace(*(loc_beg+1))) loc_beg++;
-				loc_beg++;
-				loc_end = loc_beg + strlen(loc_beg);
-				while (isspace(*(loc_end-1))) loc_end--;
-				*loc_end = '\0';		
-				strcpy(value, loc_beg);
-				
-				if (!config_add_value(bevs[i], block_type, option, value))
-					daemon_log(LOG_WARNING, OUT_PRE "Warning: parse error: %s = %s", option, value);
-				
-				memset(value, '\0', CONFIG_PARSE_VALUE_SIZE * sizeof(char));
-				memset(option, '\0', CONFIG_PARSE_OPTION_SIZE * sizeof(char));
-				memset(buffer, '\0', CONFIG_PARSE_BUFFER_SIZE * sizeof(char));
-			}
-			else if (*loc_beg == '\0')
-				continue;
-			else
-			{
-				loc_end = loc_beg;
-				
-				if (loc_com == NULL)
-					loc_com = &buffer[strlen(buffer)-1];
-				
-				while (!isspace(*loc_end) && loc_end < loc_com && *loc_end != '\0') loc_end++;
-				*loc_end = '\0';
-				
-				if (strcasecmp(loc_beg, CONFIG_BUTTON_BEGIN) == 0)
-				{
-					if (block_end == 0)
-					{
-						daemon_log(LOG_WARNING, OUT_PRE "Warning: config file parse error");
-						continue;
-					}
-					block_begin = 1;
-					i++;
-					if (i >= MAX_BEVS)
-						bevs = (btnx_event **) realloc(bevs, (i+2)*sizeof(bevs));
-					bevs[i] = (btnx_event *) calloc(1, sizeof(btnx_event));
-					bevs[i+1] = NULL;
-					bevs[i]->enabled = 1;
-					bevs[i]->delay = 0;
-					bevs[i]->last.tv_sec = 0;
-					bevs[i]->last.tv_usec = 0;
-					bevs[i]->switch_type = CONFIG_SWITCH_NONE;
-					bevs[i]->switch_name = NULL;
-					bevs[i]->command = NULL;
-					bevs[i]->args = NULL;
-					block_type = BLOCK_BUTTON;
-				}
-				else if (strcasecmp(loc_beg, CONFIG_BUTTON_END) == 0)
-				{
-					if (block_begin == 0)
-					{
-						daemon_log(LOG_WARNING, OUT_PRE "Warning: config file parse error");
-						continue;
-					}
-					block_end = 1;
-					block_type = BLOCK_NONE;
-				}
-				else if (strcasecmp(loc_beg, CONFIG_MOUSE_BEGIN) == 0)
-				{
-					if (block_end == 0)
-					{
-						daemon_log(LOG_WARNING, OUT_PRE "Warning: config file parse error");
-						continue;
-					}
-					block_begin = 1;
-					block_type = BLOCK_MOUSE;
-				}
-				else if (strcasecmp(loc_beg, CONFIG_MOUSE_END) == 0)
-				{
-					if (block_begin == 0)
-					{
-						daemon_log(LOG_WARNING, OUT_PRE "Warning: config file parse error");
-						continue;
-					}
-					block_end = 1;
-					block_type = BLOCK_NONE;
-				}
-			}
+			daemon_log(LOG_WARNING, OUT_PRE "Could not map the config file: %s", strerror(errno));
+			close(fd);
+			return NULL;
 		}
 	}
+	close(fd);
 	
-	fclose(fp);
+	memset(&p, 0, sizeof(p));
+	p.block_end = 1;
+	p.block_type = BLOCK_NONE;
+	p.size = MAX_BEVS;
+	p.entry.arena = arena_new();
+	p.entry.wheel_coalesce = -1;
+	p.entry.stroke_step = STROKE_STEP;
+	p.entry.chatter_max = CHATTER_MAX;
+	p.hot = (btnx_binding *) malloc(p.size * sizeof(btnx_binding));
+	p.cold = (btnx_event *) malloc(p.size * sizeof(btnx_event));
+	if (p.entry.arena == NULL || p.hot == NULL || p.cold == NULL)
+	{
+		daemon_log(LOG_WARNING, OUT_PRE "Error: could not allocate bindings: %s", strerror(errno));
+		p.entry.failed = 1;
+	}
+	else if (config_init_options() < 0)
+		p.entry.failed = 1;
 	
-	return bevs;
+	end = data + st.st_size;
+	for (line = data; line < end && !p.entry.failed; line = eol + 1)
+	{
+		if ((eol = memchr(line, '\n', end - line)) == NULL)
+			eol = end;
+		config_parse_line(&p, line, eol);
+	}
+	
+	if (data != NULL)
+		munmap(data, st.st_size);
+	if (p.entry.failed)
+		goto error;
+	
+	/* Move the bindings into exactly sized arrays next to their strings */
+	cfg = (btnx_config *) arena_alloc(p.entry.arena, sizeof(btnx_config));
+	if (cfg != NULL)
+	{
+		cfg->count = p.count;
+		cfg->arena = p.entry.arena;
+		cfg->hot = (btnx_binding *) arena_alloc(p.entry.arena, p.count * sizeof(btnx_binding));
+		cfg->cold = (btnx_event *) arena_alloc(p.entry.arena, p.count * sizeof(btnx_event));
+	}
+	if (cfg == NULL || cfg->hot == NULL || cfg->cold == NULL)
+	{
+		daemon_log(LOG_WARNING, OUT_PRE "Error: could not allocate bindings: %s", strerror(errno));
+		goto error;
+	}
+	memcpy(cfg->hot, p.hot, p.count * sizeof(btnx_binding));
+	memcpy(cfg->cold, p.cold, p.count * sizeof(btnx_event));
+	free(p.hot);
+	free(p.cold);
+	p.hot = NULL;
+	p.cold = NULL;
+	
+	cfg->wheel_coalesce = p.entry.wheel_coalesce;
+	cfg->wheel_key_rate = p.entry.wheel_key_rate;
+	cfg->stroke_step = (p.entry.stroke_step > 0) ? p.entry.stroke_step : STROKE_STEP;
+	cfg->chatter_max = (p.entry.chatter_max > 0) ? p.entry.chatter_max : 0;
+	cfg->chatter_unbound = (cfg->chatter_max > 0 && p.entry.chatter_unbound);
+	/* Unbound buttons only pass the chatter filter if they do not reach
+	 * the system directly */
+	cfg->grab = cfg->chatter_unbound;
+	for (i=0; i < cfg->count; i++)
+	{
+		/* Motion can only be transformed if it does not reach the system */
+		if (cfg->cold[i].keycode == MOTION_TRANSFORM && (cfg->hot[i].enabled & BINDING_ENABLED))
+			cfg->grab = 1;
+		config_compile_action(&cfg->hot[i], &cfg->cold[i], cfg->wheel_coalesce >= 0);
+		/* Keys and buttons bound to a spinning wheel are debounced down to
+		 * the rate cap */
+		if (cfg->wheel_key_rate > 0 && ((cfg->hot[i].rawcode >> 24) & 0xFF) == EV_REL &&
+		    cfg->cold[i].keycode > KEY_RESERVED && cfg->cold[i].keycode < BTNX_EXTRA_EVENTS &&
+		    cfg->hot[i].delay < 1000 / cfg->wheel_key_rate)
+			cfg->hot[i].delay = 1000 / cfg->wheel_key_rate;
+	}
+	if (layer_build(cfg) < 0)
+	{
+		daemon_log(LOG_WARNING, OUT_PRE "Error: could not allocate layers: %s", strerror(errno));
+		goto error;
+	}
+	
+	return cfg;
+
+error:
+	/* Everything allocated for the bindings lives in the arena */
+	free(p.hot);
+	free(p.cold);
+	arena_free(p.entry.arena);
+	return NULL;
+}
+
+/* Free the bindings returned by config_parse() */
+void config_free(btnx_config *cfg)
+{
+	if (cfg == NULL)
+		return;
+	arena_free(cfg->arena);
 }
@@ -12,7 +12,7 @@
 #define EVENTS_NAME				"events"
 //#define DEFAULTS_CONFIG_PATH	"/etc/btnx/defaults"
 //#define DEFAULT_CONFIG_NAME		"default_config_"
-#define CONFIG_MANAGER_FILE		CONFIG_PATH "/btnx_manager"
+#define CONFIG_MANAGER_NAME		"btnx_manager"
 
 #define CONFIG_PARSE_BUFFER_SIZE			512
 #define CONFIG_PARSE_OPTION_SIZE			64
@@ -21,12 +21,26 @@
 
 #define IS_ENCLOSING(c) ((c) == '\'' || (c) == '"' || (c) == '`')
 
+/* Mouse identification of a configuration, read without parsing the
+ * whole configuration file */
+struct config_id_t {
+	char name[CONFIG_NAME_MAX_SIZE];
+	int vendor;
+	int product;
+};
+
+/* Directory of the configuration files, CONFIG_PATH by default */
+void config_set_path(const char *path);
 
 /* Return configuration file names */
 const char *config_get_next(void);
 const char *config_get_prev(void);
 
+/* Read the mouse IDs of all configurations in the config manager file */
+int config_index(struct config_id_t **ids);
+
 /* Parse the configuration file */
-btnx_event **config_parse(char **config_name);
+btnx_config *config_parse(char **config_name);
+void config_free(btnx_config *cfg);
 
 #endif /*CONFIG_PARSER_H_*/
@@ -0,0 +1,435 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Unix domain control socket. Clients send one command per line and get
+ * the result back, terminated by a line with "OK" or "ERR <reason>".
+ * The socket is served from the main event loop; nothing here blocks. */
+
+#define _GNU_SOURCE				// Needed for accept4()
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "chatter.h"
+#include "config_parser.h"
+#include "control.h"
+#include "device.h"
+#include "layer.h"
+#include "stats.h"
+#include "log.h"
+
+/* Room for the longest formatted reply */
+#define CONTROL_FORMAT_SIZE	((CHATTER_FORMAT_SIZE > STATS_FORMAT_SIZE) ? \
+		CHATTER_FORMAT_SIZE : STATS_FORMAT_SIZE)
+
+/* A connected control client */
+struct control_client {
+	int fd;
+	int len;
+	char buffer[CONTROL_BUFFER_SIZE];
+};
+
+/* Static variables */
+static int listen_fd = NULL_FD;
+static struct control_client clients[CONTROL_MAX_CLIENTS];
+static btnx_config *ctl_cfg = NULL;
+static struct engine_t *ctl_engine = NULL;
+static struct device_fds_t *ctl_dev_fds = NULL;
+static char ctl_format[CONTROL_FORMAT_SIZE];	/* Statistics being replied */
+
+/* Static function declarations */
+static void control_client_close(struct control_client *client);
+static void control_accept(void);
+static void control_read(struct control_client *client);
+static void control_command(struct control_client *client, char *line);
+static void control_send(struct control_client *client, const char *buf, int len);
+static void control_reply(struct control_client *client, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+static int control_set_enabled(const char *arg, int suspended);
+static int control_config_listed(const char *name);
+static void control_list_devices(struct control_client *client);
+static void control_list_bindings(struct control_client *client);
+
+/* Create the listening socket */
+int control_init(struct engine_t *engine, struct device_fds_t *dev_fds) {
+	struct sockaddr_un addr;
+	int i;
+	
+	ctl_engine = engine;
+	ctl_cfg = engine->cfg;
+	ctl_dev_fds = dev_fds;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+		clients[i].fd = NULL_FD;
+	
+	if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: could not create control socket: %s",
+				strerror(errno));
+		return NULL_FD;
+	}
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+	unlink(CONTROL_SOCKET_PATH);
+	
+	if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+		chmod(CONTROL_SOCKET_PATH, S_IRUSR | S_IWUSR) < 0 ||
+		listen(listen_fd, CONTROL_MAX_CLIENTS) < 0) {
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: could not bind control socket %s: %s",
+				CONTROL_SOCKET_PATH, strerror(errno));
+		close(listen_fd);
+		listen_fd = NULL_FD;
+		return NULL_FD;
+	}
+	
+	return listen_fd;
+}
+
+/* Close the listening socket and all clients */
+void control_close(void) {
+	int i;
+	
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+		control_client_close(&clients[i]);
+	if (listen_fd != NULL_FD) {
+		close(listen_fd);
+		unlink(CONTROL_SOCKET_PATH);
+		listen_fd = NULL_FD;
+	}
+}
+
+/* Add the control fds to an fd_set and raise max_fd if necessary */
+void control_fill_fds(fd_set *fds, int *max_fd) {
+	int i;
+	
+	if (listen_fd == NULL_FD)
+		return;
+	FD_SET(listen_fd, fds);
+	if (listen_fd > *max_fd)
+		*max_fd = listen_fd;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (clients[i].fd == NULL_FD)
+			continue;
+		FD_SET(clients[i].fd, fds);
+		if (clients[i].fd > *max_fd)
+			*max_fd = clients[i].fd;
+	}
+}
+
+/* Returns 1 if any control fd is set in fds */
+int control_is_set(fd_set *fds) {
+	int i;
+	
+	if (listen_fd == NULL_FD)
+		return 0;
+	if (FD_ISSET(listen_fd, fds))
+		return 1;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (clients[i].fd != NULL_FD && FD_ISSET(clients[i].fd, fds))
+			return 1;
+	}
+	return 0;
+}
+
+/* Serve all control fds that are set in fds */
+void control_handle(fd_set *fds) {
+	int i;
+	
+	if (listen_fd == NULL_FD)
+		return;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (clients[i].fd != NULL_FD && FD_ISSET(clients[i].fd, fds))
+			control_read(&clients[i]);
+	}
+	if (FD_ISSET(listen_fd, fds))
+		control_accept();
+}
+
+static void control_client_close(struct control_client *client) {
+	if (client->fd == NULL_FD)
+		return;
+	close(client->fd);
+	client->fd = NULL_FD;
+	client->len = 0;
+}
+
+static void control_accept(void) {
+	int fd, i;
+	
+	if ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+		return;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (clients[i].fd == NULL_FD) {
+			clients[i].fd = fd;
+			clients[i].len = 0;
+			return;
+		}
+	}
+	/* No free client slots */
+	send(fd, "ERR busy\n", 9, MSG_DONTWAIT | MSG_NOSIGNAL);
+	close(fd);
+}
+
+/* Read from a client and execute every complete line */
+static void control_read(struct control_client *client) {
+	int ret;
+	char *line, *end;
+	
+	ret = read(client->fd, client->buffer + client->len, 
+	           CONTROL_BUFFER_SIZE - 1 - client->len);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (ret <= 0) {
+		control_client_close(client);
+		return;
+	}
+	client->len += ret;
+	client->buffer[client->len] = '\0';
+	
+	line = client->buffer;
+	while ((end = strchr(line, '\n')) != NULL) {
+		*end = '\0';
+		if (end > line && *(end-1) == '\r')
+			*(end-1) = '\0';
+		control_command(client, line);
+		if (client->fd == NULL_FD)
+			return;
+		line = end + 1;
+	}
+	
+	client->len -= line - client->buffer;
+	memmove(client->buffer, line, client->len);
+	if (client->len >= CONTROL_BUFFER_SIZE - 1) {
+		control_reply(client, "ERR command too long\n");
+		control_client_close(client);
+	}
+}
+
+/* Send reply data to a client. If the socket buffer is full the client is
+ * not reading. It is dropped, so that it never gets the terminator of a
+ * reply that was cut short. */
+static void control_send(struct control_client *client, const char *buf, int len) {
+	if (client->fd == NULL_FD || len <= 0)
+		return;
+	if (send(client->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len)
+		control_client_close(client);
+}
+
+/* Send a short reply to a client */
+static void control_reply(struct control_client *client, const char *fmt, ...) {
+	char buf[CONTROL_REPLY_SIZE];
+	va_list args;
+	int len;
+	
+	va_start(args, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (len >= (int) sizeof(buf))
+		len = sizeof(buf) - 1;
+	control_send(client, buf, len);
+}
+
+/* Suspend or resume a binding by rawcode, or all bindings. Returns the number
+ * of affected bindings, -1 if arg is neither "all" nor a hex number. */
+static int control_set_enabled(const char *arg, int suspended) {
+	int i, rawcode=0, count=0, all;
+	char *end;
+	
+	all = !strcasecmp(arg, "all");
+	if (!all) {
+		rawcode = strtol(arg, &end, 16);
+		if (end == arg || *end != '\0')
+			return -1;
+	}
+	for (i = 0; i < ctl_cfg->count; i++) {
+		if (all || ctl_cfg->hot[i].rawcode == rawcode) {
+			if (suspended)
+				ctl_cfg->hot[i].enabled |= BINDING_SUSPENDED;
+			else
+				ctl_cfg->hot[i].enabled &= ~BINDING_SUSPENDED;
+			count++;
+		}
+	}
+	return count;
+}
+
+/* Returns 1 if a configuration switch to name can only fail in the exec:
+ * name is listed in the config manager file and its file can be read.
+ * NULL, the default configuration, always is. */
+static int control_config_listed(const char *name) {
+	struct config_id_t *ids;
+	int i, count, found=0;
+	
+	if (name == NULL)
+		return 1;
+	count = config_index(&ids);
+	for (i = 0; i < count && !found; i++)
+		found = !strcmp(ids[i].name, name);
+	free(ids);
+	return found;
+}
+
+static void control_list_devices(struct control_client *client) {
+	int i;
+	unsigned short id[4];
+	char name[128];
+	
+	for (i = 0; i < ctl_dev_fds->count; i++) {
+		memset(id, 0, sizeof(id));
+		name[0] = '\0';
+		ioctl(ctl_dev_fds->fd[i], EVIOCGID, id);
+		if (ioctl(ctl_dev_fds->fd[i], EVIOCGNAME(sizeof(name)), name) < 0)
+			name[0] = '\0';
+		name[sizeof(name)-1] = '\0';
+		control_reply(client, "device %d vendor 0x%04x product 0x%04x name \"%s\"\n",
+				i, id[ID_VENDOR], id[ID_PRODUCT], name);
+	}
+}
+
+static void control_list_bindings(struct control_client *client) {
+	int i;
+	btnx_binding *binding;
+	btnx_event *bev;
+	
+	for (i = 0; i < ctl_cfg->count; i++) {
+		binding = &ctl_cfg->hot[i];
+		bev = &ctl_cfg->cold[i];
+		control_reply(client, "binding %d rawcode 0x%08x type %d keycode %d "
+				"mods %d,%d,%d delay %d layer %d enabled %d suspended %d\n",
+				i, binding->rawcode, binding->type, bev->keycode,
+				bev->mod[0], bev->mod[1], bev->mod[2], binding->delay, bev->layer,
+				(binding->enabled & BINDING_ENABLED) != 0,
+				(binding->enabled & BINDING_SUSPENDED) != 0);
+	}
+}
+
+/* Execute a single command line */
+static void control_command(struct control_client *client, char *line) {
+	char *cmd, *arg, *save=NULL;
+	const char *name;
+	int layer;
+	
+	cmd = strtok_r(line, " \t", &save);
+	arg = strtok_r(NULL, " \t", &save);
+	if (cmd == NULL)
+		return;
+	
+	if (!strcasecmp(cmd, "help")) {
+		control_reply(client,
+				"help\t\tThis text\n"
+				"config\t\tPrint the current configuration name\n"
+				"switch NAME\tSwitch to configuration NAME\n"
+				"next\t\tSwitch to the next configuration\n"
+				"prev\t\tSwitch to the previous configuration\n"
+				"reload\t\tReload the current configuration\n"
+				"devices\t\tList the event handlers in use\n"
+				"bindings\tList the configured bindings\n"
+				"layer [N]\tPrint the active layer or make layer N the toggled layer\n"
+				"stats\t\tPrint counters and latency statistics\n"
+				"resetstats\tClear counters and latency statistics\n"
+				"chatter\t\tPrint the press and release times the chatter filter learns from\n"
+				"disable RAWCODE|all\tSuspend bindings until enabled or reloaded\n"
+				"enable RAWCODE|all\tResume suspended bindings\n"
+				"OK\n");
+	}
+	else if (!strcasecmp(cmd, "config")) {
+		name = btnx_config_name();
+		control_reply(client, "config %s\nOK\n", name ? name : CONFIG_NAME);
+	}
+	else if (!strcasecmp(cmd, "switch") || !strcasecmp(cmd, "next") ||
+	         !strcasecmp(cmd, "prev") || !strcasecmp(cmd, "reload")) {
+		if (!strcasecmp(cmd, "switch"))
+			name = arg;
+		else if (!strcasecmp(cmd, "next"))
+			name = config_get_next();
+		else if (!strcasecmp(cmd, "prev"))
+			name = config_get_prev();
+		else
+			name = btnx_config_name();
+		
+		if (name == NULL && strcasecmp(cmd, "reload")) {
+			control_reply(client, "ERR no such configuration\n");
+			return;
+		}
+		if (name != NULL && strlen(name) >= CONFIG_NAME_MAX_SIZE) {
+			control_reply(client, "ERR invalid configuration name\n");
+			return;
+		}
+		if (!control_config_listed(name)) {
+			control_reply(client, "ERR no such configuration\n");
+			return;
+		}
+		/* The daemon re-executes itself. Reply first, the connection is
+		 * closed by the exec. btnx_config_switch() logs an exec that
+		 * fails, the client already has its terminator. */
+		control_reply(client, "OK\n");
+		btnx_config_switch(name);
+	}
+	else if (!strcasecmp(cmd, "devices")) {
+		control_list_devices(client);
+		control_reply(client, "OK\n");
+	}
+	else if (!strcasecmp(cmd, "bindings")) {
+		control_list_bindings(client);
+		control_reply(client, "OK\n");
+	}
+	else if (!strcasecmp(cmd, "layer")) {
+		if (arg != NULL) {
+			layer = strtol(arg, NULL, 10);
+			if (layer < 0 || layer >= ctl_cfg->layers) {
+				control_reply(client, "ERR no such layer\n");
+				return;
+			}
+			ctl_cfg->locked = layer;
+			layer_restore(ctl_cfg);
+		}
+		control_reply(client, "layer %d of %d\nOK\n", ctl_cfg->active_layer, ctl_cfg->layers);
+	}
+	else if (!strcasecmp(cmd, "stats")) {
+		control_send(client, ctl_format, stats_format(ctl_engine->stats, &ctl_engine->chatter,
+				ctl_format, sizeof(ctl_format)));
+		control_reply(client, "OK\n");
+	}
+	else if (!strcasecmp(cmd, "resetstats")) {
+		stats_reset(ctl_engine->stats);
+		control_reply(client, "OK\n");
+	}
+	else if (!strcasecmp(cmd, "chatter")) {
+		control_send(client, ctl_format, chatter_format(&ctl_engine->chatter,
+				ctl_format, sizeof(ctl_format), 1));
+		control_reply(client, "OK\n");
+	}
+	else if (!strcasecmp(cmd, "disable") || !strcasecmp(cmd, "enable")) {
+		if (arg == NULL) {
+			control_reply(client, "ERR missing rawcode\n");
+			return;
+		}
+		switch (control_set_enabled(arg, !strcasecmp(cmd, "disable"))) {
+		case -1:
+			control_reply(client, "ERR invalid rawcode\n");
+			break;
+		case 0:
+			control_reply(client, "ERR no such binding\n");
+			break;
+		default:
+			control_reply(client, "OK\n");
+		}
+	}
+	else
+		control_reply(client, "ERR unknown command: %s\n", cmd);
+}
@@ -0,0 +1,25 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef CONTROL_H_
+#define CONTROL_H_
+
+#include <sys/select.h>
+#include "btnx.h"
+#include "device.h"
+#include "engine.h"
+
+#define CONTROL_SOCKET_PATH		"/var/run/btnx.sock"
+#define CONTROL_MAX_CLIENTS		4
+#define CONTROL_BUFFER_SIZE		256
+#define CONTROL_REPLY_SIZE		2048
+
+int control_init(struct engine_t *engine, struct device_fds_t *dev_fds);
+void control_close(void);
+void control_fill_fds(fd_set *fds, int *max_fd);
+int control_is_set(fd_set *fds);
+void control_handle(fd_set *fds);
+
+#endif /*CONTROL_H_*/
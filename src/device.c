@@ -11,6 +11,7 @@
 
 #include "btnx.h"
 #include "device.h"
+#include "evdev.h"
 
 /* Static variables */
 static int product_id=0;
@@ -37,7 +38,10 @@ void device_set_product_id(int id) {
 void device_fds_init(struct device_fds_t *dev_fds) {
 	dev_fds->count = 0;
 	dev_fds->fd = NULL;
+	dev_fds->evdev = NULL;
 	dev_fds->max_fd = NULL_FD;
+	dev_fds->motion = 0;
+	dev_fds->grab = 0;
 }
 
 /* Set the maximum file descriptor in a struct device_fds_t */
@@ -71,17 +75,57 @@ int device_fds_find_set_fd(struct device_fds_t *dev_fds, fd_set *fds) {
 	return NULL_FD;
 }
 
+/* Return the reader of a file descriptor */
+struct evdev_t *device_fds_evdev(struct device_fds_t *dev_fds, int fd) {
+	int i;
+	
+	for (i = 0; i < dev_fds->count; i++) {
+		if (dev_fds->fd[i] == fd)
+			return dev_fds->evdev[i];
+	}
+	return NULL;
+}
+
 /* Add a file descriptor to a device_fds_t */
 void device_fds_add_fd(struct device_fds_t *dev_fds, int fd) {
-	if (dev_fds->count == 0)
+	if (dev_fds->count == 0) {
 		dev_fds->fd = malloc(sizeof(fd));
-	else
+		dev_fds->evdev = malloc(sizeof(struct evdev_t *));
+	}
+	else {
 		dev_fds->fd = realloc(dev_fds->fd, sizeof(fd) * (dev_fds->count + 1));
+		dev_fds->evdev = realloc(dev_fds->evdev,
+				sizeof(struct evdev_t *) * (dev_fds->count + 1));
+	}
 	
 	dev_fds->fd[dev_fds->count] = fd;
+	dev_fds->evdev[dev_fds->count] = evdev_new(fd);
+	if (dev_fds->evdev[dev_fds->count] != NULL) {
+		if (dev_fds->grab)
+			evdev_grab(dev_fds->evdev[dev_fds->count]);
+		if (dev_fds->motion)
+			evdev_motion(dev_fds->evdev[dev_fds->count], 1);
+	}
 	dev_fds->count++;
 }
 
+/* Close and remove a file descriptor from a device_fds_t */
+void device_fds_remove_fd(struct device_fds_t *dev_fds, int fd) {
+	int i;
+	
+	for (i = 0; i < dev_fds->count; i++) {
+		if (dev_fds->fd[i] != fd)
+			continue;
+		close(fd);
+		evdev_free(dev_fds->evdev[i]);
+		dev_fds->fd[i] = dev_fds->fd[dev_fds->count - 1];
+		dev_fds->evdev[i] = dev_fds->evdev[dev_fds->count - 1];
+		dev_fds->count--;
+		break;
+	}
+	device_fds_set_max_fd(dev_fds);
+}
+
 /* Close all file descriptors of a device_fds_t */
 void device_fds_close(struct device_fds_t *dev_fds) {
 	int i;
@@ -90,7 +134,20 @@ void device_fds_close(struct device_fds_t *dev_fds) {
 		return;
 	for (i = 0; i < dev_fds->count; i++) {
 		close(dev_fds->fd[i]);
+		evdev_free(dev_fds->evdev[i]);
 	}
 	free(dev_fds->fd);
+	free(dev_fds->evdev);
 	device_fds_init(dev_fds);
 }
+
+/* Turn motion delivery of all readers on or off */
+void device_fds_motion(struct device_fds_t *dev_fds, int enable) {
+	int i;
+	
+	dev_fds->motion = enable;
+	for (i = 0; i < dev_fds->count; i++) {
+		if (dev_fds->evdev[i] != NULL)
+			evdev_motion(dev_fds->evdev[i], enable);
+	}
+}
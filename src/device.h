@@ -7,11 +7,23 @@
 #ifndef DEVICE_H_
 #define DEVICE_H_
 
+struct evdev_t;
+
 /* Contains all device fds to listen to */
 struct device_fds_t {
 	int count;
 	int *fd;
+	struct evdev_t **evdev;	/* Reader of each fd */
 	int max_fd;
+	int motion;				/* The readers deliver motion */
+	int grab;				/* Grab the readers that move the pointer */
+};
+
+/* An opened event handler and its IDs */
+struct device_handler_t {
+	int fd;
+	int vendor;
+	int product;
 };
 
 int device_get_vendor_id(void);
@@ -23,7 +35,10 @@ void device_fds_init(struct device_fds_t *dev_fds);
 void device_fds_set_max_fd(struct device_fds_t *dev_fds);
 void device_fds_fill_fds(struct device_fds_t *dev_fds, fd_set *fds);
 int device_fds_find_set_fd(struct device_fds_t *dev_fds, fd_set *fds);
+struct evdev_t *device_fds_evdev(struct device_fds_t *dev_fds, int fd);
 void device_fds_add_fd(struct device_fds_t *dev_fds, int fd);
+void device_fds_remove_fd(struct device_fds_t *dev_fds, int fd);
 void device_fds_close(struct device_fds_t *dev_fds);
+void device_fds_motion(struct device_fds_t *dev_fds, int enable);
 
 #endif /*DEVICE_H_*/
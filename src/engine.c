@@ -0,0 +1,706 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* The core of btnx: matches decoded input events to the bindings of the
+ * active layer, debounces them and runs their compiled actions. It does
+ * no I/O. Output goes to a sink and time comes from a clock, both given
+ * by the caller, so the engine runs just as well without devices, e.g.
+ * under a benchmark or a replay of recorded events. */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "btnx.h"
+#include "engine.h"
+#include "frame.h"
+#include "layer.h"
+#include "stats.h"
+#include "chatter.h"
+#include "probes.h"
+
+/* States of a gesture */
+enum
+{
+	GESTURE_IDLE=0,
+	GESTURE_DOWN,		/* Pressed, a hold if it lasts until due */
+	GESTURE_HELD,		/* The hold binding is pressed */
+	GESTURE_UP,			/* Tapped, a double tap if pressed again before due */
+	GESTURE_SECOND		/* The double tap binding is pressed */
+};
+
+static void engine_clock_default(struct timeval *now);
+static int engine_binding(struct engine_t *engine, int rawcode, int pressed);
+static int engine_check_delay(const btnx_binding *binding, const struct timeval *now);
+static void engine_scroll(struct engine_t *engine, int value);
+static void engine_flush(struct engine_t *engine);
+static void engine_transform(struct engine_t *engine, const btnx_motion *motion);
+static void engine_move(struct engine_t *engine, int code, int value);
+static void engine_pass(struct engine_t *engine, const hexdump_t *ev);
+static void engine_send(struct engine_t *engine);
+static void engine_end(struct engine_t *engine);
+static void engine_run(struct engine_t *engine, int action, int index, const hexdump_t *ev);
+static void engine_trigger(struct engine_t *engine, int index, int pressed, const hexdump_t *ev);
+static void engine_due(btnx_gesture *g, const struct timeval *from, int ms);
+static void engine_expire(struct engine_t *engine, btnx_gesture *g);
+static void engine_gesture(struct engine_t *engine, btnx_gesture *g, const hexdump_t *ev);
+static int engine_next(struct engine_t *engine, struct timeval *due);
+static void engine_button(struct engine_t *engine, int index, const hexdump_t *ev);
+static int engine_direction(int x, int y);
+static void engine_step(btnx_stroke *s, int min);
+static void engine_motion(struct engine_t *engine, int code, int value);
+static void engine_stroke(struct engine_t *engine, btnx_stroke *s, const hexdump_t *ev);
+static int engine_chatter(struct engine_t *engine, const hexdump_t *ev, int grabbed);
+static void engine_event(struct engine_t *engine, const hexdump_t *ev, int grabbed);
+
+static void engine_clock_default(struct timeval *now)
+{
+	gettimeofday(now, NULL);
+}
+
+/* Set up an engine for a parsed configuration. A NULL clock uses
+ * gettimeofday(). The engine adds to the counters in stats, and keeps no
+ * other state outside of engine and cfg. */
+void engine_init(struct engine_t *engine, btnx_config *cfg,
+                 const struct engine_sink_t *sink, engine_clock_t clock,
+                 struct btnx_stats *stats)
+{
+	memset(engine, 0, sizeof(*engine));
+	engine->cfg = cfg;
+	if (sink != NULL)
+		engine->sink = *sink;
+	engine->clock = (clock != NULL) ? clock : engine_clock_default;
+	engine->stats = stats;
+	frame_compile(cfg);
+	chatter_init(&engine->chatter, cfg->chatter_max);
+}
+
+/* Find the binding of the active layer that is associated with a captured
+ * rawcode and return its index. A suspended binding takes no new presses,
+ * but still gets the release of a press it handled, so that nothing it
+ * sent stays down. */
+static int engine_binding(struct engine_t *engine, int rawcode, int pressed)
+{
+	btnx_config *cfg = engine->cfg;
+	int key, i, handled;
+	
+	if ((key = layer_key(cfg, rawcode)) < 0)
+		return -1; /* no such rawcode in configuration */
+	handled = cfg->held[key] >= 0;
+	if ((i = layer_binding(cfg, key, pressed)) < 0)
+		return -1; /* not bound in the active layer */
+	if (cfg->hot[i].enabled == BINDING_ENABLED)
+		return i; /* rawcode found and event is enabled */
+	if (!pressed && handled && cfg->hot[i].enabled == (BINDING_ENABLED | BINDING_SUSPENDED))
+		return i; /* handled the press before it was suspended */
+	if (pressed)
+		cfg->held[key] = -1; /* the press is not handled, nor is its release */
+	if (cfg->hot[i].enabled & BINDING_SUSPENDED)
+		engine->stats->events_suspended++; /* disabled through the control socket */
+	return -1; /* associated rawcode found, but event is disabled */
+}
+
+/* This function checks if there has been sufficient delay between two
+ * occurrances of the same event. Delay is in milliseconds, defined in the
+ * configuration file. 
+ * Returns 0 if delay is satisfied, -1 if there has not been enough delay. */
+static int engine_check_delay(const btnx_binding *binding, const struct timeval *now)
+{
+	if (binding->last.tv_sec == 0 && binding->last.tv_usec == 0)
+		return 0;
+	
+	/* Perform a millisecond conversion and compare */
+	if (((int)(((unsigned int)now->tv_sec - (unsigned int)binding->last.tv_sec) * 1000) +
+		(int)(((int)now->tv_usec - (int)binding->last.tv_usec) / 1000))
+		> (int)binding->delay)
+		return 0;
+	return -1;
+}
+
+/* Add a wheel step to the coalesced scroll. The first step of a burst
+ * opens the merge window. */
+static void engine_scroll(struct engine_t *engine, int value)
+{
+	int window = engine->cfg->wheel_coalesce;
+	
+	if (engine->scroll_steps == 0 && window > 0)
+	{
+		engine->clock(&engine->scroll_due);
+		engine->scroll_due.tv_sec += window / 1000;
+		engine->scroll_due.tv_usec += (window % 1000) * 1000;
+		if (engine->scroll_due.tv_usec >= 1000000)
+		{
+			engine->scroll_due.tv_sec++;
+			engine->scroll_due.tv_usec -= 1000000;
+		}
+	}
+	engine->scroll += value;
+	engine->scroll_steps++;
+}
+
+/* Send the coalesced scroll as one REL_WHEEL event, after the motion
+ * passed on before it. Called before any other output, so that the order
+ * of the events is kept. */
+static void engine_flush(struct engine_t *engine)
+{
+	const struct engine_sink_t *sink = &engine->sink;
+	
+	engine_send(engine);
+	if (engine->scroll_steps == 0)
+		return;
+	engine->stats->wheel_coalesced += engine->scroll_steps - (engine->scroll != 0);
+	if (engine->scroll != 0 && sink->frame != NULL)
+	{
+		frame_scroll(&engine->scroll_frame, engine->scroll);
+		sink->frame(sink->data, &engine->scroll_frame);
+	}
+	engine->scroll = 0;
+	engine->scroll_steps = 0;
+}
+
+/* Switch the motion transform. Fractions left by the previous one are
+ * dropped. */
+static void engine_transform(struct engine_t *engine, const btnx_motion *motion)
+{
+	engine->motion = motion;
+	engine->carry_x = engine->carry_y = 0;
+	engine->drag_x = engine->drag_y = 0;
+}
+
+/* Pass on pointer motion of a grabbed handler through the active
+ * transform. Scaling carries the fractions of a count over to the next
+ * event, so that slow motion is not lost; scrolling does the same with
+ * the motion short of a wheel step. */
+static void engine_move(struct engine_t *engine, int code, int value)
+{
+	const btnx_motion *m = engine->motion;
+	int *carry, *drag, steps, x = (code == REL_X);
+	
+	if (m != NULL)
+	{
+		if (m->invert & (x ? MOTION_INVERT_X : MOTION_INVERT_Y))
+			value = -value;
+		carry = x ? &engine->carry_x : &engine->carry_y;
+		*carry += value * m->scale;
+		value = *carry / 100;
+		*carry -= value * 100;
+		if (m->scroll > 0)
+		{
+			drag = x ? &engine->drag_x : &engine->drag_y;
+			*drag += value;
+			if ((steps = *drag / m->scroll) == 0)
+				return;
+			*drag -= steps * m->scroll;
+			/* Dragging up scrolls up, like the wheel turned forward */
+			if (x)
+				engine->hwheel += steps;
+			else
+				engine->wheel -= steps;
+			return;
+		}
+	}
+	if (x)
+		engine->move_x += value;
+	else
+		engine->move_y += value;
+}
+
+/* Pass on an event of a grabbed handler that no binding takes. Buttons and
+ * keys go out at once through the mouse device, behind the motion before
+ * them. Wheel steps are summed up
+ * with the motion. Other events are dropped. */
+static void engine_pass(struct engine_t *engine, const hexdump_t *ev)
+{
+	const struct engine_sink_t *sink = &engine->sink;
+	int type = (ev->rawcode >> 24) & 0xFF, code = ev->rawcode & 0xFFFF;
+	
+	if (type == EV_REL && code == REL_WHEEL)
+		engine->wheel += ev->pressed;
+	else if (type == EV_REL && code == REL_HWHEEL)
+		engine->hwheel += ev->pressed;
+	else if (type == EV_KEY)
+	{
+		engine_flush(engine);
+		if (sink->frame != NULL)
+		{
+			frame_button(&engine->pass_frame, code, ev->pressed);
+			sink->frame(sink->data, &engine->pass_frame);
+		}
+	}
+	else
+		return;
+	engine->stats->events_passed++;
+}
+
+/* Send the motion and wheel steps passed on since the last write */
+static void engine_send(struct engine_t *engine)
+{
+	const struct engine_sink_t *sink = &engine->sink;
+	
+	if ((engine->move_x | engine->move_y | engine->wheel | engine->hwheel) == 0)
+		return;
+	if (sink->frame != NULL &&
+	    frame_motion(&engine->pass_frame, engine->move_x, engine->move_y,
+	                 engine->wheel, engine->hwheel) > 0)
+	{
+		sink->frame(sink->data, &engine->pass_frame);
+		engine->stats->motion_frames++;
+	}
+	engine->move_x = engine->move_y = 0;
+	engine->wheel = engine->hwheel = 0;
+}
+
+/* Run an action compiled by the configuration parser */
+static void engine_run(struct engine_t *engine, int action, int index, const hexdump_t *ev)
+{
+	const struct engine_sink_t *sink = &engine->sink;
+	btnx_config *cfg = engine->cfg;
+	btnx_event *bev = &cfg->cold[index];
+	
+	switch (action)
+	{
+	case ACTION_PRESS:
+	case ACTION_RELEASE:
+	case ACTION_TAP:
+		BTNX_PROBE(frame_submit, ev->rawcode, index, &ev->time);
+		engine_flush(engine);
+		if (sink->frame == NULL)
+			break;
+		if (action != ACTION_RELEASE)
+			sink->frame(sink->data, &bev->frame[1]);
+		if (action != ACTION_PRESS)
+			sink->frame(sink->data, &bev->frame[0]);
+		break;
+	case ACTION_COMMAND:
+		BTNX_PROBE(command_spawn, ev->rawcode, index, &ev->time);
+		if (sink->command != NULL)
+			sink->command(sink->data, bev);
+		break;
+	case ACTION_CONFIG_SWITCH:
+		BTNX_PROBE(config_switch, ev->rawcode, index, &ev->time);
+		engine_flush(engine);
+		if (sink->config_switch != NULL)
+			sink->config_switch(sink->data, bev);
+		break;
+	case ACTION_WHEEL_HOLD:
+	case ACTION_WHEEL_RESTORE:
+	case ACTION_WHEEL_TOGGLE:
+		if (sink->wheel != NULL)
+			sink->wheel(sink->data, action, bev->wheel_mode);
+		return;
+	case ACTION_LAYER_HOLD:
+		layer_hold(cfg, bev->layer_target);
+		return;
+	case ACTION_LAYER_RESTORE:
+		layer_restore(cfg);
+		return;
+	case ACTION_LAYER_TOGGLE:
+		layer_toggle(cfg, bev->layer_target);
+		return;
+	case ACTION_MOTION_HOLD:
+		engine_transform(engine, &bev->motion);
+		return;
+	case ACTION_MOTION_RESTORE:
+		engine_transform(engine, NULL);
+		return;
+	case ACTION_MOTION_TOGGLE:
+		engine_transform(engine, (engine->motion == &bev->motion) ? NULL : &bev->motion);
+		return;
+	case ACTION_SCROLL:
+		BTNX_PROBE(frame_submit, ev->rawcode, index, &ev->time);
+		engine_scroll(engine, bev->keycode == REL_WHEELFORWARD ? 1 : -1);
+		break;
+	default:
+		return;
+	}
+	engine->stats->events_sent++;
+}
+
+/* Run the press or release action of a binding chosen by a gesture */
+static void engine_trigger(struct engine_t *engine, int index, int pressed, const hexdump_t *ev)
+{
+	btnx_binding *binding;
+	
+	if (index < 0)
+		return;
+	binding = &engine->cfg->hot[index];
+	if (binding->enabled == BINDING_ENABLED && binding->action[pressed] != ACTION_NONE)
+		engine_run(engine, binding->action[pressed], index, ev);
+}
+
+/* Set the time a gesture state times out, ms after from */
+static void engine_due(btnx_gesture *g, const struct timeval *from, int ms)
+{
+	g->due.tv_sec = from->tv_sec + ms / 1000;
+	g->due.tv_usec = from->tv_usec + (ms % 1000) * 1000;
+	if (g->due.tv_usec >= 1000000)
+	{
+		g->due.tv_sec++;
+		g->due.tv_usec -= 1000000;
+	}
+}
+
+/* The state of a gesture has timed out: a press became a hold, or a tap
+ * was not followed by a second one */
+static void engine_expire(struct engine_t *engine, btnx_gesture *g)
+{
+	timerclear(&g->due);
+	if (g->state == GESTURE_DOWN)
+	{
+		engine_trigger(engine, g->hold, 1, &g->ev);
+		g->state = GESTURE_HELD;
+	}
+	else if (g->state == GESTURE_UP)
+	{
+		engine_trigger(engine, g->tap, 1, &g->ev);
+		engine_trigger(engine, g->tap, 0, &g->ev);
+		g->state = GESTURE_IDLE;
+	}
+}
+
+/* Tell a tap, a hold and a double tap apart. The kernel timestamps of the
+ * events decide, so a timeout that the event loop has not run yet still
+ * comes first. A button without a double tap binding runs its tap on the
+ * release, without waiting. */
+static void engine_gesture(struct engine_t *engine, btnx_gesture *g, const hexdump_t *ev)
+{
+	if (timerisset(&g->due) && !timercmp(&ev->time, &g->due, <))
+		engine_expire(engine, g);
+	
+	switch (g->state)
+	{
+	case GESTURE_IDLE:
+		if (!ev->pressed)
+			break;
+		g->ev = *ev;
+		g->state = GESTURE_DOWN;
+		if (g->hold >= 0)
+			engine_due(g, &ev->time, g->hold_time);
+		break;
+	case GESTURE_DOWN:
+		if (ev->pressed)
+			break;
+		timerclear(&g->due);
+		if (g->dbl >= 0)
+		{
+			g->state = GESTURE_UP;
+			engine_due(g, &ev->time, g->dbl_time);
+			break;
+		}
+		engine_trigger(engine, g->tap, 1, &g->ev);
+		engine_trigger(engine, g->tap, 0, ev);
+		g->state = GESTURE_IDLE;
+		break;
+	case GESTURE_HELD:
+		if (ev->pressed)
+			break;
+		engine_trigger(engine, g->hold, 0, ev);
+		g->state = GESTURE_IDLE;
+		break;
+	case GESTURE_UP:
+		if (!ev->pressed)
+			break;
+		timerclear(&g->due);
+		engine_trigger(engine, g->dbl, 1, ev);
+		g->state = GESTURE_SECOND;
+		break;
+	case GESTURE_SECOND:
+		if (ev->pressed)
+			break;
+		engine_trigger(engine, g->dbl, 0, ev);
+		g->state = GESTURE_IDLE;
+		break;
+	}
+}
+
+/* Run a button press or release on its binding, as if it had no strokes */
+static void engine_button(struct engine_t *engine, int index, const hexdump_t *ev)
+{
+	btnx_binding *binding;
+	int pressed = (ev->pressed != 0);
+	
+	if (index < 0)
+		return;
+	binding = &engine->cfg->hot[index];
+	if (binding->gesture >= 0)
+		engine_gesture(engine, &engine->cfg->gesture[binding->gesture], ev);
+	else if (binding->action[pressed] != ACTION_NONE)
+		engine_run(engine, binding->action[pressed], index, ev);
+}
+
+/* Quantize a motion to one of eight directions. The sectors are 45
+ * degrees wide; tan(22.5) is close to 106/256. */
+static int engine_direction(int x, int y)
+{
+	int ax = (x < 0) ? -x : x, ay = (y < 0) ? -y : y;
+	
+	if (ay * 256 < ax * 106)
+		return (x > 0) ? STROKE_R : STROKE_L;
+	if (ax * 256 < ay * 106)
+		return (y > 0) ? STROKE_D : STROKE_U;
+	if (y < 0)
+		return (x > 0) ? STROKE_UR : STROKE_UL;
+	return (x > 0) ? STROKE_DR : STROKE_DL;
+}
+
+/* Add a direction to a stroke once its motion reaches min along an axis.
+ * Further motion in the same direction does not repeat it. */
+static void engine_step(btnx_stroke *s, int min)
+{
+	int dir;
+	
+	if (s->x < min && s->x > -min && s->y < min && s->y > -min)
+		return;
+	dir = engine_direction(s->x, s->y);
+	s->x = s->y = 0;
+	if (s->len > 0 && s->len <= STROKE_MAX && s->dir[s->len-1] == dir)
+		return;
+	if (s->len < STROKE_MAX)
+		s->dir[s->len] = dir;
+	if (s->len <= STROKE_MAX)
+		s->len++;
+}
+
+/* Add relative motion to the strokes being drawn */
+static void engine_motion(struct engine_t *engine, int code, int value)
+{
+	btnx_config *cfg = engine->cfg;
+	btnx_stroke *s;
+	int i;
+	
+	for (i=0; i < cfg->strokes; i++)
+	{
+		s = &cfg->stroke[i];
+		if (!s->active)
+			continue;
+		if (code == REL_X)
+			s->x += value;
+		else
+			s->y += value;
+		engine_step(s, cfg->stroke_step);
+	}
+}
+
+/* Track a stroke while its button is held and run the stroke binding it
+ * matches on the release. A click without motion is run on the button's
+ * own binding. Motion is only asked for while a stroke button is held. */
+static void engine_stroke(struct engine_t *engine, btnx_stroke *s, const hexdump_t *ev)
+{
+	const struct engine_sink_t *sink = &engine->sink;
+	btnx_config *cfg = engine->cfg;
+	int i;
+	
+	if (ev->pressed)
+	{
+		if (s->active)
+			return;
+		s->active = 1;
+		s->ev = *ev;
+		s->x = s->y = s->len = 0;
+		if (engine->strokes_held++ == 0 && sink->motion != NULL)
+			sink->motion(sink->data, 1);
+		return;
+	}
+	if (!s->active)
+		return;
+	s->active = 0;
+	if (--engine->strokes_held == 0 && sink->motion != NULL)
+		sink->motion(sink->data, 0);
+	
+	/* The rest of the motion counts if it is half a step */
+	engine_step(s, (cfg->stroke_step + 1) / 2);
+	if (s->len == 0)
+	{
+		engine_button(engine, s->tap, &s->ev);
+		engine_button(engine, s->tap, ev);
+		return;
+	}
+	for (i = s->first; i >= 0; i = cfg->cold[i].path_next)
+	{
+		if (cfg->cold[i].path_len == s->len && cfg->hot[i].enabled == BINDING_ENABLED &&
+		    !memcmp(cfg->cold[i].path, s->dir, s->len))
+		{
+			engine->stats->strokes++;
+			engine_trigger(engine, i, 1, ev);
+			engine_trigger(engine, i, 0, ev);
+			return;
+		}
+	}
+	engine->stats->strokes_unmatched++;
+}
+
+/* Run an event of a mouse button through the chatter filter. Buttons in
+ * the configuration are filtered, the others only if a grabbed handler
+ * passes them on. Returns 1 if the event is held back or dropped. */
+static int engine_chatter(struct engine_t *engine, const hexdump_t *ev, int grabbed)
+{
+	btnx_config *cfg = engine->cfg;
+	hexdump_t release;
+	
+	if (cfg->chatter_max <= 0 || (ev->rawcode >> 24) != EV_KEY ||
+	    !chatter_code(ev->rawcode & 0xFFFF) || (ev->pressed != 0 && ev->pressed != 1))
+		return 0;
+	if (layer_key(cfg, ev->rawcode) < 0 && !(cfg->chatter_unbound && grabbed))
+		return 0;
+	switch (chatter_event(&engine->chatter, ev, grabbed, &release))
+	{
+	case CHATTER_FLUSH:
+		engine_event(engine, &release, grabbed);
+		return 0;
+	case CHATTER_HOLD:
+		return 1;
+	case CHATTER_DROP:
+		engine->stats->events_chattered++;
+		return 1;
+	}
+	return 0;
+}
+
+/* Run the binding of a decoded event. The unbound events of a grabbed
+ * handler do not reach the system otherwise and are passed on. */
+static void engine_event(struct engine_t *engine, const hexdump_t *ev, int grabbed)
+{
+	btnx_config *cfg = engine->cfg;
+	btnx_binding *binding;
+	struct timeval now;
+	int bev_index, pressed, code;
+	
+	/* Motion is only delivered while a stroke is drawn, or by a grabbed
+	 * handler */
+	code = ev->rawcode & 0xFFFF;
+	if ((engine->strokes_held > 0 || grabbed) &&
+	    (ev->rawcode >> 24) == EV_REL && (code == REL_X || code == REL_Y))
+	{
+		if (engine->strokes_held > 0)
+			engine_motion(engine, code, ev->pressed);
+		if (grabbed)
+			engine_move(engine, code, ev->pressed);
+		return;
+	}
+	BTNX_PROBE(event_read, ev->rawcode, -1, &ev->time);
+	pressed = (ev->pressed != 0);
+	if ((bev_index = engine_binding(engine, ev->rawcode, pressed)) == -1)
+	{
+		if (grabbed)
+			engine_pass(engine, ev);
+		return;
+	}
+	BTNX_PROBE(binding_match, ev->rawcode, bev_index, &ev->time);
+	engine->stats->events_matched++;
+	binding = &cfg->hot[bev_index];
+	if (binding->debounce[pressed])
+	{
+		engine->clock(&now);
+		if (engine_check_delay(binding, &now) < 0)
+		{
+			BTNX_PROBE(debounce_reject, ev->rawcode, bev_index, &ev->time);
+			engine->stats->events_debounced++;
+			return;
+		}
+		binding->last = now;
+	}
+	if (binding->stroke >= 0)
+		engine_stroke(engine, &cfg->stroke[binding->stroke], ev);
+	else if (binding->gesture >= 0)
+		engine_gesture(engine, &cfg->gesture[binding->gesture], ev);
+	else if (binding->action[pressed] != ACTION_NONE)
+	{
+		engine_run(engine, binding->action[pressed], bev_index, ev);
+		engine->clock(&now);
+		stats_latency(engine->stats, &ev->time, &now);
+	}
+}
+
+/* Send what a read left behind. Without a merge window, the steps of one
+ * read are merged. */
+static void engine_end(struct engine_t *engine)
+{
+	if (engine->cfg->wheel_coalesce == 0)
+		engine_flush(engine);
+	else
+		engine_send(engine);
+}
+
+/* Run the bindings of decoded events, after the chatter filter */
+void engine_feed(struct engine_t *engine, const hexdump_t *events, int count,
+                 int grabbed)
+{
+	int i;
+	
+	for (i = 0; i < count; i++)
+	{
+		if (events[i].rawcode == 0 || engine_chatter(engine, &events[i], grabbed))
+			continue;
+		engine_event(engine, &events[i], grabbed);
+	}
+	engine_end(engine);
+}
+
+/* Find the earliest time engine_tick() has work to do. Returns 0 if it
+ * has none. */
+static int engine_next(struct engine_t *engine, struct timeval *due)
+{
+	btnx_config *cfg = engine->cfg;
+	struct timeval release;
+	int i, found=0;
+	
+	if (engine->scroll_steps > 0 && cfg->wheel_coalesce > 0)
+	{
+		*due = engine->scroll_due;
+		found = 1;
+	}
+	if (chatter_next(&engine->chatter, &release) && (!found || timercmp(&release, due, <)))
+	{
+		*due = release;
+		found = 1;
+	}
+	for (i=0; i < cfg->gestures; i++)
+	{
+		if (!timerisset(&cfg->gesture[i].due))
+			continue;
+		if (!found || timercmp(&cfg->gesture[i].due, due, <))
+			*due = cfg->gesture[i].due;
+		found = 1;
+	}
+	return found;
+}
+
+/* Returns the microseconds until engine_tick() has work to do, -1 if it
+ * has none. The event loop waits for input at most this long. */
+long engine_timeout(struct engine_t *engine)
+{
+	struct timeval now, due;
+	long us;
+	
+	if (!engine_next(engine, &due))
+		return -1;
+	engine->clock(&now);
+	us = (due.tv_sec - now.tv_sec) * 1000000L + (due.tv_usec - now.tv_usec);
+	return (us > 0) ? us : 0;
+}
+
+/* Run the timed work that is due: send a scroll whose merge window has
+ * closed, the releases the chatter filter held back long enough, and
+ * resolve the gestures that timed out */
+void engine_tick(struct engine_t *engine)
+{
+	btnx_config *cfg = engine->cfg;
+	struct timeval now;
+	hexdump_t release;
+	int i, grabbed;
+	
+	if (!engine_next(engine, &now))
+		return;
+	engine->clock(&now);
+	if (engine->scroll_steps > 0 && cfg->wheel_coalesce > 0 &&
+	    !timercmp(&now, &engine->scroll_due, <))
+		engine_flush(engine);
+	while (chatter_due(&engine->chatter, &now, &release, &grabbed))
+		engine_event(engine, &release, grabbed);
+	for (i=0; i < cfg->gestures; i++)
+	{
+		if (timerisset(&cfg->gesture[i].due) && !timercmp(&now, &cfg->gesture[i].due, <))
+			engine_expire(engine, &cfg->gesture[i]);
+	}
+}
@@ -0,0 +1,61 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include <sys/time.h>
+
+#include "btnx.h"
+#include "chatter.h"
+#include "stats.h"
+
+/* Where the engine sends its output. Callbacks left NULL are skipped. */
+struct engine_sink_t {
+	void (*frame)(void *data, const btnx_frame *frame);
+	void (*command)(void *data, btnx_event *bev);
+	void (*config_switch)(void *data, btnx_event *bev);
+	void (*wheel)(void *data, int action, int mode);	/* ACTION_WHEEL_* */
+	void (*motion)(void *data, int enable);		/* Motion is needed for a stroke */
+	void *data;
+};
+
+/* Time source of debouncing and latency statistics */
+typedef void (*engine_clock_t)(struct timeval *now);
+
+struct engine_t {
+	btnx_config *cfg;
+	struct engine_sink_t sink;
+	engine_clock_t clock;
+	struct btnx_stats *stats;		/* Counters, may be shared with the caller */
+	struct chatter_t chatter;		/* Switch bounce filter, learned by this engine */
+	
+	/* Wheel steps coalesced by ACTION_SCROLL and not sent yet */
+	int scroll;						/* Sum of the steps */
+	int scroll_steps;				/* Number of steps */
+	struct timeval scroll_due;		/* End of the merge window */
+	btnx_frame scroll_frame;
+	
+	int strokes_held;				/* Stroke buttons held down */
+	
+	/* Unbound events of grabbed handlers, passed on after the motion
+	 * transform. Motion is summed up and sent once per read. */
+	const btnx_motion *motion;		/* Active transform, NULL for none */
+	int move_x, move_y;				/* Pointer motion not sent yet */
+	int wheel, hwheel;				/* Wheel steps not sent yet */
+	int carry_x, carry_y;			/* Fractions of a count left by the scale, in 1/100 */
+	int drag_x, drag_y;				/* Motion short of a wheel step */
+	btnx_frame pass_frame;
+};
+
+void engine_init(struct engine_t *engine, btnx_config *cfg,
+                 const struct engine_sink_t *sink, engine_clock_t clock,
+                 struct btnx_stats *stats);
+void engine_feed(struct engine_t *engine, const hexdump_t *events, int count,
+                 int grabbed);
+long engine_timeout(struct engine_t *engine);
+void engine_tick(struct engine_t *engine);
+
+#endif /*ENGINE_H_*/
@@ -0,0 +1,390 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Reads event handlers a frame at a time. When the kernel reports
+ * SYN_DROPPED because the handler's buffer overflowed, the partial frame
+ * is discarded and the key state is resynced with EVIOCGKEY, so that a
+ * lost release does not leave a key or a modifier stuck down. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "evdev.h"
+#include "stats.h"
+#include "log.h"
+
+#define EVDEV_BITS(n)			((n) / 8 + 1)
+#define EVDEV_TEST_BIT(a, b)	((a)[(b)/8] & (1 << ((b)%8)))
+#define EVDEV_KEY_RAWCODE(code)	((EV_KEY << 24) | (code))
+
+/* State of one event handler */
+struct evdev_t {
+	int fd;
+	int dropped;					/* Ignoring events up to the next SYN_REPORT */
+	int size;						/* Size of buf in events */
+	int pending;					/* Events of an unfinished frame at the start of buf */
+	int capacity;					/* Size of out, size + number of keys */
+	int queued;						/* A read into buf is in flight */
+	int completed;					/* The read finished with result */
+	int grabbed;					/* Events reach nobody else */
+	ssize_t result;
+	struct input_event *buf;
+	hexdump_t *out;					/* Decoded events */
+	unsigned char caps[EVDEV_BITS(KEY_MAX)];	/* Keys the device has */
+	unsigned char keys[EVDEV_BITS(KEY_MAX)];	/* Keys we have seen down */
+};
+
+static int evdev_query_default(int fd, unsigned long request, void *bits);
+static int evdev_count_bits(int fd, int type, int max);
+static int evdev_buffer_size(int fd);
+static inline void evdev_decode(const struct input_event *ev, hexdump_t *hexdump);
+static inline void evdev_set_key(struct evdev_t *dev, int code, int down);
+static int evdev_resync(struct evdev_t *dev, int n, int limit);
+
+/* Reads the capabilities and the key state */
+static evdev_query_t evdev_query=evdev_query_default;
+
+static int evdev_query_default(int fd, unsigned long request, void *bits)
+{
+	return ioctl(fd, request, bits);
+}
+
+/* Replace the ioctl() that reads the capabilities and the key state of
+ * the handlers, e.g. to run the resync on a pipe. NULL restores it. */
+void evdev_set_query(evdev_query_t query)
+{
+	evdev_query = (query != NULL) ? query : evdev_query_default;
+}
+
+/* Count the codes of an event type a device supports */
+static int evdev_count_bits(int fd, int type, int max)
+{
+	unsigned char bits[EVDEV_BITS(KEY_MAX)];
+	int i, count=0;
+	
+	memset(bits, 0, sizeof(bits));
+	if (evdev_query(fd, EVIOCGBIT(type, EVDEV_BITS(max)), bits) < 0)
+		return 0;
+	for (i=0; i<=max; i++)
+	{
+		if (EVDEV_TEST_BIT(bits, i))
+			count++;
+	}
+	return count;
+}
+
+/* Size the read buffer like the kernel sizes the handler's buffer: a few
+ * packets of the events the device can report at once. One read() can
+ * then drain everything the kernel has queued. */
+static int evdev_buffer_size(int fd)
+{
+	int per_packet, size=EVDEV_MIN_BUFFER;
+	
+	/* Every axis, a couple of buttons, a scan code and the report */
+	per_packet = evdev_count_bits(fd, EV_REL, REL_MAX) +
+	             evdev_count_bits(fd, EV_ABS, ABS_MAX) + 2 + 1 + 1;
+	while (size < per_packet * EVDEV_BUF_PACKETS)
+		size *= 2;
+	return size;
+}
+
+/* Open the reader of an event handler */
+struct evdev_t *evdev_new(int fd)
+{
+	struct evdev_t *dev;
+	int keys;
+	
+	if ((dev = (struct evdev_t *) calloc(1, sizeof(struct evdev_t))) == NULL)
+		return NULL;
+	dev->fd = fd;
+	dev->size = evdev_buffer_size(fd);
+	if (evdev_query(fd, EVIOCGBIT(EV_KEY, sizeof(dev->caps)), dev->caps) < 0)
+		memset(dev->caps, 0, sizeof(dev->caps));
+	keys = evdev_count_bits(fd, EV_KEY, KEY_MAX);
+	/* Keys that are down already belong to no binding press */
+	if (evdev_query(fd, EVIOCGKEY(sizeof(dev->keys)), dev->keys) < 0)
+		memset(dev->keys, 0, sizeof(dev->keys));
+	
+	/* Nothing is bound to motion, only strokes ask for it */
+	evdev_motion(dev, 0);
+	
+	dev->buf = (struct input_event *) malloc(dev->size * sizeof(struct input_event));
+	dev->capacity = dev->size + keys;
+	dev->out = (hexdump_t *) malloc(dev->capacity * sizeof(hexdump_t));
+	if (dev->buf == NULL || dev->out == NULL)
+	{
+		evdev_free(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+void evdev_free(struct evdev_t *dev)
+{
+	if (dev == NULL)
+		return;
+	free(dev->buf);
+	free(dev->out);
+	free(dev);
+}
+
+/* Turn the delivery of REL_X and REL_Y on or off with EVIOCSMASK, so
+ * that the kernel does not wake us for motion nobody needs. The other
+ * relative axes, like the wheels, stay on. Kernels older than 4.4 keep
+ * delivering motion, which is then ignored. A grabbed handler always
+ * delivers motion, it is passed on by the engine. */
+void evdev_motion(struct evdev_t *dev, int enable)
+{
+#ifdef EVIOCSMASK
+	unsigned char codes[EVDEV_BITS(REL_MAX)];
+	struct input_mask mask;
+	
+	if (dev->grabbed)
+		enable = 1;
+	memset(codes, 0xFF, sizeof(codes));
+	if (!enable)
+		codes[0] &= ~((1 << REL_X) | (1 << REL_Y));
+	mask.type = EV_REL;
+	mask.codes_size = sizeof(codes);
+	mask.codes_ptr = (unsigned long) codes;
+	ioctl(dev->fd, EVIOCSMASK, &mask);
+#else
+	(void) dev; (void) enable;
+#endif
+}
+
+/* Grab a handler that moves the pointer with EVIOCGRAB, so that its events
+ * only reach the system through the engine, which can then transform the
+ * motion. Handlers without pointer motion are left alone. Returns 1 if the
+ * handler is grabbed. */
+int evdev_grab(struct evdev_t *dev)
+{
+	unsigned char rel[EVDEV_BITS(REL_MAX)];
+	
+	memset(rel, 0, sizeof(rel));
+	if (evdev_query(dev->fd, EVIOCGBIT(EV_REL, sizeof(rel)), rel) < 0 ||
+	    !EVDEV_TEST_BIT(rel, REL_X) || !EVDEV_TEST_BIT(rel, REL_Y))
+		return 0;
+	if (ioctl(dev->fd, EVIOCGRAB, 1) < 0)
+	{
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: could not grab the mouse handler: %s",
+				strerror(errno));
+		return 0;
+	}
+	dev->grabbed = 1;
+	evdev_motion(dev, 1);
+	return 1;
+}
+
+/* Returns 1 if the handler is grabbed */
+int evdev_grabbed(struct evdev_t *dev)
+{
+	return dev->grabbed;
+}
+
+/* The key and button codes the device has, a bit per code like
+ * EVIOCGBIT(EV_KEY) fills them in */
+const unsigned char *evdev_caps(struct evdev_t *dev)
+{
+	return dev->caps;
+}
+
+/* Extract the rawcode(s) of an input event. */
+static inline void evdev_decode(const struct input_event *ev, hexdump_t *hexdump)
+{
+	hexdump->rawcode = ev->code & 0xFFFF;
+	if (ev->type == EV_REL)
+		hexdump->rawcode += (ev->value & 0xFF) << 16;
+	hexdump->rawcode += (ev->type & 0xFF) << 24;
+	hexdump->pressed = ev->value;
+	hexdump->time = ev->time;
+}
+
+/* Record a key as down or up */
+static inline void evdev_set_key(struct evdev_t *dev, int code, int down)
+{
+	if (down)
+		dev->keys[code/8] |= 1 << (code%8);
+	else
+		dev->keys[code/8] &= ~(1 << (code%8));
+}
+
+/* Compare the key state of the device with the keys seen down and add
+ * the missing releases, then the missing presses, to out after n
+ * events, up to limit. Returns the new number of events. Differences
+ * that do not fit are left for the next resync. */
+static int evdev_resync(struct evdev_t *dev, int n, int limit)
+{
+	unsigned char now[EVDEV_BITS(KEY_MAX)];
+	struct timeval tv;
+	int code, pass, down;
+	
+	if (evdev_query(dev->fd, EVIOCGKEY(sizeof(now)), now) < 0)
+	{
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: could not resync key state: %s",
+				strerror(errno));
+		return n;
+	}
+	gettimeofday(&tv, NULL);
+	for (pass=0; pass<2; pass++)
+	{
+		for (code=0; code<=KEY_MAX && n < limit; code++)
+		{
+			if (!EVDEV_TEST_BIT(dev->caps, code))
+				continue;
+			down = EVDEV_TEST_BIT(now, code) != 0;
+			if (down == (EVDEV_TEST_BIT(dev->keys, code) != 0) || down != pass)
+				continue;
+			evdev_set_key(dev, code, down);
+			dev->out[n].rawcode = EVDEV_KEY_RAWCODE(code);
+			dev->out[n].pressed = down;
+			dev->out[n].time = tv;
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Read what the handler has queued and decode the complete frames. Events
+ * of an unfinished frame are kept for the next call. Returns the number of
+ * decoded events in *out, 0 if there is nothing to read and -1 on error. */
+int evdev_read(struct evdev_t *dev, const hexdump_t **out)
+{
+	const struct input_event *ev;
+	ssize_t len;
+	int i, frame=0, count, n=0;
+	
+	*out = dev->out;
+	if (dev->completed)
+	{
+		dev->completed = 0;
+		if ((len = dev->result) < 0)
+		{
+			errno = -len;
+			len = -1;
+		}
+	}
+	else if (dev->queued)
+		return 0;
+	else
+		len = read(dev->fd, dev->buf + dev->pending,
+		           (dev->size - dev->pending) * sizeof(struct input_event));
+	if (len < 0)
+		return (errno == EAGAIN) ? 0 : -1;
+	if (len == 0)
+		return -1;
+	count = dev->pending + len / sizeof(struct input_event);
+	btnx_stats.events_read += len / sizeof(struct input_event);
+	
+	for (i=dev->pending; i<count; i++)
+	{
+		ev = &dev->buf[i];
+		if (ev->type != EV_SYN)
+			continue;
+		if (ev->code == SYN_DROPPED)
+		{
+			/* Drop the partial frame and everything up to the next report */
+			btnx_stats.events_dropped++;
+			dev->dropped = 1;
+			frame = i + 1;
+			continue;
+		}
+		if (ev->code != SYN_REPORT)
+			continue;
+		if (dev->dropped)
+		{
+			dev->dropped = 0;
+			/* Leave room for the events that are still to be decoded */
+			n = evdev_resync(dev, n, dev->capacity - (count - i - 1));
+		}
+		else
+		{
+			for (; frame < i; frame++)
+			{
+				ev = &dev->buf[frame];
+				/* After a resync, events still queued can repeat a
+				 * state that is already known */
+				if (ev->type == EV_KEY && ev->code <= KEY_MAX && ev->value != 2)
+				{
+					if ((EVDEV_TEST_BIT(dev->keys, ev->code) != 0) == (ev->value != 0))
+						continue;
+					evdev_set_key(dev, ev->code, ev->value);
+				}
+				evdev_decode(ev, &dev->out[n++]);
+			}
+		}
+		frame = i + 1;
+	}
+	
+	/* Keep an unfinished frame. A frame larger than the buffer is handed
+	 * out as it is. */
+	if (dev->dropped || frame == count)
+		dev->pending = 0;
+	else if (count - frame < dev->size)
+	{
+		memmove(dev->buf, dev->buf + frame, (count - frame) * sizeof(struct input_event));
+		dev->pending = count - frame;
+	}
+	else
+	{
+		for (; frame < count; frame++)
+			evdev_decode(&dev->buf[frame], &dev->out[n++]);
+		dev->pending = 0;
+	}
+	return n;
+}
+
+/* Space for a read queued by someone else, e.g. the io_uring loop. The
+ * result is handed in with evdev_read_done() and decoded by the next
+ * evdev_read(). */
+void *evdev_read_buffer(struct evdev_t *dev, size_t *len)
+{
+	dev->queued = 1;
+	*len = (dev->size - dev->pending) * sizeof(struct input_event);
+	return dev->buf + dev->pending;
+}
+
+/* Result of a queued read, bytes or -errno */
+void evdev_read_done(struct evdev_t *dev, ssize_t result)
+{
+	dev->queued = 0;
+	dev->completed = 1;
+	dev->result = result;
+}
+
+/* Returns 1 if a queued read has finished but is not decoded yet */
+int evdev_read_ready(struct evdev_t *dev)
+{
+	return dev->completed;
+}
+
+/* Release every key seen down, e.g. when the handler goes away. Returns
+ * the number of events in *out. */
+int evdev_release_all(struct evdev_t *dev, const hexdump_t **out)
+{
+	struct timeval tv;
+	int code, n=0;
+	
+	*out = dev->out;
+	gettimeofday(&tv, NULL);
+	for (code=0; code<=KEY_MAX; code++)
+	{
+		if (!EVDEV_TEST_BIT(dev->keys, code) || !EVDEV_TEST_BIT(dev->caps, code))
+			continue;
+		dev->out[n].rawcode = EVDEV_KEY_RAWCODE(code);
+		dev->out[n].pressed = 0;
+		dev->out[n].time = tv;
+		n++;
+	}
+	memset(dev->keys, 0, sizeof(dev->keys));
+	dev->pending = 0;
+	return n;
+}
@@ -0,0 +1,34 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef EVDEV_H_
+#define EVDEV_H_
+
+#include <sys/types.h>
+
+#include "btnx.h"
+
+#define EVDEV_MIN_BUFFER	64	/* Events, same as the kernel's evdev minimum */
+#define EVDEV_BUF_PACKETS	8	/* Packets per buffer, same as evdev */
+
+struct evdev_t;
+
+/* Reads a bitmap of a handler with EVIOCGBIT or EVIOCGKEY, like ioctl() */
+typedef int (*evdev_query_t)(int fd, unsigned long request, void *bits);
+
+struct evdev_t *evdev_new(int fd);
+void evdev_free(struct evdev_t *dev);
+int evdev_read(struct evdev_t *dev, const hexdump_t **out);
+void *evdev_read_buffer(struct evdev_t *dev, size_t *len);
+void evdev_read_done(struct evdev_t *dev, ssize_t result);
+int evdev_read_ready(struct evdev_t *dev);
+int evdev_release_all(struct evdev_t *dev, const hexdump_t **out);
+void evdev_motion(struct evdev_t *dev, int enable);
+int evdev_grab(struct evdev_t *dev);
+int evdev_grabbed(struct evdev_t *dev);
+const unsigned char *evdev_caps(struct evdev_t *dev);
+void evdev_set_query(evdev_query_t query);
+
+#endif /*EVDEV_H_*/
@@ -0,0 +1,120 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Temporary configuration directory of btnx-check and btnx-bench. The
+ * parser reads it in place of CONFIG_PATH, so nothing installed is read
+ * or changed. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include "btnx.h"
+#include "config_parser.h"
+#include "fixture.h"
+
+/* Static variables */
+static char fixture_dir[FIXTURE_NAME_SIZE]="";
+
+/* Create the directory as /tmp/prefix.XXXXXX and point the parser at it */
+int fixture_init(const char *prefix)
+{
+	snprintf(fixture_dir, sizeof(fixture_dir), "/tmp/%s.XXXXXX", prefix);
+	if (mkdtemp(fixture_dir) == NULL)
+	{
+		fprintf(stderr, "Could not create %s: %s\n", fixture_dir, strerror(errno));
+		fixture_dir[0] = '\0';
+		return -1;
+	}
+	config_set_path(fixture_dir);
+	return 0;
+}
+
+/* Open a file of the directory for writing */
+FILE *fixture_open(const char *name)
+{
+	char path[FIXTURE_NAME_SIZE * 2];
+	
+	snprintf(path, sizeof(path), "%s/%s", fixture_dir, name);
+	return fopen(path, "w");
+}
+
+/* Write a file of the directory */
+int fixture_file(const char *name, const char *text)
+{
+	FILE *fp;
+	
+	if ((fp = fixture_open(name)) == NULL)
+		return -1;
+	fputs(text, fp);
+	return fclose(fp);
+}
+
+/* Copy a file into the directory */
+int fixture_copy(const char *name, const char *path)
+{
+	char *text;
+	FILE *fp;
+	long size;
+	int ret=-1;
+	
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= 0 &&
+	    fseek(fp, 0, SEEK_SET) == 0 && (text = (char *) malloc(size + 1)) != NULL)
+	{
+		if (fread(text, 1, size, fp) == (size_t) size)
+		{
+			text[size] = '\0';
+			ret = fixture_file(name, text);
+		}
+		free(text);
+	}
+	fclose(fp);
+	return ret;
+}
+
+/* List a configuration of the directory in the config manager file and
+ * parse it */
+btnx_config *fixture_load(const char *name)
+{
+	char text[FIXTURE_NAME_SIZE];
+	char *config_name;
+	btnx_config *cfg;
+	
+	snprintf(text, sizeof(text), "%s\n", name);
+	if (fixture_file(CONFIG_MANAGER_NAME, text) < 0)
+		return NULL;
+	if ((config_name = strdup(name)) == NULL)
+		return NULL;
+	cfg = config_parse(&config_name);
+	free(config_name);
+	return cfg;
+}
+
+/* Remove the directory */
+void fixture_cleanup(void)
+{
+	struct dirent *entry;
+	DIR *dir;
+	
+	if (fixture_dir[0] == '\0')
+		return;
+	if ((dir = opendir(fixture_dir)) != NULL)
+	{
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (entry->d_name[0] != '.')
+				unlinkat(dirfd(dir), entry->d_name, 0);
+		}
+		closedir(dir);
+	}
+	if (rmdir(fixture_dir) < 0)
+		fprintf(stderr, "Could not remove %s: %s\n", fixture_dir, strerror(errno));
+	fixture_dir[0] = '\0';
+}
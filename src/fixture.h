@@ -0,0 +1,22 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef FIXTURE_H_
+#define FIXTURE_H_
+
+#include <stdio.h>
+
+#include "btnx.h"
+
+#define FIXTURE_NAME_SIZE	256
+
+int fixture_init(const char *prefix);
+FILE *fixture_open(const char *name);
+int fixture_file(const char *name, const char *text);
+int fixture_copy(const char *name, const char *path);
+btnx_config *fixture_load(const char *name);
+void fixture_cleanup(void);
+
+#endif /*FIXTURE_H_*/
@@ -0,0 +1,147 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Builds the uinput events of every binding when the configuration is
+ * loaded, so that running a binding is a matter of writing them out. */
+
+#include <string.h>
+#include <linux/input.h>
+
+#include "btnx.h"
+#include "frame.h"
+
+static inline void frame_add(btnx_frame *frame, int type, int code, int value);
+static void frame_target(btnx_frame *frame, int dev);
+static int frame_mods(btnx_frame *frame, const btnx_event *bev, int value);
+static void frame_key(btnx_frame *frame, const btnx_event *bev, int value);
+
+/* Append an event to a frame */
+static inline void frame_add(btnx_frame *frame, int type, int code, int value)
+{
+	struct input_event *ev = &frame->ev[frame->count[0] + frame->count[1]];
+	
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+	if (frame->count[1] > 0 || (frame->count[0] > 0 && frame->dev[0] != frame->dev[1]))
+		frame->count[1]++;
+	else
+		frame->count[0]++;
+}
+
+/* Start a new report for a device. Events for the same device share a
+ * write, a different device starts the second write. */
+static void frame_target(btnx_frame *frame, int dev)
+{
+	if (frame->count[0] == 0)
+		frame->dev[0] = dev;
+	frame->dev[1] = dev;
+}
+
+/* Add the modifier key events of a binding as one report */
+static int frame_mods(btnx_frame *frame, const btnx_event *bev, int value)
+{
+	int i, count=0;
+	
+	frame_target(frame, UINPUT_DEV_KBD);
+	for (i=0; i<MAX_MODS; i++)
+	{
+		if (bev->mod[i] == 0)
+			continue;
+		frame_add(frame, EV_KEY, bev->mod[i], value);
+		count++;
+	}
+	if (count > 0)
+		frame_add(frame, EV_SYN, SYN_REPORT, 0);
+	return count;
+}
+
+/* Add the main key, button or wheel event of a binding as one report.
+ * Relative events have no release, only the modifiers are released. */
+static void frame_key(btnx_frame *frame, const btnx_event *bev, int value)
+{
+	if (bev->keycode == REL_WHEELFORWARD || bev->keycode == REL_WHEELBACK)
+	{
+		if (!value)
+			return;
+		frame_target(frame, UINPUT_DEV_MOUSE);
+		frame_add(frame, EV_REL, REL_WHEEL,
+		                 bev->keycode == REL_WHEELFORWARD ? 1 : -1);
+	}
+	else if (bev->keycode > KEY_RESERVED && bev->keycode < BTNX_EXTRA_EVENTS)
+	{
+		frame_target(frame, frame_kbd_code(bev->keycode) ?
+		                    UINPUT_DEV_KBD : UINPUT_DEV_MOUSE);
+		frame_add(frame, EV_KEY, bev->keycode, value);
+	}
+	else
+		return;
+	frame_add(frame, EV_SYN, SYN_REPORT, 0);
+}
+
+/* Build a frame that scrolls the wheel by value steps, for the movement
+ * the engine has coalesced */
+void frame_scroll(btnx_frame *frame, int value)
+{
+	memset(frame, 0, sizeof(*frame));
+	frame_target(frame, UINPUT_DEV_MOUSE);
+	frame_add(frame, EV_REL, REL_WHEEL, value);
+	frame_add(frame, EV_SYN, SYN_REPORT, 0);
+}
+
+/* Build a frame of the motion passed on from grabbed handlers. Axes that
+ * did not move are left out. Returns the number of axes in the frame. */
+int frame_motion(btnx_frame *frame, int x, int y, int wheel, int hwheel)
+{
+	int count;
+	
+	memset(frame, 0, sizeof(*frame));
+	frame_target(frame, UINPUT_DEV_MOUSE);
+	if (x != 0)
+		frame_add(frame, EV_REL, REL_X, x);
+	if (y != 0)
+		frame_add(frame, EV_REL, REL_Y, y);
+	if (wheel != 0)
+		frame_add(frame, EV_REL, REL_WHEEL, wheel);
+	if (hwheel != 0)
+		frame_add(frame, EV_REL, REL_HWHEEL, hwheel);
+	if ((count = frame->count[0]) > 0)
+		frame_add(frame, EV_SYN, SYN_REPORT, 0);
+	return count;
+}
+
+/* Build a frame that passes on a button of a grabbed handler */
+void frame_button(btnx_frame *frame, int code, int value)
+{
+	memset(frame, 0, sizeof(*frame));
+	frame_target(frame, UINPUT_DEV_MOUSE);
+	frame_add(frame, EV_KEY, code, value);
+	frame_add(frame, EV_SYN, SYN_REPORT, 0);
+}
+
+/* Build the press and release frames of every binding. A press sends the
+ * modifiers first and then the main key, a release the main key first and
+ * then the modifiers. Commands, switches and layers get empty frames. */
+void frame_compile(btnx_config *cfg)
+{
+	int i, mods;
+	btnx_event *bev;
+	
+	for (i=0; i < cfg->count; i++)
+	{
+		bev = &cfg->cold[i];
+		memset(bev->frame, 0, sizeof(bev->frame));
+		if (bev->keycode > REL_WHEELBACK)
+			continue;
+		
+		mods = frame_mods(&bev->frame[1], bev, 1);
+		frame_key(&bev->frame[1], bev, 1);
+		/* Needs a little delay for mouse + modifier combo */
+		bev->frame[1].pause = (mods > 0 && bev->frame[1].count[1] > 0);
+		
+		frame_key(&bev->frame[0], bev, 0);
+		frame_mods(&bev->frame[0], bev, 0);
+	}
+}
@@ -0,0 +1,33 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <linux/input.h>
+
+#include "btnx.h"
+
+/* uinput devices, indexes of btnx_frame.dev */
+enum
+{
+	UINPUT_DEV_KBD=0,
+	UINPUT_DEV_MOUSE,
+	UINPUT_DEVICES
+};
+
+/* Returns 1 if a keycode is sent through the keyboard device, 0 if it is
+ * sent through the mouse device. */
+static inline int frame_kbd_code(int keycode)
+{
+	return (keycode <= KEY_UNKNOWN || keycode >= KEY_OK) && keycode < BTNX_EXTRA_EVENTS;
+}
+
+void frame_compile(btnx_config *cfg);
+void frame_scroll(btnx_frame *frame, int value);
+int frame_motion(btnx_frame *frame, int x, int y, int wheel, int hwheel);
+void frame_button(btnx_frame *frame, int code, int value);
+
+#endif /*FRAME_H_*/
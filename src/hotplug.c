@@ -0,0 +1,92 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Listens to kernel uevents so that event handlers and the MX Revolution
+ * receiver can be picked up again when they are plugged in or
+ * re-enumerated. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "hotplug.h"
+#include "log.h"
+
+/* Static variables */
+static int hotplug_fd = NULL_FD;
+static char hotplug_buffer[HOTPLUG_BUFFER_SIZE];
+
+/* Open the uevent socket. Returns the fd to listen to or NULL_FD. */
+int hotplug_init(void) {
+	struct sockaddr_nl addr;
+	
+	hotplug_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+	                    NETLINK_KOBJECT_UEVENT);
+	if (hotplug_fd < 0) {
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: hotplug notifications not available: %s",
+				strerror(errno));
+		return (hotplug_fd = NULL_FD);
+	}
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = 1; /* Kernel uevents */
+	if (bind(hotplug_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: hotplug notifications not available: %s",
+				strerror(errno));
+		close(hotplug_fd);
+		return (hotplug_fd = NULL_FD);
+	}
+	
+	return hotplug_fd;
+}
+
+void hotplug_close(void) {
+	if (hotplug_fd != NULL_FD)
+		close(hotplug_fd);
+	hotplug_fd = NULL_FD;
+}
+
+/* Read one uevent. Returns 1 if an event with a device node was read,
+ * 0 if there was nothing of interest and -1 on error. */
+int hotplug_read(struct hotplug_event_t *event) {
+	int len, pos;
+	char *key;
+	
+	event->action = HOTPLUG_OTHER;
+	event->subsystem = NULL;
+	event->devname = NULL;
+	
+	len = recv(hotplug_fd, hotplug_buffer, sizeof(hotplug_buffer) - 1, MSG_DONTWAIT);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR || errno == ENOBUFS) ? 0 : -1;
+	hotplug_buffer[len] = '\0';
+	
+	/* "action@devpath" header followed by null separated KEY=value pairs */
+	for (pos = strlen(hotplug_buffer) + 1; pos < len; pos += strlen(key) + 1) {
+		key = &hotplug_buffer[pos];
+		if (!strncmp(key, "ACTION=", 7)) {
+			if (!strcmp(key + 7, "add"))
+				event->action = HOTPLUG_ADD;
+			else if (!strcmp(key + 7, "remove"))
+				event->action = HOTPLUG_REMOVE;
+		}
+		else if (!strncmp(key, "SUBSYSTEM=", 10))
+			event->subsystem = key + 10;
+		else if (!strncmp(key, "DEVNAME=", 8))
+			event->devname = key + 8;
+	}
+	
+	if (event->subsystem == NULL || event->devname == NULL)
+		return 0;
+	return 1;
+}
@@ -0,0 +1,31 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef HOTPLUG_H_
+#define HOTPLUG_H_
+
+#define HOTPLUG_BUFFER_SIZE		4096
+
+/* Hotplug actions */
+enum
+{
+	HOTPLUG_OTHER=0,
+	HOTPLUG_ADD,
+	HOTPLUG_REMOVE
+};
+
+/* A kernel uevent. The strings point into a buffer that is overwritten by
+ * the next hotplug_read(). */
+struct hotplug_event_t {
+	int action;
+	const char *subsystem;	/* e.g. "input" or "usbmisc" */
+	const char *devname;	/* Device node relative to /dev, e.g. "input/event5" */
+};
+
+int hotplug_init(void);
+void hotplug_close(void);
+int hotplug_read(struct hotplug_event_t *event);
+
+#endif /*HOTPLUG_H_*/
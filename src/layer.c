@@ -0,0 +1,236 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#include <stdio.h>
+#include <string.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "arena.h"
+#include "layer.h"
+
+static int layer_insert(btnx_config *cfg, int rawcode);
+static int layer_gestures(btnx_config *cfg);
+static int layer_strokes(btnx_config *cfg);
+
+/* Find or add the key of a rawcode */
+static int layer_insert(btnx_config *cfg, int rawcode)
+{
+	int key;
+	unsigned int h = (unsigned int) rawcode * 0x9E3779B1u;
+	struct layer_slot_t *slot;
+	
+	if ((key = layer_key(cfg, rawcode)) >= 0)
+		return key;
+	for (h ^= h >> 16;; h++)
+	{
+		slot = &cfg->slots[h & cfg->mask];
+		if (slot->key < 0)
+			break;
+	}
+	slot->rawcode = rawcode;
+	slot->key = cfg->keys++;
+	return slot->key;
+}
+
+/* Attach the hold and double tap bindings to the binding of their button
+ * in their layer, which gets a gesture. A button with only hold or double
+ * tap bindings is dispatched to the first of them. Returns -1 if out of
+ * memory. */
+static int layer_gestures(btnx_config *cfg)
+{
+	int i, entry, trigger, *slot, count=0;
+	btnx_gesture *g;
+	
+	for (i=0; i < cfg->count; i++)
+	{
+		if (cfg->cold[i].trigger == TRIGGER_HOLD || cfg->cold[i].trigger == TRIGGER_DOUBLE)
+			count++;
+	}
+	cfg->gestures = 0;
+	cfg->gesture = NULL;
+	if (count == 0)
+		return 0;
+	if ((cfg->gesture = (btnx_gesture *) arena_alloc(cfg->arena, count * sizeof(btnx_gesture))) == NULL)
+		return -1;
+	
+	for (i=0; i < cfg->count; i++)
+	{
+		trigger = cfg->cold[i].trigger;
+		if (trigger != TRIGGER_HOLD && trigger != TRIGGER_DOUBLE)
+			continue;
+		slot = &cfg->layer[cfg->cold[i].layer][layer_key(cfg, cfg->hot[i].rawcode)];
+		if (*slot < 0)
+			*slot = i;
+		entry = *slot;
+		if (cfg->hot[entry].gesture < 0)
+		{
+			g = &cfg->gesture[cfg->gestures];
+			memset(g, 0, sizeof(*g));
+			g->tap = (entry == i) ? -1 : entry;
+			g->hold = g->dbl = -1;
+			g->hold_time = GESTURE_HOLD_TIME;
+			g->dbl_time = GESTURE_DOUBLE_TIME;
+			cfg->hot[entry].gesture = cfg->gestures++;
+		}
+		g = &cfg->gesture[cfg->hot[entry].gesture];
+		if (trigger == TRIGGER_HOLD && g->hold < 0)
+		{
+			g->hold = i;
+			if (cfg->cold[i].trigger_time > 0)
+				g->hold_time = cfg->cold[i].trigger_time;
+		}
+		else if (trigger == TRIGGER_DOUBLE && g->dbl < 0)
+		{
+			g->dbl = i;
+			if (cfg->cold[i].trigger_time > 0)
+				g->dbl_time = cfg->cold[i].trigger_time;
+		}
+	}
+	return 0;
+}
+
+/* Attach the stroke bindings to the binding of their button in their
+ * layer, like layer_gestures(). Returns -1 if out of memory. */
+static int layer_strokes(btnx_config *cfg)
+{
+	int i, entry, *slot, count=0;
+	btnx_stroke *s;
+	
+	for (i=0; i < cfg->count; i++)
+	{
+		if (cfg->cold[i].path_len > 0)
+			count++;
+	}
+	cfg->strokes = 0;
+	cfg->stroke = NULL;
+	if (count == 0)
+		return 0;
+	if ((cfg->stroke = (btnx_stroke *) arena_alloc(cfg->arena, count * sizeof(btnx_stroke))) == NULL)
+		return -1;
+	
+	/* Backwards, so that the lists keep the order of the file */
+	for (i=cfg->count-1; i >= 0; i--)
+	{
+		if (cfg->cold[i].path_len == 0)
+			continue;
+		slot = &cfg->layer[cfg->cold[i].layer][layer_key(cfg, cfg->hot[i].rawcode)];
+		if (*slot < 0)
+			*slot = i;
+		entry = *slot;
+		if (cfg->hot[entry].stroke < 0)
+		{
+			s = &cfg->stroke[cfg->strokes];
+			memset(s, 0, sizeof(*s));
+			s->tap = (entry == i) ? -1 : entry;
+			s->first = -1;
+			cfg->hot[entry].stroke = cfg->strokes++;
+		}
+		s = &cfg->stroke[cfg->hot[entry].stroke];
+		cfg->cold[i].path_next = s->first;
+		s->first = i;
+	}
+	return 0;
+}
+
+/* Build the rawcode table and the dispatch table of every layer. A layer
+ * falls back to the base layer for rawcodes it does not bind, so finding
+ * a binding is one table lookup and one array access in any layer.
+ * Returns -1 if out of memory. */
+int layer_build(btnx_config *cfg)
+{
+	int i, l, size=2;
+	btnx_event *bev;
+	
+	cfg->layers = 1;
+	for (i=0; i < cfg->count; i++)
+	{
+		if (cfg->cold[i].layer >= cfg->layers)
+			cfg->layers = cfg->cold[i].layer + 1;
+	}
+	while (size < 2 * cfg->count)
+		size *= 2;
+	
+	cfg->mask = size - 1;
+	cfg->keys = 0;
+	cfg->slots = (struct layer_slot_t *) arena_alloc(cfg->arena, size * sizeof(struct layer_slot_t));
+	cfg->layer = (int **) arena_alloc(cfg->arena, cfg->layers * sizeof(int*));
+	if (cfg->slots == NULL || cfg->layer == NULL)
+		return -1;
+	for (i=0; i < size; i++)
+		cfg->slots[i].key = -1;
+	for (i=0; i < cfg->count; i++)
+	{
+		layer_insert(cfg, cfg->hot[i].rawcode);
+		cfg->hot[i].gesture = -1;
+		cfg->hot[i].stroke = -1;
+	}
+	
+	cfg->held = (int *) arena_alloc(cfg->arena, cfg->keys * sizeof(int));
+	if (cfg->held == NULL)
+		return -1;
+	memset(cfg->held, -1, cfg->keys * sizeof(int));
+	for (l=0; l < cfg->layers; l++)
+	{
+		cfg->layer[l] = (int *) arena_alloc(cfg->arena, cfg->keys * sizeof(int));
+		if (cfg->layer[l] == NULL)
+			return -1;
+		memset(cfg->layer[l], -1, cfg->keys * sizeof(int));
+	}
+	
+	/* The first binding of a rawcode in a layer wins, like the old linear
+	 * search did */
+	for (i=cfg->count-1; i >= 0; i--)
+	{
+		bev = &cfg->cold[i];
+		if (bev->trigger == TRIGGER_HOLD || bev->trigger == TRIGGER_DOUBLE ||
+		    bev->path_len > 0)
+			continue;
+		cfg->layer[bev->layer][layer_key(cfg, cfg->hot[i].rawcode)] = i;
+	}
+	if (layer_gestures(cfg) < 0 || layer_strokes(cfg) < 0)
+		return -1;
+	for (l=1; l < cfg->layers; l++)
+	{
+		for (i=0; i < cfg->keys; i++)
+		{
+			if (cfg->layer[l][i] < 0)
+				cfg->layer[l][i] = cfg->layer[0][i];
+		}
+	}
+	
+	cfg->locked = 0;
+	cfg->active_layer = 0;
+	cfg->active = cfg->layer[0];
+	return 0;
+}
+
+/* Make a layer active */
+void layer_set(btnx_config *cfg, int layer)
+{
+	if (layer < 0 || layer >= cfg->layers)
+		return;
+	cfg->active_layer = layer;
+	cfg->active = cfg->layer[layer];
+}
+
+/* Activate a layer while a button is held */
+void layer_hold(btnx_config *cfg, int layer)
+{
+	layer_set(cfg, layer);
+}
+
+/* Return from a held layer to the toggled one */
+void layer_restore(btnx_config *cfg)
+{
+	layer_set(cfg, cfg->locked);
+}
+
+/* Toggle a layer on, or back to the base layer if it is already on */
+void layer_toggle(btnx_config *cfg, int layer)
+{
+	cfg->locked = (cfg->locked == layer) ? 0 : layer;
+	layer_set(cfg, cfg->locked);
+}
@@ -0,0 +1,58 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef LAYER_H_
+#define LAYER_H_
+
+#include "btnx.h"
+
+#define MAX_LAYERS		8
+#define GESTURE_HOLD_TIME	500		/* Default hold time in ms */
+#define GESTURE_DOUBLE_TIME	250		/* Default double tap time in ms */
+#define STROKE_STEP			100		/* Default stroke_step, in mouse counts */
+
+/* A rawcode table slot. key is the dense index of the rawcode, -1 if the
+ * slot is empty. */
+struct layer_slot_t {
+	int rawcode;
+	int key;
+};
+
+int layer_build(btnx_config *cfg);
+void layer_set(btnx_config *cfg, int layer);
+void layer_hold(btnx_config *cfg, int layer);
+void layer_restore(btnx_config *cfg);
+void layer_toggle(btnx_config *cfg, int layer);
+
+/* Return the key of a rawcode, or -1 if no layer binds it. The table is
+ * at most half full, so the probe ends quickly. */
+static inline int layer_key(const btnx_config *cfg, int rawcode)
+{
+	unsigned int h = (unsigned int) rawcode * 0x9E3779B1u;
+	const struct layer_slot_t *slot;
+	
+	for (h ^= h >> 16;; h++)
+	{
+		slot = &cfg->slots[h & cfg->mask];
+		if (slot->key < 0 || slot->rawcode == rawcode)
+			return slot->key;
+	}
+}
+
+/* Return the binding that handles an event on a key, or -1. Releases go
+ * to the binding that handled the press, even if the layer has changed
+ * in between. */
+static inline int layer_binding(btnx_config *cfg, int key, int pressed)
+{
+	int index;
+	
+	if (pressed)
+		return (cfg->held[key] = cfg->active[key]);
+	index = cfg->held[key];
+	cfg->held[key] = -1;
+	return (index < 0) ? cfg->active[key] : index;
+}
+
+#endif /*LAYER_H_*/
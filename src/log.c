@@ -0,0 +1,229 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Logging that never blocks the event loop. btnx_log() formats a record
+ * into a lock-free ring and a background thread writes it out with
+ * daemon_log(), which may block on a slow syslog. When the ring is full
+ * the record is dropped and counted. Before log_start() and after
+ * log_stop() records are written directly. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "log.h"
+#include "stats.h"
+
+/* A queued message. seq tells whose turn the slot is: pos when it is
+ * free for the producer of pos, pos + 1 when it holds that record. */
+struct log_record_t {
+	unsigned int seq;
+	int prio;
+	char msg[LOG_MSG_SIZE];
+};
+
+/* Rate limiting state of a call site, keyed by its format string */
+struct log_site_t {
+	const char *fmt;
+	long window;					/* Second the count belongs to */
+	int count;
+	int suppressed;
+};
+
+/* Static variables */
+static struct log_record_t log_ring[LOG_RING_SIZE];
+static unsigned int log_head;		/* Next record to write */
+static unsigned int log_tail;		/* Next record to drain */
+/* Per thread, so that logging never waits for another thread */
+static __thread struct log_site_t log_sites[LOG_SITES];
+static int log_fd=-1;				/* Wakes the drainer */
+static int log_sleeping=0;			/* The drainer waits for log_fd */
+static int log_running=0;
+static pthread_t log_thread;
+
+static int log_limit(const char *fmt, int *suppressed);
+static int log_drain(void);
+static void *log_main(void *arg);
+
+/* Returns 1 if a message from fmt may be logged now. Lets LOG_BURST
+ * messages of a call site and thread through per second, and returns how
+ * many were suppressed before. */
+static int log_limit(const char *fmt, int *suppressed)
+{
+	struct log_site_t *site;
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	/* Format strings sit next to each other, so mix the address bits */
+	site = &log_sites[(((unsigned long) fmt * 2654435761UL) >> 12) & (LOG_SITES - 1)];
+	*suppressed = 0;
+	if (site->fmt != fmt || site->window != now.tv_sec)
+	{
+		if (site->fmt == fmt)
+			*suppressed = site->suppressed;
+		site->fmt = fmt;
+		site->window = now.tv_sec;
+		site->count = 0;
+		site->suppressed = 0;
+	}
+	if (site->count >= LOG_BURST)
+	{
+		site->suppressed++;
+		__atomic_fetch_add(&btnx_stats.log_suppressed, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	site->count++;
+	return 1;
+}
+
+/* Write out the queued records. Returns the number written. */
+static int log_drain(void)
+{
+	struct log_record_t *rec;
+	int count=0;
+	
+	for (;; log_tail++, count++)
+	{
+		rec = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != log_tail + 1)
+			break;
+		daemon_log(rec->prio, "%s", rec->msg);
+		__atomic_store_n(&rec->seq, log_tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+	}
+	return count;
+}
+
+static void *log_main(void *arg)
+{
+	uint64_t n;
+	
+	(void) arg;
+	while (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+	{
+		if (log_drain() > 0)
+			continue;
+		/* Records are only signalled while the drainer sleeps, so look
+		 * once more after saying so */
+		__atomic_store_n(&log_sleeping, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (log_drain() == 0 && read(log_fd, &n, sizeof(n)) < 0 && errno != EINTR)
+			break;
+		__atomic_store_n(&log_sleeping, 0, __ATOMIC_RELAXED);
+	}
+	log_drain();
+	return NULL;
+}
+
+/* Start the drainer thread. Call it before the event loop thread gets a
+ * real-time priority, so that the drainer does not inherit it. */
+int log_start(void)
+{
+	unsigned int i;
+	
+	for (i=0; i<LOG_RING_SIZE; i++)
+		log_ring[i].seq = i;
+	log_head = log_tail = 0;
+	log_sleeping = 0;
+	if ((log_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+	{
+		daemon_log(LOG_WARNING, OUT_PRE "Warning: logging synchronously: %s", strerror(errno));
+		return -1;
+	}
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+	if ((errno = pthread_create(&log_thread, NULL, log_main, NULL)) != 0)
+	{
+		daemon_log(LOG_WARNING, OUT_PRE "Warning: logging synchronously: %s", strerror(errno));
+		log_running = 0;
+		close(log_fd);
+		log_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/* Write out what is left and stop the drainer, e.g. before exiting or
+ * exec'ing another configuration */
+void log_stop(void)
+{
+	uint64_t one = 1;
+	
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+		return;
+	__atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+	if (write(log_fd, &one, sizeof(one)) < 0)
+		pthread_cancel(log_thread);
+	pthread_join(log_thread, NULL);
+	close(log_fd);
+	log_fd = -1;
+}
+
+/* Log a message without blocking. Called like daemon_log(). */
+void btnx_log(int prio, const char *fmt, ...)
+{
+	struct log_record_t *rec;
+	char msg[LOG_MSG_SIZE];
+	unsigned int pos, seq;
+	uint64_t one = 1;
+	int suppressed, len;
+	va_list ap;
+	
+	if (!log_limit(fmt, &suppressed))
+		return;
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+	{
+		va_start(ap, fmt);
+		vsnprintf(msg, sizeof(msg), fmt, ap);
+		va_end(ap);
+		if (suppressed > 0)
+			daemon_log(prio, "%s (%d similar messages suppressed)", msg, suppressed);
+		else
+			daemon_log(prio, "%s", msg);
+		return;
+	}
+	
+	/* Claim the slot at the head, unless the drainer is a full ring behind */
+	pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		rec = &log_ring[pos & (LOG_RING_SIZE - 1)];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos)
+		{
+			if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((int) (seq - pos) < 0)
+		{
+			__atomic_fetch_add(&btnx_stats.log_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+			pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	}
+	
+	rec->prio = prio;
+	va_start(ap, fmt);
+	len = vsnprintf(rec->msg, LOG_MSG_SIZE, fmt, ap);
+	va_end(ap);
+	if (suppressed > 0 && len >= 0 && len < LOG_MSG_SIZE)
+		snprintf(rec->msg + len, LOG_MSG_SIZE - len, " (%d similar messages suppressed)",
+		         suppressed);
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+	
+	/* A drainer that is awake finds the record without a system call */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&log_sleeping, 0, __ATOMIC_SEQ_CST) &&
+	    write(log_fd, &one, sizeof(one)) < 0)
+		return; /* The drainer catches up on the next record */
+}
@@ -0,0 +1,18 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#define LOG_RING_SIZE		64		/* Queued records, a power of 2 */
+#define LOG_MSG_SIZE		256		/* Record size, longer messages are cut */
+#define LOG_BURST			5		/* Messages per call site, thread and second */
+#define LOG_SITES			32		/* Rate limited call sites, a power of 2 */
+
+int log_start(void);
+void log_stop(void);
+void btnx_log(int prio, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif /*LOG_H_*/
@@ -0,0 +1,54 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* USDT probes on the input-to-output path, for perf and bpftrace:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/btnx:btnx:frame_submit { ... }'
+ *
+ * Every probe carries the rawcode, the binding index (-1 before the
+ * binding is known) and the kernel timestamp of the event in
+ * microseconds. The arguments are only evaluated while a tracer is
+ * attached, which it signals through the probe's semaphore. Without
+ * <sys/sdt.h> the probes compile to nothing.
+ *
+ * Only included by engine.c, which owns the semaphores. */
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#include "btnx.h"
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define BTNX_PROBE_SEMAPHORE(name) \
+	static volatile unsigned short btnx_##name##_semaphore \
+	__attribute__((unused, section(".probes")))
+
+BTNX_PROBE_SEMAPHORE(event_read);
+BTNX_PROBE_SEMAPHORE(binding_match);
+BTNX_PROBE_SEMAPHORE(debounce_reject);
+BTNX_PROBE_SEMAPHORE(frame_submit);
+BTNX_PROBE_SEMAPHORE(command_spawn);
+BTNX_PROBE_SEMAPHORE(config_switch);
+
+#define BTNX_PROBE(name, rawcode, index, time) \
+	do { \
+		if (__builtin_expect(btnx_##name##_semaphore, 0)) \
+			DTRACE_PROBE3(btnx, name, (rawcode), (index), \
+			              (long long) (time)->tv_sec * 1000000 + (time)->tv_usec); \
+	} while (0)
+
+#else /* HAVE_SYS_SDT_H */
+
+/* sizeof does not evaluate the arguments, but keeps them used */
+#define BTNX_PROBE(name, rawcode, index, time) \
+	do { (void) sizeof((rawcode) + (index) + (time)->tv_sec); } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /*PROBES_H_*/
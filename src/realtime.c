@@ -0,0 +1,68 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Opt-in low-latency mode: memory locking, SCHED_FIFO and CPU pinning */
+
+#define _GNU_SOURCE				// Needed for CPU_SET()
+
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "realtime.h"
+
+/* Lock the daemon in memory, switch to SCHED_FIFO with priority (if > 0)
+ * and pin it to cpu (if not REALTIME_CPU_ANY). Must be called after
+ * daemon_fork(), memory locks are not inherited by children. Returns -1
+ * if any step failed. */
+int realtime_init(int priority, int cpu) {
+	struct sched_param param;
+	cpu_set_t set;
+	int ret=0;
+	
+	if (priority > 0) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: mlockall failed: %s", strerror(errno));
+			ret = -1;
+		}
+		
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: could not set SCHED_FIFO priority %d: %s",
+					priority, strerror(errno));
+			ret = -1;
+		}
+		else
+			daemon_log(LOG_INFO, OUT_PRE "Running with SCHED_FIFO priority %d", priority);
+	}
+	
+	if (cpu != REALTIME_CPU_ANY) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+			daemon_log(LOG_WARNING, OUT_PRE "Warning: could not pin to CPU %d: %s",
+					cpu, strerror(errno));
+			ret = -1;
+		}
+		else
+			daemon_log(LOG_INFO, OUT_PRE "Pinned to CPU %d", cpu);
+	}
+	
+	return ret;
+}
+
+/* Microseconds elapsed on the monotonic clock since a time */
+long realtime_elapsed_us(const struct timespec *since) {
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000L +
+		(now.tv_nsec - since->tv_nsec) / 1000L;
+}
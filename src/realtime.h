@@ -0,0 +1,16 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef REALTIME_H_
+#define REALTIME_H_
+
+#include <time.h>
+
+#define REALTIME_CPU_ANY	-1
+
+int realtime_init(int priority, int cpu);
+long realtime_elapsed_us(const struct timespec *since);
+
+#endif /*REALTIME_H_*/
@@ -48,11 +48,15 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <libdaemon/dlog.h>
 
 #include "revoco.h"
 #include "../config.h"
 #include "btnx.h"
+#include "log.h"
 
 #define streq(a,b)		(strcmp((a), (b)) == 0)
 #define strneq(a,b,c)	(strncmp((a), (b), (c)) == 0)
@@ -61,6 +65,8 @@
 #define MX_REVOLUTION	0xc51a	// version RR41.01_B0025
 #define MX_REVOLUTION2	0xc525	// version RQR02.00_B0020
 
+#define HIDDEV_SYSFS_CLASS	"/sys/class/usbmisc"
+
 /*** extracted from hiddev.h ***/
 
 typedef signed short s16;
@@ -116,16 +122,43 @@ static int revoco_mode=0;
 static int revoco_btn=3;
 static int revoco_up_scroll=0;
 static int revoco_down_scroll=0;
+static char revoco_node[64]="";	/* hiddev node of the receiver, found via sysfs */
+static int revoco_fd=-1;		/* Persistent handle to the receiver */
+static int revoco_current=REVOCO_DISABLED;	/* Wheel mode set at runtime */
+static int revoco_pending=REVOCO_INVALID_MODE;	/* Wheel mode waiting for revoco_flush() */
+
+/* HIDIOCSREPORT waits for the receiver, so once the event loop runs, the
+ * receiver is only opened and written by a worker thread. The event loop
+ * hands over modes and added nodes under revoco_lock. */
+static pthread_mutex_t revoco_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t revoco_cond=PTHREAD_COND_INITIALIZER;
+static pthread_t revoco_thread;
+static int revoco_worker=0;		/* The worker thread is running */
+static int revoco_stop=0;
+static int revoco_send=REVOCO_INVALID_MODE;	/* Wheel mode for the worker */
+static char revoco_added[64]="";	/* hiddev node added, for the worker */
+static int revoco_wanted=REVOCO_DISABLED;	/* Runtime mode last sent by the worker */
 
 /* Static function declarations */
 static void fatal(const char *fmt, ...);
+static int sysfs_read_hex(const char *name, const char *attr);
+static int sysfs_is_revolution(const char *name);
+static int sysfs_find_dev(void);
+static int open_indexed(void);
 static int open_dev(char *path);
 static void close_dev(int fd);
-static void send_report(int fd, int id, int *buf, int n);
-static void mx_cmd(int fd, int b1, int b2, int b3);
-static void configure(int handle);
+static int send_report(int fd, int id, int *buf, int n);
+static int mx_cmd(int fd, int b1, int b2, int b3);
+static int configure(int handle, int mode, int perm);
 static void trouble_shooting(void);
-static int revoco_check_values(void);
+static int revoco_check_values(int mode);
+static int revoco_base_mode(void);
+static int revoco_open(void);
+static void revoco_close_handle(void);
+static void revoco_apply(int mode);
+static int revoco_reopen(const char *devname);
+static int revoco_start(void);
+static void *revoco_main(void *arg);
 
 
 static void fatal(const char *fmt, ...)
@@ -139,6 +172,65 @@ static void fatal(const char *fmt, ...)
     va_end(args);
 }
 
+/* Read a hexadecimal attribute of the USB device a hiddev node belongs to */
+static int sysfs_read_hex(const char *name, const char *attr)
+{
+    char buf[128];
+    FILE *fp;
+    int value = -1;
+
+    snprintf(buf, sizeof(buf), HIDDEV_SYSFS_CLASS "/%.40s/device/../%s", name, attr);
+    if ((fp = fopen(buf, "r")) == NULL)
+	return -1;
+    if (fscanf(fp, "%x", &value) != 1)
+	value = -1;
+    fclose(fp);
+    return value;
+}
+
+static int sysfs_is_revolution(const char *name)
+{
+    int product;
+
+    if (strncmp(name, "hiddev", 6) != 0)
+	return 0;
+    if (sysfs_read_hex(name, "idVendor") != LOGITECH)
+	return 0;
+    product = sysfs_read_hex(name, "idProduct");
+    return product == MX_REVOLUTION || product == MX_REVOLUTION2;
+}
+
+/* Find the receiver's hiddev node in one pass over sysfs, without opening
+ * any device nodes. The result is kept in revoco_node. */
+static int sysfs_find_dev(void)
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    if ((dir = opendir(HIDDEV_SYSFS_CLASS)) == NULL)
+	return -1;
+    while ((entry = readdir(dir)) != NULL)
+    {
+	if (!sysfs_is_revolution(entry->d_name))
+	    continue;
+	snprintf(revoco_node, sizeof(revoco_node), "/dev/usb/%.40s", entry->d_name);
+	if (access(revoco_node, F_OK) != 0)
+	    snprintf(revoco_node, sizeof(revoco_node), "/dev/%.40s", entry->d_name);
+	closedir(dir);
+	return 0;
+    }
+    closedir(dir);
+    return -1;
+}
+
+/* Open the indexed hiddev node */
+static int open_indexed(void)
+{
+    if (revoco_node[0] == '\0' && sysfs_find_dev() < 0)
+	return -1;
+    return open(revoco_node, O_RDWR | O_CLOEXEC);
+}
+
 static int open_dev(char *path)
 {
     char buf[128];
@@ -148,7 +240,7 @@ static int open_dev(char *path)
     for (i = 0; i < 16; ++i)
     {
 	sprintf(buf, path, i);
-	fd = open(buf, O_RDWR);
+	fd = open(buf, O_RDWR | O_CLOEXEC);
 	if (fd >= 0)
 	{
 	    if (ioctl(fd, HIDIOCGDEVINFO, &dinfo) == 0)
@@ -170,7 +262,7 @@ static void close_dev(int fd)
     close(fd);
 }
 
-static void send_report(int fd, int id, int *buf, int n)
+static int send_report(int fd, int id, int *buf, int n)
 {
     struct hiddev_usage_ref_multi uref;
     struct hiddev_report_info rinfo;
@@ -186,7 +278,7 @@ static void send_report(int fd, int id, int *buf, int n)
     if (ioctl(fd, HIDIOCSUSAGES, &uref) == -1)
     {
 		fatal("send report %02x/%d, HIDIOCSUSAGES: %s", id, n, strerror(errno));
-		return;
+		return -1;
     }
 
     rinfo.report_type = HID_REPORT_TYPE_OUTPUT;
@@ -195,42 +287,35 @@ static void send_report(int fd, int id, int *buf, int n)
     if (ioctl(fd, HIDIOCSREPORT, &rinfo) == -1)
 	{
 		fatal("send report %02x/%d, HIDIOCSREPORT: %s", id, n, strerror(errno));
-		return;
+		return -1;
 	}
+	return 0;
 }
 
-static void mx_cmd(int fd, int b1, int b2, int b3)
+static int mx_cmd(int fd, int b1, int b2, int b3)
 {
     int buf[6] = { 0x01, 0x80, 0x56, b1, b2, b3 };
 
-    send_report(fd, 0x10, buf, 6);
+    return send_report(fd, 0x10, buf, 6);
 }
 
-static void configure(int handle)
+/* Send a single wheel mode report. perm is 0x80 to make the mode the
+ * power-up default, 0x00 for a temporary change. */
+static int configure(int handle, int mode, int perm)
 {
-#if REVOCO_TEMP==1
-	int perm = 0x00;
-#else
-	int perm = 0x80;
-#endif
-	
-	switch (revoco_mode)
+	switch (mode)
 	{
 	case REVOCO_FREE_MODE:
-	    mx_cmd(handle, perm + 1, 0, 0);
-	    break;
+	    return mx_cmd(handle, perm + 1, 0, 0);
 	case REVOCO_CLICK_MODE:
-	    mx_cmd(handle, perm + 2, 0, 0);
-	    break;
+	    return mx_cmd(handle, perm + 2, 0, 0);
 	case REVOCO_MANUAL_MODE:
-	    mx_cmd(handle, perm + 7, revoco_btn * 16 + revoco_btn, 0);
-	    break;
+	    return mx_cmd(handle, perm + 7, revoco_btn * 16 + revoco_btn, 0);
 	case REVOCO_AUTO_MODE:
-	    mx_cmd(handle, perm + 5, revoco_up_scroll, revoco_down_scroll);
-	    break;
+	    return mx_cmd(handle, perm + 5, revoco_up_scroll, revoco_down_scroll);
 	default:
-	    fatal("unknown mode %d", revoco_mode);
-	    break;
+	    fatal("unknown mode %d", mode);
+	    return -1;
     }
 }
 
@@ -276,9 +361,9 @@ static void trouble_shooting(void)
   "\tBUS=\"usb\", KERNEL=\"hiddev[0-9]*\", NAME=\"usb/%k\", MODE=\"660\"\n");
 }
 
-static int revoco_check_values(void)
+static int revoco_check_values(int mode)
 {
-	switch (revoco_mode)
+	switch (mode)
 	{
 	case REVOCO_FREE_MODE:
 	    break;
@@ -327,33 +412,230 @@ void revoco_set_down_scroll(int value)
 	revoco_down_scroll = value;
 }
 
+/* The mode runtime wheel mode changes return to */
+static int revoco_base_mode(void)
+{
+    if (revoco_mode == REVOCO_DISABLED || revoco_check_values(revoco_mode) < 0)
+	return REVOCO_CLICK_MODE;
+    return revoco_mode;
+}
+
+/* Open the receiver and keep the handle for runtime mode changes */
+static int revoco_open(void)
+{
+    if (revoco_fd != -1)
+	return revoco_fd;
+
+    revoco_fd = open_indexed();
+    /* Fall back to probing the device nodes if sysfs is not available */
+    if (revoco_fd == -1)
+	revoco_fd = open_dev("/dev/usb/hiddev%d");
+    if (revoco_fd == -1)
+	revoco_fd = open_dev("/dev/hiddev%d");
+    return revoco_fd;
+}
+
 int revoco_launch(void)
 {
-    int handle;
+#if REVOCO_TEMP==1
+	int perm = 0x00;
+#else
+	int perm = 0x80;
+#endif
     
     if (revoco_mode == REVOCO_DISABLED)
     {
     	fprintf(stderr, OUT_PRE "revoco not started. Disabled in configuration.\n");
     	return 0;
     }
-    if (revoco_check_values() < 0)
+    if (revoco_check_values(revoco_mode) < 0)
     {
     	fprintf(stderr, OUT_PRE "Attempted to pass illegal values to revoco. revoco "
     					"will not be started.\n");
     	return -1;
     }
 
-    handle = open_dev("/dev/usb/hiddev%d");
-    if (handle == -1)
-	handle = open_dev("/dev/hiddev%d");
-    if (handle == -1)
+    if (revoco_open() == -1)
     {
 		trouble_shooting();
     	return -1;
     }
 
-    configure(handle);
+    configure(revoco_fd, revoco_mode, perm);
+    revoco_current = revoco_mode;
+    return 0;
+}
+
+static void revoco_close_handle(void)
+{
+    if (revoco_fd != -1)
+	close_dev(revoco_fd);
+    revoco_fd = -1;
+}
 
-    close_dev(handle);
+/* Stop the worker and close the persistent handle */
+void revoco_close(void)
+{
+    if (revoco_worker)
+    {
+	pthread_mutex_lock(&revoco_lock);
+	revoco_stop = 1;
+	pthread_cond_signal(&revoco_cond);
+	pthread_mutex_unlock(&revoco_lock);
+	pthread_join(revoco_thread, NULL);
+	revoco_worker = 0;
+	revoco_stop = 0;
+    }
+    revoco_close_handle();
+}
+
+/* Send a runtime wheel mode report */
+static void revoco_apply(int mode)
+{
+    revoco_wanted = mode;
+    if (revoco_open() != -1 && configure(revoco_fd, mode, 0x00) < 0)
+    {
+	/* Receiver gone. revoco_reopen() sends the mode again. */
+	revoco_close_handle();
+    }
+}
+
+/* Open a hiddev node that was added. If it is the receiver coming back,
+ * for example after re-enumeration, the configured wheel mode and a mode
+ * switched at runtime are applied again. devname is relative to /dev.
+ * Returns 1 if the node is the receiver. */
+static int revoco_reopen(const char *devname)
+{
+    const char *name;
+#if REVOCO_TEMP==1
+	int perm = 0x00;
+#else
+	int perm = 0x80;
+#endif
+
+    name = strrchr(devname, '/') ? strrchr(devname, '/') + 1 : devname;
+    if (!sysfs_is_revolution(name))
+	return 0;
+
+    revoco_close_handle();
+    snprintf(revoco_node, sizeof(revoco_node), "/dev/%s", devname);
+    if ((revoco_fd = open(revoco_node, O_RDWR | O_CLOEXEC)) == -1)
+    {
+	btnx_log(LOG_WARNING, OUT_PRE "Could not open %s: %s", revoco_node, strerror(errno));
+	return 1;
+    }
+
+    if (revoco_mode != REVOCO_DISABLED && revoco_check_values(revoco_mode) == 0)
+    {
+	configure(revoco_fd, revoco_mode, perm);
+	btnx_log(LOG_INFO, OUT_PRE "revoco settings applied again to %s", revoco_node);
+    }
+    if (revoco_wanted != REVOCO_DISABLED && revoco_wanted != revoco_mode)
+	revoco_apply(revoco_wanted);
+    return 1;
+}
+
+/* Start the worker thread if it is not running. Returns 0 if it cannot
+ * be started, and the caller then does the work itself. */
+static int revoco_start(void)
+{
+    if (!revoco_worker &&
+        pthread_create(&revoco_thread, NULL, revoco_main, NULL) == 0)
+	revoco_worker = 1;
+    return revoco_worker;
+}
+
+/* Worker thread. Reopens an added receiver and sends the latest requested
+ * mode. Requests made while a report is on its way are merged. */
+static void *revoco_main(void *arg)
+{
+    char added[sizeof(revoco_added)];
+    int mode;
+
+    (void) arg;
+    pthread_mutex_lock(&revoco_lock);
+    while (!revoco_stop)
+    {
+	if (revoco_send == REVOCO_INVALID_MODE && revoco_added[0] == '\0')
+	{
+	    pthread_cond_wait(&revoco_cond, &revoco_lock);
+	    continue;
+	}
+	strcpy(added, revoco_added);
+	revoco_added[0] = '\0';
+	mode = revoco_send;
+	revoco_send = REVOCO_INVALID_MODE;
+	pthread_mutex_unlock(&revoco_lock);
+	if (mode != REVOCO_INVALID_MODE)
+	    revoco_wanted = mode;
+	/* A reopened receiver gets the mode with the configured one */
+	if ((added[0] == '\0' || !revoco_reopen(added)) && mode != REVOCO_INVALID_MODE)
+	    revoco_apply(mode);
+	pthread_mutex_lock(&revoco_lock);
+    }
+    pthread_mutex_unlock(&revoco_lock);
+    return NULL;
+}
+
+/* Request a temporary wheel mode change at runtime. REVOCO_DISABLED returns
+ * to the configured mode. The report is sent by revoco_flush(), so several
+ * requests while handling one input event cost a single report. */
+int revoco_request_mode(int mode)
+{
+    if (mode == REVOCO_DISABLED)
+	mode = revoco_base_mode();
+    if (revoco_check_values(mode) < 0)
+	return -1;
+    revoco_pending = mode;
     return 0;
 }
+
+/* Returns the wheel mode in effect once pending requests are sent */
+int revoco_get_mode(void)
+{
+    if (revoco_pending != REVOCO_INVALID_MODE)
+	return revoco_pending;
+    if (revoco_current == REVOCO_DISABLED)
+	return revoco_base_mode();
+    return revoco_current;
+}
+
+/* Hand a pending wheel mode change to the worker. Called from the event
+ * loop, which does not wait for the receiver. Without a worker thread the
+ * report is sent here. */
+void revoco_flush(void)
+{
+    int mode = revoco_pending;
+
+    if (mode == REVOCO_INVALID_MODE)
+	return;
+    revoco_pending = REVOCO_INVALID_MODE;
+    if (mode == revoco_current)
+	return;
+    revoco_current = mode;
+    if (!revoco_start())
+    {
+	revoco_apply(mode);
+	return;
+    }
+    pthread_mutex_lock(&revoco_lock);
+    revoco_send = mode;
+    pthread_cond_signal(&revoco_cond);
+    pthread_mutex_unlock(&revoco_lock);
+}
+
+/* Called from the event loop when a hiddev node is added. The worker
+ * checks whether it is the receiver and reopens it. devname is relative
+ * to /dev. */
+void revoco_hotplug(const char *devname)
+{
+    if (!revoco_start())
+    {
+	(void) revoco_reopen(devname);
+	return;
+    }
+    pthread_mutex_lock(&revoco_lock);
+    snprintf(revoco_added, sizeof(revoco_added), "%s", devname);
+    pthread_cond_signal(&revoco_cond);
+    pthread_mutex_unlock(&revoco_lock);
+}
@@ -29,5 +29,12 @@ void revoco_set_down_scroll(int value);
 
 /* Execute revoco functionality */
 int revoco_launch(void);
+void revoco_hotplug(const char *devname);
+void revoco_close(void);
+
+/* Runtime wheel mode changes */
+int revoco_request_mode(int mode);
+int revoco_get_mode(void);
+void revoco_flush(void);
 
 #endif /*REVOCO_H_*/
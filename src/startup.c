@@ -0,0 +1,149 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* Runs the startup steps as a small task graph. Each task gets a thread
+ * and waits for the tasks it depends on, so that independent steps, like
+ * creating the uinput devices and opening the mouse handlers, overlap.
+ * Without threads the tasks run one after another. Tasks do not exit the
+ * daemon, a failure is returned once every thread has finished. */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "startup.h"
+#include "log.h"
+
+/* State of startup_run() */
+struct startup_t {
+	struct startup_task_t *tasks;
+	unsigned int done;			/* Bit n is set when task n is done */
+	unsigned int failed;		/* Bit n is set when task n failed or was skipped */
+	int status;					/* Of the first task that failed */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* What a task thread runs */
+struct startup_thread_t {
+	struct startup_t *s;
+	int index;
+	pthread_t thread;
+};
+
+static void startup_task(struct startup_t *s, int index);
+static void *startup_main(void *arg);
+static double startup_ms(const struct timespec *from, const struct timespec *to);
+
+/* Wait for the dependencies of a task, run it unless one of them failed,
+ * and mark it done */
+static void startup_task(struct startup_t *s, int index)
+{
+	struct startup_task_t *task = &s->tasks[index];
+	int status=0, skip;
+	
+	pthread_mutex_lock(&s->lock);
+	while ((s->done & task->deps) != task->deps)
+		pthread_cond_wait(&s->cond, &s->lock);
+	skip = (s->failed & task->deps) != 0;
+	pthread_mutex_unlock(&s->lock);
+	
+	clock_gettime(CLOCK_MONOTONIC, &task->begin);
+	if (!skip)
+		status = task->run(task->arg);
+	clock_gettime(CLOCK_MONOTONIC, &task->end);
+	
+	pthread_mutex_lock(&s->lock);
+	s->done |= 1U << index;
+	if (skip || status != 0)
+		s->failed |= 1U << index;
+	if (status != 0 && s->status == 0)
+		s->status = status;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void *startup_main(void *arg)
+{
+	struct startup_thread_t *t = (struct startup_thread_t *) arg;
+	
+	startup_task(t->s, t->index);
+	return NULL;
+}
+
+/* Run count tasks, at most STARTUP_MAX_TASKS, and return when all are
+ * done. With parallel, every task runs in its own thread as soon as its
+ * dependencies are done. A task whose thread cannot be created runs on
+ * the calling thread, in order. Returns 0, or the status of the first
+ * task that failed. */
+int startup_run(struct startup_task_t *tasks, int count, int parallel)
+{
+	struct startup_thread_t threads[STARTUP_MAX_TASKS];
+	struct startup_t s;
+	int i, started=0;
+	
+	s.tasks = tasks;
+	s.done = 0;
+	s.failed = 0;
+	s.status = 0;
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	
+	for (i=0; i<count && parallel; i++)
+	{
+		threads[i].s = &s;
+		threads[i].index = i;
+		if ((errno = pthread_create(&threads[i].thread, NULL, startup_main, &threads[i])) != 0)
+		{
+			btnx_log(LOG_WARNING, OUT_PRE "Warning: could not start the %s task: %s",
+					tasks[i].name, strerror(errno));
+			break;
+		}
+		started++;
+	}
+	for (i=started; i<count; i++)
+		startup_task(&s, i);
+	for (i=0; i<started; i++)
+		pthread_join(threads[i].thread, NULL);
+	
+	pthread_cond_destroy(&s.cond);
+	pthread_mutex_destroy(&s.lock);
+	return s.status;
+}
+
+static double startup_ms(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+/* Log when each task ran, and the time all of them took compared with the
+ * time they would take one after another */
+void startup_report(const struct startup_task_t *tasks, int count)
+{
+	struct timespec first, last;
+	double total=0.0;
+	int i;
+	
+	if (count == 0)
+		return;
+	first = tasks[0].begin;
+	last = tasks[0].end;
+	for (i=0; i<count; i++)
+	{
+		if (startup_ms(&tasks[i].begin, &first) > 0.0)
+			first = tasks[i].begin;
+		if (startup_ms(&last, &tasks[i].end) > 0.0)
+			last = tasks[i].end;
+		total += startup_ms(&tasks[i].begin, &tasks[i].end);
+	}
+	/* One line per task, past the rate limit of btnx_log() */
+	for (i=0; i<count; i++)
+		daemon_log(LOG_INFO, OUT_PRE "startup task: %-10s %8.3f ms - %8.3f ms", tasks[i].name,
+				startup_ms(&first, &tasks[i].begin), startup_ms(&first, &tasks[i].end));
+	daemon_log(LOG_INFO, OUT_PRE "startup tasks: %.3f ms, %.3f ms one after another",
+			startup_ms(&first, &last), total);
+}
@@ -0,0 +1,28 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef STARTUP_H_
+#define STARTUP_H_
+
+#include <time.h>
+
+#define STARTUP_MAX_TASKS	16
+
+/* A startup step. It runs once the tasks it depends on are done, and is
+ * skipped if one of them failed. run returns 0, or the exit status of the
+ * daemon if the step failed. */
+struct startup_task_t {
+	const char *name;
+	int (*run)(void *arg);
+	void *arg;
+	unsigned int deps;			/* Bit n waits for task n, an earlier task */
+	struct timespec begin;		/* When it ran, set by startup_run() */
+	struct timespec end;
+};
+
+int startup_run(struct startup_task_t *tasks, int count, int parallel);
+void startup_report(const struct startup_task_t *tasks, int count);
+
+#endif /*STARTUP_H_*/
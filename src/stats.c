@@ -0,0 +1,131 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "btnx.h"
+#include "stats.h"
+#include "chatter.h"
+
+struct btnx_stats btnx_stats;
+
+/* Clear all counters of a block */
+void stats_reset(struct btnx_stats *stats) {
+	unsigned long depth = stats->queue_depth;
+	
+	memset(stats, 0, sizeof(*stats));
+	/* A level, not a counter */
+	stats->queue_depth = depth;
+}
+
+/* Record the latency between an input event's kernel timestamp and now */
+void stats_latency(struct btnx_stats *stats, const struct timeval *event_time,
+                   const struct timeval *now) {
+	long long diff;
+	unsigned long lat;
+	int bucket;
+	
+	if (event_time->tv_sec == 0 && event_time->tv_usec == 0)
+		return;
+	
+	diff = (long long)(now->tv_sec - event_time->tv_sec) * 1000000 +
+		(now->tv_usec - event_time->tv_usec);
+	if (diff < 0)
+		return; /* Clock was stepped */
+	lat = (unsigned long) diff;
+	
+	if (stats->lat_count == 0 || lat < stats->lat_min)
+		stats->lat_min = lat;
+	if (lat > stats->lat_max)
+		stats->lat_max = lat;
+	stats->lat_count++;
+	stats->lat_total += lat;
+	
+	for (bucket = 0; bucket < STATS_LATENCY_BUCKETS - 1; bucket++) {
+		if (lat < (1UL << bucket))
+			break;
+	}
+	stats->lat_hist[bucket]++;
+}
+
+/* Write the counters, and the thresholds of a chatter filter, as "name
+ * value" lines into buf. Returns the number of characters written, not
+ * counting the terminating null. */
+int stats_format(const struct btnx_stats *stats, const struct chatter_t *chatter,
+                 char *buf, int size) {
+	int len, i;
+	unsigned long avg=0;
+	
+	if (stats->lat_count > 0)
+		avg = (unsigned long)(stats->lat_total / stats->lat_count);
+	
+	len = snprintf(buf, size,
+			"events_read %lu\n"
+			"events_dropped %lu\n"
+			"events_matched %lu\n"
+			"events_debounced %lu\n"
+			"events_suspended %lu\n"
+			"events_chattered %lu\n"
+			"events_sent %lu\n"
+			"writes_suppressed %lu\n"
+			"writes_queued %lu\n"
+			"writes_dropped %lu\n"
+			"queue_depth %lu\n"
+			"queue_max %lu\n"
+			"commands %lu\n"
+			"wheel_coalesced %lu\n"
+			"strokes %lu\n"
+			"strokes_unmatched %lu\n"
+			"events_passed %lu\n"
+			"motion_frames %lu\n"
+			"log_dropped %lu\n"
+			"log_suppressed %lu\n"
+			"latency_count %lu\n"
+			"latency_min_us %lu\n"
+			"latency_avg_us %lu\n"
+			"latency_max_us %lu\n",
+			stats->events_read,
+			stats->events_dropped,
+			stats->events_matched,
+			stats->events_debounced,
+			stats->events_suspended,
+			stats->events_chattered,
+			stats->events_sent,
+			stats->writes_suppressed,
+			stats->writes_queued,
+			stats->writes_dropped,
+			stats->queue_depth,
+			stats->queue_max,
+			stats->commands,
+			stats->wheel_coalesced,
+			stats->strokes,
+			stats->strokes_unmatched,
+			stats->events_passed,
+			stats->motion_frames,
+			stats->log_dropped,
+			stats->log_suppressed,
+			stats->lat_count,
+			stats->lat_min,
+			avg,
+			stats->lat_max);
+	
+	for (i = 0; i < STATS_LATENCY_BUCKETS && len < size; i++) {
+		if (i < STATS_LATENCY_BUCKETS - 1)
+			len += snprintf(buf + len, size - len, "latency_lt_%luus %lu\n",
+					1UL << i, stats->lat_hist[i]);
+		else
+			len += snprintf(buf + len, size - len, "latency_ge_%luus %lu\n",
+					1UL << (i - 1), stats->lat_hist[i]);
+	}
+	/* The per button thresholds, the histograms are too long */
+	if (len < size)
+		len += chatter_format(chatter, buf + len, size - len, 0);
+	
+	if (len >= size)
+		len = size - 1;
+	return len;
+}
@@ -0,0 +1,66 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <sys/time.h>
+
+#include "chatter.h"
+
+/* Number of latency histogram buckets. Bucket n counts latencies below
+ * 2^n microseconds, the last bucket counts everything slower. */
+#define STATS_LATENCY_BUCKETS	16
+
+#define STATS_COUNTERS		24		/* Counter lines of stats_format() before the histogram */
+#define STATS_LINE_SIZE		64		/* Longest line of stats_format() */
+
+/* Room stats_format() needs, with the chatter thresholds */
+#define STATS_FORMAT_SIZE	((STATS_COUNTERS + STATS_LATENCY_BUCKETS) * STATS_LINE_SIZE + \
+		CHATTER_BUTTONS * 2 * CHATTER_LINE_SIZE + 1)
+
+/* Runtime counters, reported through the control socket */
+struct btnx_stats {
+	unsigned long events_read;		/* Events read from the event handlers */
+	unsigned long events_dropped;	/* SYN_DROPPED overflows, each followed by a resync */
+	unsigned long events_matched;	/* Events that matched an enabled binding */
+	unsigned long events_debounced;	/* Events rejected by check_delay() */
+	unsigned long events_suspended;	/* Events of bindings disabled at runtime */
+	unsigned long events_chattered;	/* Switch bounces dropped by the chatter filter */
+	unsigned long events_sent;		/* Events sent to uinput */
+	unsigned long writes_suppressed;	/* uinput writes left out, the keys were in that state */
+	unsigned long writes_queued;	/* uinput frames that waited for the fd to take writes */
+	unsigned long writes_dropped;	/* uinput frames lost to a full queue or a write error */
+	unsigned long queue_depth;		/* uinput frames waiting now */
+	unsigned long queue_max;		/* Most uinput frames ever waiting */
+	unsigned long commands;			/* Command executions */
+	unsigned long wheel_coalesced;	/* Wheel steps merged into another write */
+	unsigned long strokes;			/* Mouse strokes that ran a binding */
+	unsigned long strokes_unmatched;	/* Mouse strokes that matched no binding */
+	unsigned long events_passed;	/* Unbound events of grabbed handlers passed on */
+	unsigned long motion_frames;	/* Writes of passed or transformed motion */
+	unsigned long log_dropped;		/* Log records lost to a full ring */
+	unsigned long log_suppressed;	/* Log records held back by rate limiting */
+	
+	/* Latency from the kernel event timestamp to the uinput write, in
+	 * microseconds */
+	unsigned long lat_count;
+	unsigned long lat_min;
+	unsigned long lat_max;
+	unsigned long long lat_total;
+	unsigned long lat_hist[STATS_LATENCY_BUCKETS];
+};
+
+/* The counters of the daemon. An engine counts into the block given to
+ * engine_init(). */
+extern struct btnx_stats btnx_stats;
+
+void stats_reset(struct btnx_stats *stats);
+void stats_latency(struct btnx_stats *stats, const struct timeval *event_time,
+                   const struct timeval *now);
+int stats_format(const struct btnx_stats *stats, const struct chatter_t *chatter,
+                 char *buf, int size);
+
+#endif /*STATS_H_*/
@@ -9,6 +9,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,175 +18,551 @@
 
 #include "uinput.h"
 #include "btnx.h"
+#include "uring.h"
+#include "evdev.h"
+#include "frame.h"
+#include "stats.h"
+#include "log.h"
 
 #define BTNX_VENDOR			0xB216
 #define BTNX_PRODUCT_MOUSE	0x0001
 #define BTNX_PRODUCT_KBD	0x0002
 
+#define UINPUT_SET_BIT(array, bit)	((array)[(bit)/8] |= (1 << ((bit)%8)))
+#define UINPUT_TEST_BIT(array, bit)	((array)[(bit)/8] & (1 << ((bit)%8)))
+#define UINPUT_CLEAR_BIT(array, bit)	((array)[(bit)/8] &= ~(1 << ((bit)%8)))
+
+/* Capabilities of a uinput device */
+struct uinput_caps_t {
+	int needed;						/* Device is used by the configuration */
+	int rel_wheel;					/* Sends REL_WHEEL */
+	int rel_hwheel;					/* Sends REL_HWHEEL */
+	unsigned char keys[KEY_MAX/8 + 1];	/* Key and button codes */
+};
+
+/* A frame waiting for its device to take writes */
+struct uinput_frame_t {
+	int count;
+	int pause;
+	struct input_event ev[FRAME_EVENTS];
+};
+
+/* Frames of a device that could not be written yet, oldest first */
+struct uinput_queue_t {
+	unsigned int head;
+	unsigned int count;
+	unsigned int back;				/* Frames of a failed chain put back in front */
+	struct uinput_frame_t frame[UINPUT_QUEUE_SIZE];
+};
+
 /* Static variables */
-static int uinput_mouse_fd = -1;
-static int uinput_kbd_fd = -1;
+static int uinput_fds[UINPUT_DEVICES] = {-1, -1};
+static unsigned char uinput_held[UINPUT_DEVICES][KEY_MAX/8 + 1];	/* Keys btnx holds down */
+static struct uinput_queue_t uinput_queue[UINPUT_DEVICES];
+
+static int uinput_write_events(int dev, const struct input_event *ev, int count,
+                               int pause);
+static void uinput_untrack(int dev, const struct input_event *ev, int count);
+static int uinput_try(int dev, const struct input_event *ev, int count, int pause);
+static int uinput_send(int dev, const struct input_event *ev, int count, int pause);
+static void uinput_enqueue(int dev, const struct input_event *ev, int count, int pause);
+static void uinput_requeue(int dev, const struct input_event *ev, int count, int pause);
+static void uinput_flush_dev(int dev);
+
+/* Collect the codes the configuration can send to each device */
+static void uinput_collect_codes(btnx_config *cfg, struct device_fds_t *dev_fds,
+                                 struct uinput_caps_t *mouse, struct uinput_caps_t *kbd)
+{
+	const unsigned char *caps;
+	int i, j, kc;
+	btnx_event *bev;
+	
+	memset(mouse, 0, sizeof(*mouse));
+	memset(kbd, 0, sizeof(*kbd));
+	
+	/* A grabbed handler reaches the system through the mouse device, with
+	 * its buttons and keys, motion and wheels */
+	if (cfg->grab)
+	{
+		for (kc = BTN_LEFT; kc <= BTN_TASK; kc++)
+			UINPUT_SET_BIT(mouse->keys, kc);
+		for (i=0; dev_fds != NULL && i < dev_fds->count; i++)
+		{
+			if (dev_fds->evdev[i] == NULL || !evdev_grabbed(dev_fds->evdev[i]))
+				continue;
+			caps = evdev_caps(dev_fds->evdev[i]);
+			for (j=0; j < (int) sizeof(mouse->keys); j++)
+				mouse->keys[j] |= caps[j];
+		}
+		mouse->rel_wheel = 1;
+		mouse->rel_hwheel = 1;
+		mouse->needed = 1;
+	}
+	
+	for (i=0; i < cfg->count; i++)
+	{
+		if (!(cfg->hot[i].enabled & BINDING_ENABLED))
+			continue;
+		bev = &cfg->cold[i];
+		kc = bev->keycode;
+		if (kc == REL_WHEELFORWARD || kc == REL_WHEELBACK)
+		{
+			mouse->rel_wheel = 1;
+			mouse->needed = 1;
+		}
+		else if (kc > KEY_RESERVED && kc < KEY_MAX)
+		{
+			if (frame_kbd_code(kc))
+			{
+				UINPUT_SET_BIT(kbd->keys, kc);
+				kbd->needed = 1;
+			}
+			else
+			{
+				UINPUT_SET_BIT(mouse->keys, kc);
+				mouse->needed = 1;
+			}
+		}
+		/* Modifiers are always sent through the keyboard device */
+		for (j=0; j<MAX_MODS; j++)
+		{
+			if (bev->mod[j] > KEY_RESERVED && bev->mod[j] < KEY_MAX)
+			{
+				UINPUT_SET_BIT(kbd->keys, bev->mod[j]);
+				kbd->needed = 1;
+			}
+		}
+	}
+}
+
+/* Set the device name and IDs, with UI_DEV_SETUP if the kernel supports it */
+static void uinput_setup_dev(int fd, const char *name, int product)
+{
+	struct uinput_user_dev dev;
+	
+#ifdef UI_DEV_SETUP
+	struct uinput_setup setup;
+	
+	memset(&setup, 0, sizeof(setup));
+	setup.id.bustype = 0;
+	setup.id.vendor = BTNX_VENDOR;
+	setup.id.product = product;
+	setup.id.version = 0;
+	strncpy(setup.name, name, UINPUT_MAX_NAME_SIZE - 1);
+	if (ioctl(fd, UI_DEV_SETUP, &setup) == 0)
+		return;
+#endif
+	/* Kernels older than 4.5 */
+	memset(&dev, 0, sizeof(dev));
+	dev.id.bustype = 0;
+	dev.id.vendor = BTNX_VENDOR;
+	dev.id.product = product;
+	dev.id.version = 0;
+	strncpy(dev.name, name, UINPUT_MAX_NAME_SIZE - 1);
+	write(fd, &dev, sizeof(dev));
+}
+
+/* Open a uinput device and create it with the given key bits */
+static int uinput_create(const char *name, int product, struct uinput_caps_t *caps,
+                         int is_kbd)
+{
+	int fd, i;
+	
+	fd = open_handler("uinput", O_WRONLY | O_NDELAY | O_CLOEXEC);
+	if (fd < 0) 
+	{
+		perror(	OUT_PRE "Error opening the uinput device.\n"
+				OUT_PRE "Make sure you have loaded the uinput module (modprobe uinput)");
+		return -1;
+	}
+	
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	if (is_kbd)
+		ioctl(fd, UI_SET_EVBIT, EV_REP);
+	else
+	{
+		ioctl(fd, UI_SET_EVBIT, EV_REL);
+		ioctl(fd, UI_SET_RELBIT, REL_X);
+		ioctl(fd, UI_SET_RELBIT, REL_Y);
+		if (caps->rel_wheel)
+			ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+		if (caps->rel_hwheel)
+			ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+	}
+	for (i=0; i<KEY_MAX; i++)
+	{
+		if (UINPUT_TEST_BIT(caps->keys, i))
+			ioctl(fd, UI_SET_KEYBIT, i);
+	}
+	
+	uinput_setup_dev(fd, name, product);
+	ioctl(fd, UI_DEV_CREATE, 0);
+	
+	return fd;
+}
 
 /*
  * uinput_init() function partially derived from Micah Dowty's uinput_mouse.c
  * <http://svn.navi.cx/misc/trunk/vision/lib/uinput_mouse.c>
  */
-/* Open and init uinput file descriptors */
-int uinput_init(void) 
+/* Open and init uinput file descriptors. Only the devices and codes that
+ * the configuration can send are created, which keeps device creation
+ * cheap and lets udev and the input stack classify the devices quickly.
+ * The mouse device also has the codes of the handlers of dev_fds that
+ * are grabbed. */
+int uinput_init(btnx_config *cfg, struct device_fds_t *dev_fds) 
 {
-  struct uinput_user_dev dev_mouse, dev_kbd;
-  int i;
+  struct uinput_caps_t caps_mouse, caps_kbd;
 
-  uinput_mouse_fd = open_handler("uinput", O_WRONLY | O_NDELAY);
-  if (uinput_mouse_fd < 0) 
-  {
-    perror(	OUT_PRE "Error opening the uinput device.\n"
-    		OUT_PRE "Make sure you have loaded the uinput module (modprobe uinput)");
-    exit(BTNX_ERROR_OPEN_UINPUT);
-  }
-  uinput_kbd_fd = open_handler("uinput", O_WRONLY | O_NDELAY);
-  if (uinput_kbd_fd < 0) 
-  {
-    perror(OUT_PRE "Error opening the uinput device");
-    exit(BTNX_ERROR_OPEN_UINPUT);
-  }
-
-  memset(&dev_mouse, 0, sizeof(dev_mouse));
-  dev_mouse.id.bustype = 0;
-  dev_mouse.id.vendor = BTNX_VENDOR;
-  dev_mouse.id.product = BTNX_PRODUCT_MOUSE;
-  dev_mouse.id.version = 0;
-  strcpy(dev_mouse.name, UMOUSE_NAME);
-  write(uinput_mouse_fd, &dev_mouse, sizeof(dev_mouse));
+  uinput_collect_codes(cfg, dev_fds, &caps_mouse, &caps_kbd);
   
-  memset(&dev_kbd, 0, sizeof(dev_kbd));
-  dev_kbd.id.bustype = 0;
-  dev_kbd.id.vendor = BTNX_VENDOR;
-  dev_kbd.id.product = BTNX_PRODUCT_KBD;
-  dev_kbd.id.version = 0;
-  strcpy(dev_kbd.name, UKBD_NAME);
-  write(uinput_kbd_fd, &dev_kbd, sizeof(dev_kbd));
-
-  ioctl(uinput_mouse_fd, UI_SET_EVBIT, EV_REL);
-  ioctl(uinput_mouse_fd, UI_SET_RELBIT, REL_X);
-  ioctl(uinput_mouse_fd, UI_SET_RELBIT, REL_Y);
-  ioctl(uinput_mouse_fd, UI_SET_RELBIT, REL_WHEEL);
-  ioctl(uinput_mouse_fd, UI_SET_EVBIT, EV_KEY);
+  if (caps_kbd.needed &&
+      (uinput_fds[UINPUT_DEV_KBD] = uinput_create(UKBD_NAME, BTNX_PRODUCT_KBD, &caps_kbd, 1)) < 0)
+    return -1;
   
-  for (i=BTN_MISC; i<KEY_OK; i++)
-  {
-  	ioctl(uinput_mouse_fd, UI_SET_KEYBIT, i);
-  }
-   
-  ioctl(uinput_kbd_fd, UI_SET_EVBIT, EV_KEY);
-  ioctl(uinput_kbd_fd, UI_SET_EVBIT, EV_REP);
-  for (i=0; i<BTN_MISC; i++)
-  {
-  	ioctl(uinput_kbd_fd, UI_SET_KEYBIT, i);
-  }
-  for (i=KEY_OK; i<KEY_MAX; i++)
+  if (caps_mouse.needed)
   {
-  	ioctl(uinput_kbd_fd, UI_SET_KEYBIT, i);
+    /* REL_X, REL_Y and BTN_LEFT make the device classify as a mouse */
+    UINPUT_SET_BIT(caps_mouse.keys, BTN_LEFT);
+    if ((uinput_fds[UINPUT_DEV_MOUSE] = uinput_create(UMOUSE_NAME, BTNX_PRODUCT_MOUSE, &caps_mouse, 0)) < 0)
+      return -1;
   }
-  
-  ioctl(uinput_kbd_fd, UI_DEV_CREATE, 0);
-  ioctl(uinput_mouse_fd, UI_DEV_CREATE, 0);
 
   return 0;
 }
 
-void uinput_close(void) {
-	if (uinput_mouse_fd > -1)
-		close(uinput_mouse_fd);
-	if (uinput_kbd_fd > -1)
-		close(uinput_kbd_fd);
+/* Write both devices to a file such as /dev/null, to run the output path
+ * without creating devices, e.g. for btnx-check-alloc. The file is opened
+ * like the devices, writes do not block. */
+int uinput_init_file(const char *path)
+{
+	int i;
+	
+	for (i=0; i<UINPUT_DEVICES; i++)
+	{
+		if ((uinput_fds[i] = open(path, O_WRONLY | O_NDELAY | O_CLOEXEC)) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* The fd of a device, -1 if it is not open */
+int uinput_fd(int dev)
+{
+	return uinput_fds[dev];
+}
+
+/* Write frame events to a device. Key events that would not change the
+ * state of the key are left out, and so are reports that end up empty.
+ * The held keys are updated for the frame; if it is dropped instead of
+ * written or queued, the drop undoes that. Returns the number of events
+ * written. */
+static int uinput_write_events(int dev, const struct input_event *ev, int count,
+                               int pause)
+{
+	struct input_event out[FRAME_EVENTS];
+	int i, n=0, report=0;
+	
+	if (uinput_fds[dev] < 0)
+		return 0;
+	for (i=0; i<count && i<FRAME_EVENTS; i++)
+	{
+		if (ev[i].type == EV_SYN)
+		{
+			if (report == 0)
+				continue;
+			report = 0;
+		}
+		else if (ev[i].type == EV_KEY && ev[i].code <= KEY_MAX && ev[i].value != 2)
+		{
+			if ((UINPUT_TEST_BIT(uinput_held[dev], ev[i].code) != 0) == (ev[i].value != 0))
+				continue;
+			if (ev[i].value)
+				UINPUT_SET_BIT(uinput_held[dev], ev[i].code);
+			else
+				UINPUT_CLEAR_BIT(uinput_held[dev], ev[i].code);
+			report++;
+		}
+		else
+			report++;
+		out[n++] = ev[i];
+	}
+	if (n == 0)
+	{
+		btnx_stats.writes_suppressed++;
+		return 0;
+	}
+	
+	/* Behind queued frames, the frame has to wait its turn */
+	if (uinput_queue[dev].count > 0)
+		uinput_enqueue(dev, out, n, pause);
+	else if (uinput_send(dev, out, n, pause) < 0)
+		return 0;
+	return n;
 }
 
-/* Send any necessary modifier keys */
-static void uinput_send_mods(struct btnx_event *bev, struct input_event event) {
+/* Undo the changes of the held keys made by events that were dropped,
+ * latest first. Each key event of a frame changed the state of its key. */
+static void uinput_untrack(int dev, const struct input_event *ev, int count)
+{
 	int i;
-	int mod_pressed=0;
 	
-	for (i=0; i<MAX_MODS; i++)
+	for (i=count-1; i>=0; i--)
 	{
-		if (bev->mod[i] == 0)
+		if (ev[i].type != EV_KEY || ev[i].code > KEY_MAX || ev[i].value == 2)
 			continue;
-			
-		event.type = EV_KEY;
-		event.code = bev->mod[i];
-		event.value = bev->pressed;
-		write(uinput_kbd_fd, &event, sizeof(event));
-		
-		event.type = EV_SYN;
-  		event.code = SYN_REPORT;
-  		event.value = 0;
-  		write(uinput_kbd_fd, &event, sizeof(event));
-  		
-  		mod_pressed = 1;
-	}
-	
-	if (mod_pressed)
-	    usleep(200);    /* Needs a little delay for mouse + modifier combo */
-}
-
-/* Send the main key or button press/release */
-static void uinput_send_key(struct btnx_event *bev, struct input_event event, int fd) {
-	if (bev->keycode > BTNX_EXTRA_EVENTS)
-	{
-		event.type = EV_REL;
-		
-		if (bev->keycode == REL_WHEELFORWARD || bev->keycode == REL_WHEELBACK)
-			event.code = REL_WHEEL;
-		
-		if (bev->keycode == REL_WHEELFORWARD)
-			event.value = 1;
-		else if (bev->keycode == REL_WHEELBACK)
-			event.value = -1;
-		write(fd, &event, sizeof(event));
+		if (ev[i].value)
+			UINPUT_CLEAR_BIT(uinput_held[dev], ev[i].code);
+		else
+			UINPUT_SET_BIT(uinput_held[dev], ev[i].code);
 	}
-	else
+}
+
+/* Write a frame. Returns the number of events the fd took, which is 0 if
+ * it does not take writes right now, or -1 if the device rejects the
+ * frame, which is then dropped. uinput takes whole events. With io_uring
+ * the frame is taken once it is queued to the ring, and not taken while
+ * the writes queued before are in flight. */
+static int uinput_try(int dev, const struct input_event *ev, int count, int pause)
+{
+	ssize_t len;
+	int ret;
+	
+	if (uring_active())
 	{
-		event.type = EV_KEY;
-		event.code = bev->keycode;
-		event.value = bev->pressed;
-		write(fd, &event, sizeof(event));
+		ret = uring_write(uinput_fds[dev], ev, count * sizeof(*ev),
+		                  pause ? UINPUT_MOD_PAUSE : 0);
+		if (ret >= 0)
+			return (ret == 0) ? count : 0;
+		btnx_stats.writes_dropped++;
+		uinput_untrack(dev, ev, count);
+		return -1;
 	}
+	if (pause)
+		usleep(UINPUT_MOD_PAUSE);
+	if ((len = write(uinput_fds[dev], ev, count * sizeof(*ev))) >= 0)
+		return len / sizeof(*ev);
+	if (errno == EAGAIN)
+		return 0;
+	btnx_stats.writes_dropped++;
+	btnx_log(LOG_WARNING, OUT_PRE "Warning: uinput write failed: %s", strerror(errno));
+	uinput_untrack(dev, ev, count);
+	return -1;
+}
+
+/* Write a frame. If the fd does not take all of it, the rest is queued
+ * until the fd becomes writable, so that a frame never goes out in part.
+ * A frame the device rejects is dropped whole, and -1 returned. */
+static int uinput_send(int dev, const struct input_event *ev, int count, int pause)
+{
+	int n;
 	
-	event.type = EV_SYN;
-  	event.code = SYN_REPORT;
-  	event.value = 0;
-  	write(fd, &event, sizeof(event));
+	if ((n = uinput_try(dev, ev, count, pause)) < 0 || n == count)
+		return n;
+	uinput_enqueue(dev, ev + n, count - n, pause && n == 0);
+	return n;
 }
 
-/* Send a key combo event, either press or release */
-void uinput_key_press(struct btnx_event *bev)
+/* Queue a frame behind the others of a device. A full queue drops it. */
+static void uinput_enqueue(int dev, const struct input_event *ev, int count, int pause)
 {
-	struct input_event event;
-	int fd;
+	struct uinput_queue_t *q = &uinput_queue[dev];
+	struct uinput_frame_t *f;
+	
+	if (q->count == UINPUT_QUEUE_SIZE)
+	{
+		btnx_stats.writes_dropped++;
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: uinput queue full, frame dropped.");
+		uinput_untrack(dev, ev, count);
+		return;
+	}
+	f = &q->frame[(q->head + q->count++) & (UINPUT_QUEUE_SIZE - 1)];
+	f->count = count;
+	f->pause = pause;
+	memcpy(f->ev, ev, count * sizeof(*ev));
+	btnx_stats.writes_queued++;
+	if (++btnx_stats.queue_depth > btnx_stats.queue_max)
+		btnx_stats.queue_max = btnx_stats.queue_depth;
+}
 
-	if (uinput_mouse_fd < 0 || uinput_kbd_fd < 0)
+/* Put a frame of a failed io_uring chain back in front of the frames
+ * queued after the chain was written, behind the frames of the chain put
+ * back before it. A full queue drops it. */
+static void uinput_requeue(int dev, const struct input_event *ev, int count, int pause)
+{
+	struct uinput_queue_t *q = &uinput_queue[dev];
+	struct uinput_frame_t *f;
+	unsigned int i, mask = UINPUT_QUEUE_SIZE - 1;
+	
+	if (q->count == UINPUT_QUEUE_SIZE)
 	{
-		daemon_log(LOG_WARNING, OUT_PRE "Warning: uinput_fd not valid");
+		btnx_stats.writes_dropped++;
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: uinput queue full, frame dropped.");
+		uinput_untrack(dev, ev, count);
 		return;
 	}
+	q->head = (q->head - 1) & mask;
+	q->count++;
+	for (i=0; i<q->back; i++)
+		q->frame[(q->head + i) & mask] = q->frame[(q->head + i + 1) & mask];
+	f = &q->frame[(q->head + q->back++) & mask];
+	f->count = count;
+	f->pause = pause;
+	memcpy(f->ev, ev, count * sizeof(*ev));
+	btnx_stats.writes_queued++;
+	if (++btnx_stats.queue_depth > btnx_stats.queue_max)
+		btnx_stats.queue_max = btnx_stats.queue_depth;
+}
+
+/* Write the queued frames of a device in order, until the fd stops
+ * taking them. A frame taken in part keeps the rest in front. */
+static void uinput_flush_dev(int dev)
+{
+	struct uinput_queue_t *q = &uinput_queue[dev];
+	struct uinput_frame_t *f;
+	int n;
 	
-	if ((bev->keycode <= KEY_UNKNOWN || bev->keycode >= KEY_OK) && bev->keycode < BTNX_EXTRA_EVENTS)
-		fd = uinput_kbd_fd;
-	else
-		fd = uinput_mouse_fd;
-		
-	gettimeofday(&event.time, NULL);
+	/* Frames put back are written again now, a chain that fails from
+	 * here on puts its own frames back */
+	q->back = 0;
+	while (q->count > 0)
+	{
+		f = &q->frame[q->head];
+		if (uinput_fds[dev] >= 0 &&
+		    (n = uinput_try(dev, f->ev, f->count, f->pause)) >= 0 && n < f->count)
+		{
+			memmove(f->ev, f->ev + n, (f->count - n) * sizeof(f->ev[0]));
+			f->count -= n;
+			f->pause = f->pause && n == 0;
+			return;
+		}
+		q->head = (q->head + 1) & (UINPUT_QUEUE_SIZE - 1);
+		q->count--;
+		btnx_stats.queue_depth--;
+	}
+}
+
+/* A write queued to io_uring failed after uinput_write_events() took it.
+ * The fds do not block, a frame the device did not take now waits in the
+ * queue like one write() did not take. The writes behind it in its chain
+ * were cancelled and follow it there, ahead of the frames queued since.
+ * Any other error drops the frame, and the key state changes it made. */
+void uinput_write_failed(int fd, const void *buf, size_t len, int pause, int error)
+{
+	const struct input_event *ev = (const struct input_event *) buf;
+	int i, count = len / sizeof(*ev);
+	
+	for (i=0; i<UINPUT_DEVICES; i++)
+	{
+		if (uinput_fds[i] != fd || fd < 0)
+			continue;
+		if (error == EAGAIN || error == ECANCELED)
+		{
+			uinput_requeue(i, ev, count, pause);
+			return;
+		}
+		uinput_untrack(i, ev, count);
+	}
+	btnx_stats.writes_dropped++;
+	btnx_log(LOG_WARNING, OUT_PRE "Warning: uinput write failed: %s", strerror(error));
+}
+
+/* Add the uinput fds with queued frames to the fds to watch for
+ * writability. Returns the number of fds added. While io_uring writes are
+ * in flight, their completion wakes the loop instead, and the queue waits
+ * behind them. */
+int uinput_fill_fds(fd_set *fds, int *max_fd)
+{
+	int i, count=0;
 	
-	/* If button is pressed, send modifiers first and then the main key.
-	 * If button is released, release main key first and then the modifiers. */
-	if (bev->pressed) {
-		uinput_send_mods(bev, event);
-		uinput_send_key(bev, event, fd);
+	if (uring_active() && uring_writing())
+		return 0;
+	for (i=0; i<UINPUT_DEVICES; i++)
+	{
+		if (uinput_queue[i].count == 0 || uinput_fds[i] < 0)
+			continue;
+		FD_SET(uinput_fds[i], fds);
+		if (uinput_fds[i] > *max_fd)
+			*max_fd = uinput_fds[i];
+		count++;
 	}
-	else {
-		uinput_send_key(bev, event, fd);
-		uinput_send_mods(bev, event);
+	return count;
+}
+
+/* Write the queued frames of the fds that became writable. Returns the
+ * number of such fds. */
+int uinput_flush(fd_set *fds)
+{
+	int i, count=0;
+	
+	for (i=0; i<UINPUT_DEVICES; i++)
+	{
+		if (uinput_fds[i] < 0 || !FD_ISSET(uinput_fds[i], fds))
+			continue;
+		uinput_flush_dev(i);
+		count++;
 	}
+	return count;
+}
+
+/* Send a frame built by frame_compile(). The pause only separates the
+ * second write from a first one that went out. */
+void uinput_submit(const btnx_frame *frame)
+{
+	int written=0;
+	
+	if (frame->count[0] > 0)
+		written = uinput_write_events(frame->dev[0], frame->ev, frame->count[0], 0);
+	if (frame->count[1] > 0)
+		uinput_write_events(frame->dev[1], &frame->ev[frame->count[0]], frame->count[1],
+		                    frame->pause && written > 0);
 }
 
+/* Release every key btnx holds down, e.g. before the devices go away or
+ * when a grabbed handler is lost. Each device gets one report, more only
+ * if more keys are held than fit in a frame. */
+void uinput_release_all(void)
+{
+	struct input_event ev[FRAME_EVENTS];
+	int dev, code, n;
+	
+	memset(ev, 0, sizeof(ev));
+	for (dev=0; dev<UINPUT_DEVICES; dev++)
+	{
+		n = 0;
+		for (code=0; code<=KEY_MAX; code++)
+		{
+			if (!UINPUT_TEST_BIT(uinput_held[dev], code))
+				continue;
+			ev[n].type = EV_KEY;
+			ev[n].code = code;
+			if (++n < FRAME_EVENTS - 1)
+				continue;
+			ev[n].type = EV_SYN;
+			ev[n].code = SYN_REPORT;
+			uinput_write_events(dev, ev, n + 1, 0);
+			n = 0;
+		}
+		if (n == 0)
+			continue;
+		ev[n].type = EV_SYN;
+		ev[n].code = SYN_REPORT;
+		uinput_write_events(dev, ev, n + 1, 0);
+	}
+}
 
+/* Release the held keys and close the devices */
+void uinput_close(void) {
+	int i;
+	
+	uinput_release_all();
+	for (i=0; i<UINPUT_DEVICES; i++)
+	{
+		/* Last try for the queued frames, then they are gone */
+		uinput_flush_dev(i);
+		if (uinput_fds[i] > -1)
+			close(uinput_fds[i]);
+		uinput_fds[i] = -1;
+		uinput_flush_dev(i);
+	}
+}
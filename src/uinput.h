@@ -7,15 +7,32 @@
 #ifndef UINPUT_H_
 #define UINPUT_H_
 
+#include <sys/select.h>
+
 #include "btnx.h"
+#include "device.h"
+#include "frame.h"
 
 #define UMOUSE_NAME		"btnx mouse"
 #define UKBD_NAME		"btnx keyboard"
 #define UINPUT_LOCATION	"/dev/input/uinput"
 
+/* Pause between modifiers and a mouse event in microseconds */
+#define UINPUT_MOD_PAUSE	200
+
+/* Frames queued per device while its fd does not take writes, a power
+ * of 2 */
+#define UINPUT_QUEUE_SIZE	64
+
 
-int uinput_init(void);
+int uinput_init(btnx_config *cfg, struct device_fds_t *dev_fds);
+int uinput_init_file(const char *path);
+int uinput_fd(int dev);
 void uinput_close(void);
-void uinput_key_press(btnx_event *bev);
+void uinput_submit(const btnx_frame *frame);
+void uinput_release_all(void);
+int uinput_fill_fds(fd_set *fds, int *max_fd);
+int uinput_flush(fd_set *fds);
+void uinput_write_failed(int fd, const void *buf, size_t len, int pause, int error);
 
 #endif /*UINPUT_H_*/
@@ -0,0 +1,589 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+/* io_uring event loop, selected with -u. Every event handler has a poll
+ * linked to a read into its evdev buffer in flight, the other fds have a
+ * poll in flight, and uinput frames are queued as a chain of writes. One
+ * io_uring_enter() then submits the output of the previous events, re-arms
+ * the reads and sleeps until the next event. Falls back to select() when
+ * the kernel has no usable io_uring. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <libdaemon/dlog.h>
+
+#include "btnx.h"
+#include "uring.h"
+#include "log.h"
+#include "uinput.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+
+#include "evdev.h"
+#include "realtime.h"
+
+/* user_data of a request: what it is in the high word, the fd in the low */
+#define URING_DATA(tag, fd)		(((__u64) (tag) << 32) | (unsigned int) (fd))
+#define URING_TAG(data)			((int) ((data) >> 32))
+#define URING_FD(data)			((int) ((data) & 0xFFFFFFFF))
+
+/* Request tags */
+enum
+{
+	URING_POLL=1,
+	URING_WRITE_POLL,
+	URING_DEV_POLL,
+	URING_READ,
+	URING_WRITE,
+	URING_PAUSE,
+	URING_CANCEL
+};
+
+/* State of an fd */
+#define URING_POLLING	0x01		/* Poll in flight */
+#define URING_READING	0x02		/* Poll and read in flight */
+#define URING_READY		0x04		/* Poll finished, not reported yet */
+#define URING_WRITE_POLLING	0x08	/* The same for writability */
+#define URING_WRITE_READY	0x10
+
+struct uring_t {
+	int fd;
+	unsigned int entries;
+	unsigned int tail;					/* SQEs queued, published at submit */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_len, cq_len, sqes_len;
+	struct io_uring_sqe *chain;			/* Last write of the output chain */
+	struct __kernel_timespec pause[URING_ENTRIES];	/* Timeouts, by SQE */
+	char out[URING_ENTRIES][FRAME_EVENTS * sizeof(struct input_event)];	/* Written data */
+	unsigned char out_busy[URING_ENTRIES];
+	int out_fd[URING_ENTRIES];			/* Of the write of a slot */
+	size_t out_len[URING_ENTRIES];
+	unsigned char out_pause[URING_ENTRIES];	/* Write waits behind a pause */
+	unsigned int out_next;				/* Next slot of out */
+	unsigned int writes;				/* Writes in flight */
+	int ext_arg;						/* Waits can time out */
+	unsigned long enters;				/* io_uring_enter() calls */
+	struct device_fds_t *dev_fds;		/* Of the last uring_wait() */
+	int max_fd;
+	unsigned char state[FD_SETSIZE];
+};
+
+/* Static variables */
+static struct uring_t uring = { .fd = -1 };
+
+static int uring_enter(unsigned int min_complete, unsigned int flags);
+static int uring_enter_wait(long timeout_us);
+static struct io_uring_sqe *uring_get_sqe(unsigned int needed);
+static void uring_queue_read(int fd, struct evdev_t *evdev);
+static void uring_queue_poll(int fd, int write);
+static void uring_cancel_poll(int fd, int write);
+static inline int uring_cq_ready(void);
+static void uring_reap(struct device_fds_t *dev_fds);
+static void uring_link(void);
+
+/* Publish the queued SQEs and enter the kernel */
+static int uring_enter(unsigned int min_complete, unsigned int flags)
+{
+	unsigned int count;
+
+	__atomic_store_n(uring.sq_tail, uring.tail, __ATOMIC_RELEASE);
+	count = uring.tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+	/* Published SQEs can no longer be linked to */
+	uring.chain = NULL;
+	if (count == 0 && min_complete == 0)
+		return 0;
+	uring.enters++;
+	return syscall(__NR_io_uring_enter, uring.fd, count, min_complete, flags, NULL, 0);
+}
+
+/* Submit and sleep until a request finishes, for at most timeout_us if it
+ * is not negative. A wait that cannot time out on an older kernel does
+ * not sleep; the event loop then polls until its timer is due. */
+static int uring_enter_wait(long timeout_us)
+{
+#ifdef IORING_ENTER_EXT_ARG
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int count;
+	int ret;
+	
+	if (timeout_us >= 0 && uring.ext_arg)
+	{
+		__atomic_store_n(uring.sq_tail, uring.tail, __ATOMIC_RELEASE);
+		count = uring.tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+		uring.chain = NULL;
+		ts.tv_sec = timeout_us / 1000000;
+		ts.tv_nsec = (timeout_us % 1000000) * 1000;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (unsigned long) &ts;
+		uring.enters++;
+		ret = syscall(__NR_io_uring_enter, uring.fd, count, 1,
+		              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		if (ret < 0 && errno == ETIME)
+			return 0;
+		return ret;
+	}
+#endif
+	return uring_enter((timeout_us < 0) ? 1 : 0, IORING_ENTER_GETEVENTS);
+}
+
+/* Get a cleared SQE, with room for needed - 1 more behind it so that
+ * linked requests are submitted together. Returns NULL if the queue is
+ * full. */
+static struct io_uring_sqe *uring_get_sqe(unsigned int needed)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int index;
+
+	if (uring.tail + needed - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) > uring.entries)
+	{
+		uring_enter(0, 0);
+		if (uring.tail + needed - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) > uring.entries)
+			return NULL;
+	}
+	index = uring.tail & *uring.sq_mask;
+	sqe = &uring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	uring.sq_array[index] = index;
+	uring.tail++;
+	return sqe;
+}
+
+/* Read an event handler when it becomes readable. The handlers are opened
+ * non-blocking, so a plain read would fail with EAGAIN instead of waiting. */
+static void uring_queue_read(int fd, struct evdev_t *evdev)
+{
+	struct io_uring_sqe *sqe;
+	size_t len;
+
+	if ((sqe = uring_get_sqe(2)) == NULL)
+		return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll_events = POLLIN;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = URING_DATA(URING_DEV_POLL, fd);
+
+	sqe = uring_get_sqe(1);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) evdev_read_buffer(evdev, &len);
+	sqe->len = len;
+	sqe->user_data = URING_DATA(URING_READ, fd);
+	uring.state[fd] |= URING_READING;
+}
+
+static void uring_queue_poll(int fd, int write)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = uring_get_sqe(1)) == NULL)
+		return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll_events = write ? POLLOUT : POLLIN;
+	sqe->user_data = URING_DATA(write ? URING_WRITE_POLL : URING_POLL, fd);
+	uring.state[fd] |= write ? URING_WRITE_POLLING : URING_POLLING;
+}
+
+/* Cancel the poll of an fd that is no longer listened to */
+static void uring_cancel_poll(int fd, int write)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = uring_get_sqe(1)) == NULL)
+		return;
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = URING_DATA(write ? URING_WRITE_POLL : URING_POLL, fd);
+	sqe->user_data = URING_DATA(URING_CANCEL, fd);
+	uring.state[fd] &= write ? ~URING_WRITE_POLLING : ~URING_POLLING;
+}
+
+static inline int uring_cq_ready(void)
+{
+	return *uring.cq_head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+}
+
+/* Handle the finished requests */
+static void uring_reap(struct device_fds_t *dev_fds)
+{
+	struct io_uring_cqe *cqe;
+	struct evdev_t *evdev;
+	unsigned int head, tail;
+	int fd;
+
+	head = *uring.cq_head;
+	tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+	{
+		cqe = &uring.cqes[head & *uring.cq_mask];
+		fd = URING_FD(cqe->user_data);
+		switch (URING_TAG(cqe->user_data))
+		{
+		case URING_POLL:
+			uring.state[fd] &= ~URING_POLLING;
+			if (cqe->res != -ECANCELED)
+				uring.state[fd] |= URING_READY;
+			break;
+		case URING_WRITE_POLL:
+			uring.state[fd] &= ~URING_WRITE_POLLING;
+			if (cqe->res != -ECANCELED)
+				uring.state[fd] |= URING_WRITE_READY;
+			break;
+		case URING_READ:
+			uring.state[fd] &= ~URING_READING;
+			if (dev_fds != NULL && (evdev = device_fds_evdev(dev_fds, fd)) != NULL)
+				evdev_read_done(evdev, cqe->res);
+			break;
+		case URING_WRITE:
+			uring.out_busy[fd] = 0;
+			uring.writes--;
+			if (cqe->res < 0)
+				uinput_write_failed(uring.out_fd[fd], uring.out[fd], uring.out_len[fd],
+				                    uring.out_pause[fd], -cqe->res);
+			break;
+		}
+	}
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Set up the rings. Returns 0 on success, -1 if io_uring cannot be used. */
+int uring_init(void)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	if ((uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+	{
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: io_uring is not available: %s",
+				strerror(errno));
+		return -1;
+	}
+	/* Reads need fast poll, the output chain must never lose completions */
+	if (!(p.features & IORING_FEAT_FAST_POLL) || !(p.features & IORING_FEAT_NODROP) ||
+	    p.sq_entries > URING_ENTRIES)
+	{
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: io_uring of this kernel is too old.");
+		uring_close();
+		return -1;
+	}
+
+	uring.entries = p.sq_entries;
+#ifdef IORING_FEAT_EXT_ARG
+	uring.ext_arg = (p.features & IORING_FEAT_EXT_ARG) != 0;
+#endif
+	uring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	uring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	uring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (uring.cq_len > uring.sq_len)
+			uring.sq_len = uring.cq_len;
+		uring.cq_len = 0;
+	}
+	uring.sq_map = mmap(NULL, uring.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                    uring.fd, IORING_OFF_SQ_RING);
+	if (uring.sq_map == MAP_FAILED)
+		goto error;
+	if (uring.cq_len == 0)
+		uring.cq_map = uring.sq_map;
+	else if ((uring.cq_map = mmap(NULL, uring.cq_len, PROT_READ | PROT_WRITE,
+	                              MAP_SHARED | MAP_POPULATE, uring.fd,
+	                              IORING_OFF_CQ_RING)) == MAP_FAILED)
+		goto error;
+	uring.sqes = (struct io_uring_sqe *) mmap(NULL, uring.sqes_len, PROT_READ | PROT_WRITE,
+	                                          MAP_SHARED | MAP_POPULATE, uring.fd,
+	                                          IORING_OFF_SQES);
+	if (uring.sqes == MAP_FAILED)
+		goto error;
+
+	uring.sq_head = (unsigned int *) ((char *) uring.sq_map + p.sq_off.head);
+	uring.sq_tail = (unsigned int *) ((char *) uring.sq_map + p.sq_off.tail);
+	uring.sq_mask = (unsigned int *) ((char *) uring.sq_map + p.sq_off.ring_mask);
+	uring.sq_array = (unsigned int *) ((char *) uring.sq_map + p.sq_off.array);
+	uring.cq_head = (unsigned int *) ((char *) uring.cq_map + p.cq_off.head);
+	uring.cq_tail = (unsigned int *) ((char *) uring.cq_map + p.cq_off.tail);
+	uring.cq_mask = (unsigned int *) ((char *) uring.cq_map + p.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *) ((char *) uring.cq_map + p.cq_off.cqes);
+	uring.tail = *uring.sq_tail;
+	uring.chain = NULL;
+	uring.max_fd = -1;
+	memset(uring.state, 0, sizeof(uring.state));
+	memset(uring.out_busy, 0, sizeof(uring.out_busy));
+	uring.out_next = 0;
+	uring.writes = 0;
+
+	btnx_log(LOG_INFO, OUT_PRE "Using io_uring.");
+	return 0;
+
+error:
+	btnx_log(LOG_WARNING, OUT_PRE "Warning: could not map io_uring: %s", strerror(errno));
+	uring_close();
+	return -1;
+}
+
+/* Submit the writes still queued and tear down the rings. Called before
+ * the event handlers are closed. */
+void uring_close(void)
+{
+	if (uring.fd < 0)
+		return;
+	if (uring.sqes != NULL && uring.sqes != MAP_FAILED)
+	{
+		uring_enter(0, 0);
+		munmap(uring.sqes, uring.sqes_len);
+	}
+	if (uring.cq_map != NULL && uring.cq_map != MAP_FAILED && uring.cq_map != uring.sq_map)
+		munmap(uring.cq_map, uring.cq_len);
+	if (uring.sq_map != NULL && uring.sq_map != MAP_FAILED)
+		munmap(uring.sq_map, uring.sq_len);
+	close(uring.fd);
+	memset(&uring, 0, sizeof(uring));
+	uring.fd = -1;
+}
+
+int uring_active(void)
+{
+	return uring.fd >= 0;
+}
+
+/* Wait for any of the fds to become readable, or any of wfds, if not
+ * NULL, writable, like select(). Event handlers are reported once their
+ * read has finished; evdev_read() then decodes it without a system call.
+ * With spin_us, the completion queue is polled without sleeping for a
+ * bounded window first. A timeout_us that is not negative limits the
+ * wait. */
+int uring_wait(struct device_fds_t *dev_fds, fd_set *fds, fd_set *wfds, int max_fd,
+               int spin_us, long timeout_us)
+{
+	struct timespec spin_start;
+	struct evdev_t *evdev;
+	int fd, last, ret, ready=0;
+
+	last = (max_fd > uring.max_fd) ? max_fd : uring.max_fd;
+	for (fd=0; fd<=last; fd++)
+	{
+		if (fd > max_fd || wfds == NULL || !FD_ISSET(fd, wfds))
+		{
+			if (uring.state[fd] & URING_WRITE_POLLING)
+				uring_cancel_poll(fd, 1);
+			uring.state[fd] &= ~URING_WRITE_READY;
+		}
+		else if (uring.state[fd] & URING_WRITE_READY)
+			ready++;
+		else if (!(uring.state[fd] & URING_WRITE_POLLING))
+			uring_queue_poll(fd, 1);
+		
+		if (fd > max_fd || !FD_ISSET(fd, fds))
+		{
+			if (uring.state[fd] & URING_POLLING)
+				uring_cancel_poll(fd, 0);
+			uring.state[fd] &= ~URING_READY;
+		}
+		else if ((evdev = device_fds_evdev(dev_fds, fd)) != NULL)
+		{
+			if (evdev_read_ready(evdev))
+				ready++;
+			else if (!(uring.state[fd] & URING_READING))
+				uring_queue_read(fd, evdev);
+		}
+		else if (uring.state[fd] & URING_READY)
+			ready++;
+		else if (!(uring.state[fd] & URING_POLLING))
+			uring_queue_poll(fd, 0);
+	}
+	uring.max_fd = max_fd;
+	uring.dev_fds = dev_fds;
+
+	if (ready == 0 && spin_us > 0)
+	{
+		if (timeout_us >= 0 && timeout_us < spin_us)
+			spin_us = timeout_us;
+		uring_enter(0, 0);
+		clock_gettime(CLOCK_MONOTONIC, &spin_start);
+		while (!uring_cq_ready() && realtime_elapsed_us(&spin_start) < spin_us)
+			;
+		if (timeout_us >= 0)
+			timeout_us -= spin_us;
+	}
+	if (ready == 0 && !uring_cq_ready())
+		ret = uring_enter_wait(timeout_us);
+	else
+		ret = uring_enter(0, IORING_ENTER_GETEVENTS);
+	if (ret < 0 && errno != EINTR)
+		return -1;
+	uring_reap(dev_fds);
+
+	ready = 0;
+	for (fd=0; fd<=max_fd; fd++)
+	{
+		if (wfds != NULL && FD_ISSET(fd, wfds))
+		{
+			if (uring.state[fd] & URING_WRITE_READY)
+			{
+				uring.state[fd] &= ~URING_WRITE_READY;
+				ready++;
+			}
+			else
+				FD_CLR(fd, wfds);
+		}
+		if (!FD_ISSET(fd, fds))
+			continue;
+		if ((evdev = device_fds_evdev(dev_fds, fd)) != NULL)
+		{
+			if (!evdev_read_ready(evdev))
+				FD_CLR(fd, fds);
+			else
+				ready++;
+		}
+		/* Polls are re-armed when the fd is not handled right away */
+		else if (uring.state[fd] & URING_READY)
+		{
+			uring.state[fd] &= ~URING_READY;
+			ready++;
+		}
+		else
+			FD_CLR(fd, fds);
+	}
+	return ready;
+}
+
+/* Link the next request to the end of the output chain. A write that
+ * fails ends the chain, a pause that times out does not. */
+static void uring_link(void)
+{
+	if (uring.chain == NULL)
+		return;
+	if (uring.chain->opcode == IORING_OP_TIMEOUT)
+		uring.chain->flags |= IOSQE_IO_HARDLINK;
+	else
+		uring.chain->flags |= IOSQE_IO_LINK;
+}
+
+/* Queue a write behind the writes queued before it, after a pause of
+ * pause_us. If one of them fails, the writes behind it are cancelled, so
+ * that none overtakes it; all of them come back through
+ * uinput_write_failed(), in order. The data is
+ * copied, buf can be reused right away. Returns 0 if the write is queued,
+ * 1 if it has to wait until the writes in flight have finished, or -1 if
+ * it is dropped. Never waits itself. */
+int uring_write(int fd, const void *buf, size_t len, int pause_us)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int slot, needed = (pause_us > 0) ? 2 : 1;
+	
+	if (len > sizeof(uring.out[0]))
+	{
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: io_uring write too long, dropped.");
+		return -1;
+	}
+	/* Making room submits the queue, which ends the chain */
+	if (uring.tail + needed - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) > uring.entries)
+		uring_enter(0, 0);
+	/* A new chain must not overtake the writes of the previous one, which
+	 * may still wait behind a pause or for the device, and their copies
+	 * must not be overwritten. The caller keeps the write until then. */
+	slot = uring.out_next & (URING_ENTRIES - 1);
+	if ((uring.chain == NULL && uring.writes > 0) || uring.out_busy[slot])
+		return 1;
+
+	if (pause_us > 0 && (sqe = uring_get_sqe(2)) != NULL)
+	{
+		uring_link();
+		uring.pause[(sqe - uring.sqes)].tv_sec = 0;
+		uring.pause[(sqe - uring.sqes)].tv_nsec = pause_us * 1000L;
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = (unsigned long) &uring.pause[(sqe - uring.sqes)];
+		sqe->len = 1;
+		sqe->user_data = URING_DATA(URING_PAUSE, fd);
+		uring.chain = sqe;
+	}
+	if ((sqe = uring_get_sqe(1)) == NULL)
+	{
+		btnx_log(LOG_WARNING, OUT_PRE "Warning: io_uring queue is full, write dropped.");
+		return -1;
+	}
+	uring_link();
+	memcpy(uring.out[slot], buf, len);
+	uring.out_busy[slot] = 1;
+	uring.out_fd[slot] = fd;
+	uring.out_len[slot] = len;
+	uring.out_pause[slot] = (pause_us > 0);
+	uring.out_next++;
+	uring.writes++;
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) uring.out[slot];
+	sqe->len = len;
+	sqe->user_data = URING_DATA(URING_WRITE, slot);
+	uring.chain = sqe;
+	return 0;
+}
+
+/* Returns 1 while queued writes have not finished */
+int uring_writing(void)
+{
+	return uring.writes > 0;
+}
+
+/* Number of io_uring_enter() calls so far, for btnx-bench */
+unsigned long uring_enters(void)
+{
+	return uring.enters;
+}
+
+#else /* HAVE_LINUX_IO_URING_H */
+
+int uring_init(void)
+{
+	btnx_log(LOG_WARNING, OUT_PRE "Warning: built without io_uring support.");
+	return -1;
+}
+
+void uring_close(void)
+{
+}
+
+int uring_active(void)
+{
+	return 0;
+}
+
+int uring_wait(struct device_fds_t *dev_fds, fd_set *fds, fd_set *wfds, int max_fd,
+               int spin_us, long timeout_us)
+{
+	(void) dev_fds; (void) fds; (void) wfds; (void) max_fd; (void) spin_us; (void) timeout_us;
+	return -1;
+}
+
+int uring_write(int fd, const void *buf, size_t len, int pause_us)
+{
+	(void) fd; (void) buf; (void) len; (void) pause_us;
+	return -1;
+}
+
+int uring_writing(void)
+{
+	return 0;
+}
+
+unsigned long uring_enters(void)
+{
+	return 0;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
@@ -0,0 +1,25 @@
+ /* 
+  * Copyright (C) 2007  Olli Salonen <oasalonen@gmail.com>
+  * see btnx.c for detailed license information
+  */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <sys/types.h>
+#include <sys/select.h>
+
+#include "device.h"
+
+#define URING_ENTRIES	64		/* Submission queue size, a power of 2 */
+
+int uring_init(void);
+void uring_close(void);
+int uring_active(void);
+int uring_wait(struct device_fds_t *dev_fds, fd_set *fds, fd_set *wfds, int max_fd,
+               int spin_us, long timeout_us);
+int uring_write(int fd, const void *buf, size_t len, int pause_us);
+int uring_writing(void);
+unsigned long uring_enters(void);
+
+#endif /*URING_H_*/